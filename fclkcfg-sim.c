@@ -0,0 +1,792 @@
+/*********************************************************************************
+ *
+ *       Copyright (C) 2025 Ichiro Kawazome
+ *       All rights reserved.
+ *
+ *       Redistribution and use in source and binary forms, with or without
+ *       modification, are permitted provided that the following conditions
+ *       are met:
+ *
+ *         1. Redistributions of source code must retain the above copyright
+ *            notice, this list of conditions and the following disclaimer.
+ *
+ *         2. Redistributions in binary form must reproduce the above copyright
+ *            notice, this list of conditions and the following disclaimer in
+ *            the documentation and/or other materials provided with the
+ *            distribution.
+ *
+ *       THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *       "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *       LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *       A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ *       OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *       SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *       LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *       DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *       THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *       (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *       OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ********************************************************************************/
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/platform_device.h>
+#include <linux/clk.h>
+#include <linux/clk-provider.h>
+#include <linux/clkdev.h>
+#include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/of.h>
+#include <linux/version.h>
+
+/**
+ * DOC: fclkcfg-sim constants
+ *
+ * fclkcfg-sim registers a software clock tree shaped like the PL clocks of
+ * ZynqMP, so that fclkcfg can be loaded and measured without hardware.
+ *
+ *   sim_ref ---+--- iopll ---+
+ *              +--- rpll  ---+--- pl<N>_mux --- pl<N>_div0 --- pl<N>_div1 --- pl<N>_ref
+ *              +--- dpll  ---+
+ *
+ * The clocks are registered with clock lookups (clkdev) by their names, and
+ * with an OF clock provider when probed from a device tree node.
+ */
+
+MODULE_DESCRIPTION("FPGA Clock Configuration Simulated Clock Provider");
+MODULE_AUTHOR("ikwzm");
+MODULE_LICENSE("Dual BSD/GPL");
+
+#define DRIVER_NAME        "fclkcfg-sim"
+
+#define SIM_REF_RATE       33333333
+#define SIM_PLL_NUM        3
+#define SIM_PLL_MULT_MIN   25
+#define SIM_PLL_MULT_MAX   125
+#define SIM_PL_NUM         4
+#define SIM_DIV_MAX        63
+
+/**
+ * DOC: fclkcfg-sim clock index
+ *
+ * Index of the clocks in the OF clock provider (#clock-cells = <1>).
+ *
+ * * 0          - sim_ref
+ * * 1, 2, 3    - iopll, rpll, dpll
+ * * 4 + 4*N    - pl<N>_mux
+ * * 5 + 4*N    - pl<N>_div0
+ * * 6 + 4*N    - pl<N>_div1
+ * * 7 + 4*N    - pl<N>_ref (7, 11, 15, 19)
+ */
+#define SIM_CLK_REF        0
+#define SIM_CLK_PLL(n)     (1 + (n))
+#define SIM_CLK_PL_MUX(n)  (4 + 4*(n))
+#define SIM_CLK_PL_DIV0(n) (5 + 4*(n))
+#define SIM_CLK_PL_DIV1(n) (6 + 4*(n))
+#define SIM_CLK_PL_REF(n)  (7 + 4*(n))
+#define SIM_CLK_NUM        (4 + 4*SIM_PL_NUM)
+
+/**
+ * DOC: fclkcfg-sim static variables
+ *
+ * * standalone          - create a platform device at module load.
+ * * pll_latency_us      - latency of PLL set_rate.
+ * * mux_latency_us      - latency of mux set_parent.
+ * * div_latency_us      - latency of divider set_rate.
+ * * gate_latency_us     - latency of gate enable/disable.
+ * * disable_failures    - number of reads of is_enabled that still return 1 after disable.
+ * * set_rate_failures   - number of next divider set_rate calls to fail.
+ * * set_parent_failures - number of next mux set_parent calls to fail.
+ * * glitch_count        - number of changes made while the output was enabled.
+ */
+
+/**
+ * standalone       - create a platform device at module load.
+ */
+static int            standalone = 1;
+module_param(         standalone , int, S_IRUGO);
+MODULE_PARM_DESC(     standalone , DRIVER_NAME " create a platform device at module load");
+
+/**
+ * pll_latency_us   - latency of PLL set_rate.
+ */
+static int            pll_latency_us = 100;
+module_param(         pll_latency_us , int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(     pll_latency_us , DRIVER_NAME " latency of PLL set_rate [usec]");
+
+/**
+ * mux_latency_us   - latency of mux set_parent.
+ */
+static int            mux_latency_us = 10;
+module_param(         mux_latency_us , int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(     mux_latency_us , DRIVER_NAME " latency of mux set_parent [usec]");
+
+/**
+ * div_latency_us   - latency of divider set_rate.
+ */
+static int            div_latency_us = 10;
+module_param(         div_latency_us , int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(     div_latency_us , DRIVER_NAME " latency of divider set_rate [usec]");
+
+/**
+ * gate_latency_us  - latency of gate enable/disable.
+ */
+static int            gate_latency_us = 1;
+module_param(         gate_latency_us , int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(     gate_latency_us , DRIVER_NAME " latency of gate enable/disable [usec]");
+
+/**
+ * disable_failures - number of reads of is_enabled that still return 1 after disable.
+ */
+static int            disable_failures = 0;
+module_param(         disable_failures , int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(     disable_failures , DRIVER_NAME " number of is_enabled reads that return 1 after disable");
+
+/**
+ * set_rate_failures - number of next divider set_rate calls to fail.
+ */
+static int            set_rate_failures = 0;
+module_param(         set_rate_failures , int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(     set_rate_failures , DRIVER_NAME " number of next divider set_rate calls to fail");
+
+/**
+ * set_parent_failures - number of next mux set_parent calls to fail.
+ */
+static int            set_parent_failures = 0;
+module_param(         set_parent_failures , int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(     set_parent_failures , DRIVER_NAME " number of next mux set_parent calls to fail");
+
+/**
+ * glitch_count     - number of changes made while the output was enabled.
+ */
+static int            glitch_count = 0;
+module_param(         glitch_count , int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(     glitch_count , DRIVER_NAME " number of changes made while the output was enabled");
+
+/**
+ * DOC: fclkcfg-sim clock structure
+ *
+ * * struct fclkcfg_sim_pll  - simulated PLL.
+ * * struct fclkcfg_sim_mux  - simulated mux.
+ * * struct fclkcfg_sim_div  - simulated divider.
+ * * struct fclkcfg_sim_gate - simulated gate.
+ * * struct fclkcfg_sim_data - simulated clock tree.
+ */
+struct fclkcfg_sim_gate;
+
+struct fclkcfg_sim_pll {
+    struct clk_hw            hw;
+    unsigned int             mult;
+};
+
+struct fclkcfg_sim_mux {
+    struct clk_hw            hw;
+    u8                       index;
+    struct fclkcfg_sim_gate* gate;
+};
+
+struct fclkcfg_sim_div {
+    struct clk_hw            hw;
+    unsigned int             div;
+    struct fclkcfg_sim_gate* gate;
+};
+
+struct fclkcfg_sim_gate {
+    struct clk_hw            hw;
+    bool                     enabled;
+    int                      disable_lag;
+};
+
+struct fclkcfg_sim_data {
+    struct device*           dev;
+    struct clk_hw*           ref;
+    struct fclkcfg_sim_pll   pll[SIM_PLL_NUM];
+    struct fclkcfg_sim_mux   mux[SIM_PL_NUM];
+    struct fclkcfg_sim_div   div0[SIM_PL_NUM];
+    struct fclkcfg_sim_div   div1[SIM_PL_NUM];
+    struct fclkcfg_sim_gate  gate[SIM_PL_NUM];
+    char                     names[SIM_CLK_NUM][16];
+    struct clk_lookup*       lookups[SIM_CLK_NUM];
+    bool                     provider_done;
+    struct clk_hw_onecell_data onecell;
+};
+
+#define to_sim_pll(_hw)  container_of(_hw, struct fclkcfg_sim_pll , hw)
+#define to_sim_mux(_hw)  container_of(_hw, struct fclkcfg_sim_mux , hw)
+#define to_sim_div(_hw)  container_of(_hw, struct fclkcfg_sim_div , hw)
+#define to_sim_gate(_hw) container_of(_hw, struct fclkcfg_sim_gate, hw)
+
+/**
+ * DOC: fclkcfg-sim clock operations
+ *
+ * * fclkcfg_sim_sleep()         - sleep for latency of operation.
+ * * fclkcfg_sim_inject_failure() - consume injected failure count.
+ * * fclkcfg_sim_check_glitch()  - count change while output is enabled.
+ * * fclkcfg_sim_pll_ops         - PLL operations.
+ * * fclkcfg_sim_mux_ops         - mux operations.
+ * * fclkcfg_sim_div_ops         - divider operations.
+ * * fclkcfg_sim_gate_ops        - gate operations.
+ */
+
+/**
+ * fclkcfg_sim_sleep() - sleep for latency of operation.
+ */
+static void fclkcfg_sim_sleep(int usec)
+{
+    if (usec > 0)
+        usleep_range(usec, usec + (usec >> 4) + 1);
+}
+
+/**
+ * fclkcfg_sim_inject_failure() - consume injected failure count.
+ *
+ * Return:      true if the operation should fail.
+ */
+static bool fclkcfg_sim_inject_failure(int* failures)
+{
+    if (READ_ONCE(*failures) <= 0)
+        return false;
+    WRITE_ONCE(*failures, READ_ONCE(*failures) - 1);
+    return true;
+}
+
+/**
+ * fclkcfg_sim_check_glitch() - count change while output is enabled.
+ */
+static void fclkcfg_sim_check_glitch(struct fclkcfg_sim_gate* gate, const char* what)
+{
+    if ((gate != NULL) && (gate->enabled == true)) {
+        glitch_count++;
+        pr_warn_ratelimited("%s: %s changed while %s is enabled.\n",
+                            DRIVER_NAME, what, clk_hw_get_name(&gate->hw));
+    }
+}
+
+/**
+ * fclkcfg_sim_pll_recalc_rate()
+ */
+static unsigned long fclkcfg_sim_pll_recalc_rate(struct clk_hw* hw, unsigned long parent_rate)
+{
+    return parent_rate * to_sim_pll(hw)->mult;
+}
+
+/**
+ * fclkcfg_sim_pll_mult() - multiplier for rate.
+ */
+static unsigned int fclkcfg_sim_pll_mult(unsigned long rate, unsigned long parent_rate)
+{
+    unsigned long mult = (parent_rate) ? DIV_ROUND_CLOSEST(rate, parent_rate) : SIM_PLL_MULT_MIN;
+    return clamp(mult, (unsigned long)SIM_PLL_MULT_MIN, (unsigned long)SIM_PLL_MULT_MAX);
+}
+
+/**
+ * fclkcfg_sim_pll_determine_rate()
+ */
+static int fclkcfg_sim_pll_determine_rate(struct clk_hw* hw, struct clk_rate_request* req)
+{
+    req->rate = req->best_parent_rate * fclkcfg_sim_pll_mult(req->rate, req->best_parent_rate);
+    return 0;
+}
+
+/**
+ * fclkcfg_sim_pll_set_rate()
+ */
+static int fclkcfg_sim_pll_set_rate(struct clk_hw* hw, unsigned long rate, unsigned long parent_rate)
+{
+    fclkcfg_sim_sleep(pll_latency_us);
+    to_sim_pll(hw)->mult = fclkcfg_sim_pll_mult(rate, parent_rate);
+    return 0;
+}
+
+static const struct clk_ops fclkcfg_sim_pll_ops = {
+    .recalc_rate    = fclkcfg_sim_pll_recalc_rate,
+    .determine_rate = fclkcfg_sim_pll_determine_rate,
+    .set_rate       = fclkcfg_sim_pll_set_rate,
+};
+
+/**
+ * fclkcfg_sim_mux_get_parent()
+ */
+static u8 fclkcfg_sim_mux_get_parent(struct clk_hw* hw)
+{
+    return to_sim_mux(hw)->index;
+}
+
+/**
+ * fclkcfg_sim_mux_set_parent()
+ */
+static int fclkcfg_sim_mux_set_parent(struct clk_hw* hw, u8 index)
+{
+    struct fclkcfg_sim_mux* mux = to_sim_mux(hw);
+
+    fclkcfg_sim_sleep(mux_latency_us);
+    if (fclkcfg_sim_inject_failure(&set_parent_failures))
+        return -EIO;
+    fclkcfg_sim_check_glitch(mux->gate, clk_hw_get_name(hw));
+    mux->index = index;
+    return 0;
+}
+
+static const struct clk_ops fclkcfg_sim_mux_ops = {
+    .get_parent     = fclkcfg_sim_mux_get_parent,
+    .set_parent     = fclkcfg_sim_mux_set_parent,
+};
+
+/**
+ * fclkcfg_sim_div_recalc_rate()
+ */
+static unsigned long fclkcfg_sim_div_recalc_rate(struct clk_hw* hw, unsigned long parent_rate)
+{
+    return parent_rate / to_sim_div(hw)->div;
+}
+
+/**
+ * fclkcfg_sim_div_value() - divider value for rate.
+ */
+static unsigned int fclkcfg_sim_div_value(unsigned long rate, unsigned long parent_rate)
+{
+    unsigned long div = (rate) ? DIV_ROUND_CLOSEST(parent_rate, rate) : SIM_DIV_MAX;
+    return clamp(div, 1UL, (unsigned long)SIM_DIV_MAX);
+}
+
+/**
+ * fclkcfg_sim_rate_diff()
+ */
+static inline unsigned long fclkcfg_sim_rate_diff(unsigned long a, unsigned long b)
+{
+    return (a > b) ? a - b : b - a;
+}
+
+/**
+ * fclkcfg_sim_div_determine_rate()
+ *
+ * With CLK_SET_RATE_PARENT, every divider value is tried against the rate
+ * the parent can give, and the closest result is chosen.
+ */
+static int fclkcfg_sim_div_determine_rate(struct clk_hw* hw, struct clk_rate_request* req)
+{
+    struct clk_hw* parent = clk_hw_get_parent(hw);
+    unsigned long  best_rate        = 0;
+    unsigned long  best_parent_rate = req->best_parent_rate;
+    unsigned int   div;
+
+    if ((parent == NULL) || ((clk_hw_get_flags(hw) & CLK_SET_RATE_PARENT) == 0)) {
+        req->rate = req->best_parent_rate / fclkcfg_sim_div_value(req->rate, req->best_parent_rate);
+        return 0;
+    }
+    for (div = 1; div <= SIM_DIV_MAX; div++) {
+        unsigned long parent_rate;
+        unsigned long rate;
+        if (req->rate > ULONG_MAX / div)
+            break;
+        parent_rate = clk_hw_round_rate(parent, req->rate * div);
+        rate        = parent_rate / div;
+        if (fclkcfg_sim_rate_diff(rate, req->rate) < fclkcfg_sim_rate_diff(best_rate, req->rate)) {
+            best_rate        = rate;
+            best_parent_rate = parent_rate;
+        }
+    }
+    req->rate             = best_rate;
+    req->best_parent_rate = best_parent_rate;
+    req->best_parent_hw   = parent;
+    return 0;
+}
+
+/**
+ * fclkcfg_sim_div_set_rate()
+ */
+static int fclkcfg_sim_div_set_rate(struct clk_hw* hw, unsigned long rate, unsigned long parent_rate)
+{
+    struct fclkcfg_sim_div* div = to_sim_div(hw);
+
+    fclkcfg_sim_sleep(div_latency_us);
+    if (fclkcfg_sim_inject_failure(&set_rate_failures))
+        return -EIO;
+    fclkcfg_sim_check_glitch(div->gate, clk_hw_get_name(hw));
+    div->div = fclkcfg_sim_div_value(rate, parent_rate);
+    return 0;
+}
+
+static const struct clk_ops fclkcfg_sim_div_ops = {
+    .recalc_rate    = fclkcfg_sim_div_recalc_rate,
+    .determine_rate = fclkcfg_sim_div_determine_rate,
+    .set_rate       = fclkcfg_sim_div_set_rate,
+};
+
+/**
+ * fclkcfg_sim_gate_enable()
+ */
+static int fclkcfg_sim_gate_enable(struct clk_hw* hw)
+{
+    struct fclkcfg_sim_gate* gate = to_sim_gate(hw);
+
+    if (gate_latency_us > 0)
+        udelay(gate_latency_us);
+    gate->enabled     = true;
+    gate->disable_lag = 0;
+    return 0;
+}
+
+/**
+ * fclkcfg_sim_gate_disable()
+ *
+ * When disable_failures is N, is_enabled keeps returning 1 for the next N
+ * reads, as a gate whose status lags the disable would do. fclkcfg must
+ * not fail a transition for it, because no enable reference is left.
+ */
+static void fclkcfg_sim_gate_disable(struct clk_hw* hw)
+{
+    struct fclkcfg_sim_gate* gate = to_sim_gate(hw);
+
+    if (gate_latency_us > 0)
+        udelay(gate_latency_us);
+    gate->enabled     = false;
+    gate->disable_lag = READ_ONCE(disable_failures);
+}
+
+/**
+ * fclkcfg_sim_gate_is_enabled()
+ */
+static int fclkcfg_sim_gate_is_enabled(struct clk_hw* hw)
+{
+    struct fclkcfg_sim_gate* gate = to_sim_gate(hw);
+
+    if (gate->enabled == true)
+        return 1;
+    if (gate->disable_lag > 0) {
+        gate->disable_lag--;
+        return 1;
+    }
+    return 0;
+}
+
+static const struct clk_ops fclkcfg_sim_gate_ops = {
+    .enable         = fclkcfg_sim_gate_enable,
+    .disable        = fclkcfg_sim_gate_disable,
+    .is_enabled     = fclkcfg_sim_gate_is_enabled,
+};
+
+/**
+ * DOC: fclkcfg-sim clock tree operations
+ *
+ * * fclkcfg_sim_register()  - register one simulated clock.
+ * * fclkcfg_sim_cleanup()   - unregister simulated clock tree.
+ * * fclkcfg_sim_setup()     - register simulated clock tree.
+ */
+
+/**
+ * fclkcfg_sim_register() - register one simulated clock.
+ *
+ * @this:         Pointer to the fclkcfg-sim data.
+ * @index:        index of the clock.
+ * @hw:           clk_hw of the clock.
+ * @ops:          clock operations.
+ * @parent_names: names of parents.
+ * @num_parents:  number of parents.
+ * @flags:        clock framework flags.
+ * Return:        Success(=0) or error status(<0).
+ */
+static int fclkcfg_sim_register(
+    struct fclkcfg_sim_data* this,
+    int                      index,
+    struct clk_hw*           hw,
+    const struct clk_ops*    ops,
+    const char* const*       parent_names,
+    u8                       num_parents,
+    unsigned long            flags)
+{
+    struct clk_init_data init;
+    int                  retval;
+
+    memset(&init, 0, sizeof(init));
+    init.name         = this->names[index];
+    init.ops          = ops;
+    init.parent_names = parent_names;
+    init.num_parents  = num_parents;
+    init.flags        = flags;
+    hw->init          = &init;
+
+    retval = clk_hw_register(this->dev, hw);
+    hw->init          = NULL;
+    if (retval) {
+        dev_err(this->dev, "register %s failed(%d).\n", this->names[index], retval);
+        return retval;
+    }
+    this->onecell.hws[index] = hw;
+    return 0;
+}
+
+/**
+ * fclkcfg_sim_cleanup() - unregister simulated clock tree.
+ *
+ * @this:       Pointer to the fclkcfg-sim data.
+ */
+static void fclkcfg_sim_cleanup(struct fclkcfg_sim_data* this)
+{
+    int index;
+
+    if (this->provider_done == true) {
+        of_clk_del_provider(this->dev->of_node);
+        this->provider_done = false;
+    }
+    for (index = SIM_CLK_NUM-1; index >= 0; index--) {
+        if (this->lookups[index] != NULL) {
+            clkdev_drop(this->lookups[index]);
+            this->lookups[index] = NULL;
+        }
+        if (this->onecell.hws[index] != NULL) {
+            if (index == SIM_CLK_REF)
+                clk_hw_unregister_fixed_rate(this->onecell.hws[index]);
+            else
+                clk_hw_unregister(this->onecell.hws[index]);
+            this->onecell.hws[index] = NULL;
+        }
+    }
+}
+
+/**
+ * fclkcfg_sim_setup() - register simulated clock tree.
+ *
+ * @this:       Pointer to the fclkcfg-sim data.
+ * Return:      Success(=0) or error status(<0).
+ */
+static int fclkcfg_sim_setup(struct fclkcfg_sim_data* this)
+{
+    static const char* const pll_names[SIM_PLL_NUM] = {"iopll", "rpll", "dpll"};
+    static const unsigned int pll_mult[SIM_PLL_NUM] = {30, 45, 64};
+    const char*              parent_names[SIM_PLL_NUM];
+    int                      retval;
+    int                      n;
+
+    this->onecell.num = SIM_CLK_NUM;
+
+    snprintf(this->names[SIM_CLK_REF], sizeof(this->names[0]), "sim_ref");
+    this->ref = clk_hw_register_fixed_rate(this->dev, this->names[SIM_CLK_REF], NULL, 0, SIM_REF_RATE);
+    if (IS_ERR(this->ref)) {
+        retval    = PTR_ERR(this->ref);
+        this->ref = NULL;
+        dev_err(this->dev, "register %s failed(%d).\n", this->names[SIM_CLK_REF], retval);
+        goto failed;
+    }
+    this->onecell.hws[SIM_CLK_REF] = this->ref;
+
+    for (n = 0; n < SIM_PLL_NUM; n++) {
+        const char* ref_name = this->names[SIM_CLK_REF];
+        snprintf(this->names[SIM_CLK_PLL(n)], sizeof(this->names[0]), "%s", pll_names[n]);
+        this->pll[n].mult = pll_mult[n];
+        retval = fclkcfg_sim_register(this, SIM_CLK_PLL(n), &this->pll[n].hw,
+                                      &fclkcfg_sim_pll_ops, &ref_name, 1, 0);
+        if (retval)
+            goto failed;
+        parent_names[n] = this->names[SIM_CLK_PLL(n)];
+    }
+
+    for (n = 0; n < SIM_PL_NUM; n++) {
+        const char* name;
+        snprintf(this->names[SIM_CLK_PL_MUX(n) ], sizeof(this->names[0]), "pl%d_mux" , n);
+        snprintf(this->names[SIM_CLK_PL_DIV0(n)], sizeof(this->names[0]), "pl%d_div0", n);
+        snprintf(this->names[SIM_CLK_PL_DIV1(n)], sizeof(this->names[0]), "pl%d_div1", n);
+        snprintf(this->names[SIM_CLK_PL_REF(n) ], sizeof(this->names[0]), "pl%d_ref" , n);
+
+        this->mux[n].index  = 0;
+        this->mux[n].gate   = &this->gate[n];
+        this->div0[n].div   = 10;
+        this->div0[n].gate  = &this->gate[n];
+        this->div1[n].div   = 1;
+        this->div1[n].gate  = &this->gate[n];
+        this->gate[n].enabled = false;
+
+        retval = fclkcfg_sim_register(this, SIM_CLK_PL_MUX(n), &this->mux[n].hw,
+                                      &fclkcfg_sim_mux_ops, parent_names, SIM_PLL_NUM,
+                                      CLK_SET_PARENT_GATE | CLK_SET_RATE_NO_REPARENT);
+        if (retval)
+            goto failed;
+        name   = this->names[SIM_CLK_PL_MUX(n)];
+        retval = fclkcfg_sim_register(this, SIM_CLK_PL_DIV0(n), &this->div0[n].hw,
+                                      &fclkcfg_sim_div_ops, &name, 1,
+                                      CLK_SET_RATE_GATE);
+        if (retval)
+            goto failed;
+        name   = this->names[SIM_CLK_PL_DIV0(n)];
+        retval = fclkcfg_sim_register(this, SIM_CLK_PL_DIV1(n), &this->div1[n].hw,
+                                      &fclkcfg_sim_div_ops, &name, 1,
+                                      CLK_SET_RATE_GATE | CLK_SET_RATE_PARENT);
+        if (retval)
+            goto failed;
+        name   = this->names[SIM_CLK_PL_DIV1(n)];
+        retval = fclkcfg_sim_register(this, SIM_CLK_PL_REF(n), &this->gate[n].hw,
+                                      &fclkcfg_sim_gate_ops, &name, 1,
+                                      CLK_SET_RATE_PARENT);
+        if (retval)
+            goto failed;
+    }
+
+    for (n = 0; n < SIM_CLK_NUM; n++) {
+        this->lookups[n] = clkdev_hw_create(this->onecell.hws[n], this->names[n], NULL);
+        if (this->lookups[n] == NULL) {
+            dev_err(this->dev, "create clock lookup of %s failed.\n", this->names[n]);
+            retval = -ENOMEM;
+            goto failed;
+        }
+    }
+
+    if (this->dev->of_node != NULL) {
+        retval = of_clk_add_hw_provider(this->dev->of_node, of_clk_hw_onecell_get, &this->onecell);
+        if (retval) {
+            dev_err(this->dev, "of_clk_add_hw_provider failed(%d).\n", retval);
+            goto failed;
+        }
+        this->provider_done = true;
+    }
+    return 0;
+
+ failed:
+    fclkcfg_sim_cleanup(this);
+    return retval;
+}
+
+/**
+ * DOC: fclkcfg-sim platform driver
+ *
+ * * fclkcfg_sim_probe()     - probe call for the device.
+ * * fclkcfg_sim_remove()    - remove call for the device.
+ */
+
+/**
+ * fclkcfg_sim_probe() - probe call for the device.
+ *
+ * @pdev:	handle to the platform device structure.
+ * Return:      Success(=0) or error status(<0).
+ */
+static int fclkcfg_sim_probe(struct platform_device* pdev)
+{
+    struct fclkcfg_sim_data* this;
+    int                      retval;
+
+    this = devm_kzalloc(&pdev->dev, sizeof(*this) + SIM_CLK_NUM * sizeof(struct clk_hw*), GFP_KERNEL);
+    if (this == NULL)
+        return -ENOMEM;
+    this->dev = &pdev->dev;
+
+    retval = fclkcfg_sim_setup(this);
+    if (retval)
+        return retval;
+
+    platform_set_drvdata(pdev, this);
+    dev_info(&pdev->dev, "driver installed. pl0_ref..pl%d_ref are ready.\n", SIM_PL_NUM-1);
+    return 0;
+}
+
+/**
+ * _fclkcfg_sim_remove() - remove call for the device.
+ *
+ * @pdev:	handle to the platform device structure.
+ */
+static void _fclkcfg_sim_remove(struct platform_device* pdev)
+{
+    struct fclkcfg_sim_data* this = platform_get_drvdata(pdev);
+
+    if (this != NULL)
+        fclkcfg_sim_cleanup(this);
+    dev_info(&pdev->dev, "driver removed.\n");
+}
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 11, 0)
+static int fclkcfg_sim_remove(struct platform_device* pdev)
+{
+    _fclkcfg_sim_remove(pdev);
+    return 0;
+}
+#else
+static void fclkcfg_sim_remove(struct platform_device* pdev)
+{
+    _fclkcfg_sim_remove(pdev);
+}
+#endif
+
+/**
+ * Open Firmware Device Identifier Matching Table
+ */
+static struct of_device_id fclkcfg_sim_of_match[] = {
+    { .compatible = "ikwzm,fclkcfg-sim", },
+    { /* end of table */}
+};
+MODULE_DEVICE_TABLE(of, fclkcfg_sim_of_match);
+
+/**
+ * Platform Driver Structure
+ */
+static struct platform_driver fclkcfg_sim_platform_driver = {
+    .probe  = fclkcfg_sim_probe,
+    .remove = fclkcfg_sim_remove,
+    .driver = {
+        .owner = THIS_MODULE,
+        .name  = DRIVER_NAME,
+        .of_match_table = fclkcfg_sim_of_match,
+    },
+};
+static bool                    fclkcfg_sim_platform_driver_done = 0;
+static struct platform_device* fclkcfg_sim_standalone_device    = NULL;
+
+/**
+ * DOC: fclkcfg-sim kernel module operations
+ *
+ * * fclkcfg_sim_module_cleanup()
+ * * fclkcfg_sim_module_init()
+ * * fclkcfg_sim_module_exit()
+ */
+
+/**
+ * fclkcfg_sim_module_cleanup()
+ */
+static void fclkcfg_sim_module_cleanup(void)
+{
+    if (fclkcfg_sim_standalone_device != NULL){platform_device_unregister(fclkcfg_sim_standalone_device);}
+    if (fclkcfg_sim_platform_driver_done     ){platform_driver_unregister(&fclkcfg_sim_platform_driver);}
+    fclkcfg_sim_standalone_device    = NULL;
+    fclkcfg_sim_platform_driver_done = 0;
+}
+
+/**
+ * fclkcfg_sim_module_exit()
+ */
+static void __exit fclkcfg_sim_module_exit(void)
+{
+    fclkcfg_sim_module_cleanup();
+}
+
+/**
+ * fclkcfg_sim_module_init()
+ *
+ * When standalone is set, a platform device without device tree node is
+ * created, so that the clocks can be used through clock lookups on systems
+ * without device tree (e.g. x86).
+ */
+static int __init fclkcfg_sim_module_init(void)
+{
+    int retval;
+
+    retval = platform_driver_register(&fclkcfg_sim_platform_driver);
+    if (retval) {
+        printk(KERN_ERR "%s: couldn't register platform driver\n", DRIVER_NAME);
+        goto failed;
+    }
+    fclkcfg_sim_platform_driver_done = 1;
+
+    if (standalone) {
+        fclkcfg_sim_standalone_device = platform_device_register_simple(DRIVER_NAME, -1, NULL, 0);
+        if (IS_ERR(fclkcfg_sim_standalone_device)) {
+            retval = PTR_ERR(fclkcfg_sim_standalone_device);
+            fclkcfg_sim_standalone_device = NULL;
+            printk(KERN_ERR "%s: couldn't register platform device\n", DRIVER_NAME);
+            goto failed;
+        }
+    }
+    return 0;
+
+ failed:
+    fclkcfg_sim_module_cleanup();
+    return retval;
+}
+
+module_init(fclkcfg_sim_module_init);
+module_exit(fclkcfg_sim_module_exit);
@@ -34,6 +34,17 @@
 #include <linux/platform_device.h>
 #include <linux/clk.h>
 #include <linux/clk-provider.h>
+#include <linux/reset.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/workqueue.h>
+#include <linux/math64.h>
+#include <linux/notifier.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/configfs.h>
 #include <linux/slab.h>
 #include <linux/of.h>
 #include <linux/of_fdt.h>
@@ -43,7 +54,9 @@
 #include <linux/file.h>
 #include <linux/firmware.h>
 #include <linux/fs.h>
+#include <linux/cpufreq.h>
 #include <linux/version.h>
+#include "fclkcfg.h"
 
 /**
  * DOC: fclkcfg constants 
@@ -55,7 +68,6 @@ MODULE_LICENSE("Dual BSD/GPL");
 
 #define DRIVER_VERSION     "1.9.0"
 #define DRIVER_NAME        "fclkcfg"
-#define DEVICE_MAX_NUM      32
 
 #if     (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 11, 0))
 #define USE_DEV_GROUPS      1
@@ -63,21 +75,51 @@ MODULE_LICENSE("Dual BSD/GPL");
 #define USE_DEV_GROUPS      0
 #endif
 
+#if     (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0))
+#define USE_ASYNC_PROBE     1
+#else
+#define USE_ASYNC_PROBE     0
+#endif
+
+#if     IS_ENABLED(CONFIG_CONFIGFS_FS)
+#define USE_CONFIGFS        1
+#else
+#define USE_CONFIGFS        0
+#endif
+
+#if     IS_ENABLED(CONFIG_OF_OVERLAY)
+#define USE_OF_OVERLAY_NOTIFIER 1
+#else
+#define USE_OF_OVERLAY_NOTIFIER 0
+#endif
+
+#if     IS_ENABLED(CONFIG_CPU_FREQ)
+#define USE_CPUFREQ         1
+#else
+#define USE_CPUFREQ         0
+#endif
+
+#if     IS_ENABLED(CONFIG_FCLKCFG_KUNIT_TEST)
+#define USE_KUNIT_TEST      1
+#else
+#define USE_KUNIT_TEST      0
+#endif
+
 /**
  * DOC: fclkcfg static variables
  *
- * * info_enable    - fclkcfg install/uninstall infomation enable.
+ * * info_enable    - fclkcfg install/uninstall infomation enable(0:off, 1:summary, 2:verbose).
  * * enable_sync    - fclkcfg enable synchronization.
- * * disable_retry  - fclkcfg disable retry count.
+ * * disable_retry  - fclkcfg disable retry count (deprecated).
  * * debug_print    - fclkcfg debug print enable.
  */
 
 /**
- * info_enable      - fclkcfg install/uninstall infomation enable.
+ * info_enable      - fclkcfg install/uninstall infomation enable(0:off, 1:summary, 2:verbose).
  */
 static int            info_enable = 1;
 module_param(         info_enable , int, S_IRUGO);
-MODULE_PARM_DESC(     info_enable , DRIVER_NAME " install/uninstall infomation enable");
+MODULE_PARM_DESC(     info_enable , DRIVER_NAME " install/uninstall infomation enable(0:off, 1:summary, 2:verbose)");
 
 /**
  * enable_sync      - fclkcfg enable synchronization.
@@ -87,11 +129,11 @@ module_param(         enable_sync , int, S_IRUGO);
 MODULE_PARM_DESC(     enable_sync , DRIVER_NAME " enable synchronization");
 
 /**
- * disable_retry    - fclkcfg disable retry count.
+ * disable_retry    - fclkcfg disable retry count (deprecated, ignored).
  */
-static int            disable_retry = 8;
+static int            disable_retry = -1;
 module_param(         disable_retry , int, S_IRUGO);
-MODULE_PARM_DESC(     disable_retry , DRIVER_NAME " disable retry count");
+MODULE_PARM_DESC(     disable_retry , DRIVER_NAME " disable retry count (deprecated, ignored)");
 
 /**
  * debug_print      - fclkcfg debug print enable.
@@ -111,12 +153,18 @@ MODULE_PARM_DESC(     debug_print , DRIVER_NAME " debug print enable");
  * This section defines the structure of fclk state.
  *
  * * struct fclk_state   - fclk state data structure.
+ * * parse_fclk_manifest_line() - parse one line of clock manifest.
+ * * fclk_manifest_dup()  - copy firmware data to a null-terminated string.
  * * of_get_fclk_state() - get rate or enable property from device tree.
  *
  */
 
 /**
  * struct fclk_state - fclk state data structure.
+ *
+ * ratio_solved is set when the rate already agrees with the rate ratios
+ * (solved jointly, restored, or a state of the device itself), so that it
+ * may be applied to a device linked by rate ratios.
  */
 struct fclk_state {
     unsigned long        rate;
@@ -125,8 +173,130 @@ struct fclk_state {
     bool                 rate_valid;
     bool                 enable_valid;
     bool                 resclk_valid;
+    bool                 rate_max;
+    bool                 ratio_solved;
 };
 
+/**
+ * fclk_state_clear()   - clear all fields of fclk state.
+ *
+ * @state:       address of fclk state data.
+ */
+static inline void fclk_state_clear(struct fclk_state* state)
+{
+    state->rate         = 0;
+    state->rate_valid   = false;
+    state->enable       = false;
+    state->enable_valid = false;
+    state->resclk       = 0;
+    state->resclk_valid = false;
+    state->rate_max     = false;
+    state->ratio_solved = false;
+}
+
+/**
+ * parse_fclk_state()   - parse "rate=... enable=... resource=..." string.
+ *
+ * @buf:         string to parse.
+ * @state:       address of fclk state data.
+ * Return:       Success(=0) or error status(<0).
+ *
+ * Fields are separated by white space or comma and any subset of them may
+ * be given. Only the fields found in @buf are marked valid in @state.
+ * "rate=max" requests the highest rate within min_rate and max_rate.
+ */
+static int parse_fclk_state(const char* buf, struct fclk_state* state)
+{
+    int   retval = 0;
+    char* str;
+    char* ptr;
+    char* token;
+
+    fclk_state_clear(state);
+
+    str = kstrdup(buf, GFP_KERNEL);
+    if (str == NULL)
+        return -ENOMEM;
+
+    ptr = str;
+    while ((token = strsep(&ptr, " \t\n,")) != NULL) {
+        char*         value;
+        unsigned long number;
+        if (*token == '\0')
+            continue;
+        value = strchr(token, '=');
+        if (value == NULL) {
+            retval = -EINVAL;
+            break;
+        }
+        *value++ = '\0';
+        if ((strcmp(token, "rate") == 0) && (strcmp(value, "max") == 0)) {
+            state->rate_max     = true;
+            state->rate_valid   = false;
+            continue;
+        }
+        if (0 != (retval = kstrtoul(value, 0, &number)))
+            break;
+        if        (strcmp(token, "rate"    ) == 0) {
+            state->rate         = number;
+            state->rate_valid   = true;
+            state->rate_max     = false;
+        } else if (strcmp(token, "enable"  ) == 0) {
+            state->enable       = (number != 0);
+            state->enable_valid = true;
+        } else if (strcmp(token, "resource") == 0) {
+            state->resclk       = number;
+            state->resclk_valid = true;
+        } else {
+            retval = -EINVAL;
+            break;
+        }
+    }
+    kfree(str);
+    return retval;
+}
+
+/**
+ * parse_fclk_manifest_line() - parse "<device-name> rate=... enable=... resource=..." line.
+ *
+ * @line:        line to parse, modified in place.
+ * @name:        address to store the device name, or NULL for a blank line.
+ * @state:       address of fclk state data.
+ * Return:       Success(=0) or error status(<0).
+ *
+ * Text after '#' is a comment.
+ */
+static int parse_fclk_manifest_line(char* line, char** name, struct fclk_state* state)
+{
+    char* comment = strchr(line, '#');
+
+    if (comment != NULL)
+        *comment = '\0';
+    line  = strim(line);
+    *name = NULL;
+    if (*line == '\0')
+        return 0;
+    *name = strsep(&line, " \t");
+    return parse_fclk_state((line != NULL) ? line : "", state);
+}
+
+/**
+ * fclk_manifest_dup() - copy firmware data to a null-terminated string.
+ *
+ * @fw:          firmware loaded by request_firmware().
+ * Return:       string to be freed by kfree() or NULL.
+ */
+static char* fclk_manifest_dup(const struct firmware* fw)
+{
+    char* text = kmalloc(fw->size + 1, GFP_KERNEL);
+
+    if (text != NULL) {
+        memcpy(text, fw->data, fw->size);
+        text[fw->size] = '\0';
+    }
+    return text;
+}
+
 /**
  * of_get_fclk_state()  - get rate/enable/resource property from device tree.
  *
@@ -152,7 +322,11 @@ static void of_get_fclk_state(
 
         prop = of_get_property(of_node, rate_name, NULL);
         
-        if (!IS_ERR_OR_NULL(prop)) {
+        if (!IS_ERR_OR_NULL(prop) && (strcmp(prop, "max") == 0)) {
+            state->rate_max   = true;
+            state->rate_valid = false;
+            DEV_DBG(dev, "get %s property (=max).\n", rate_name);
+        } else if (!IS_ERR_OR_NULL(prop)) {
             ssize_t       prop_status;
             unsigned long rate;
             if (0 != (prop_status = kstrtoul(prop, 0, &rate))) {
@@ -160,6 +334,7 @@ static void of_get_fclk_state(
             } else {
                 state->rate_valid = true;
                 state->rate       = rate;
+                state->rate_max   = false;
                 DEV_DBG(dev, "get %s property (=%lu).\n", rate_name, rate);
             }
         }
@@ -197,6 +372,146 @@ static void of_get_fclk_state(
     DEV_DBG(dev, "get %s done.\n", resclk_name);
 }
 
+/**
+ * struct fclk_settle_stat - settle wait statistics.
+ *
+ * The time is what the transition actually spent in the wait, including
+ * the timer slack. It does not tell when a circuit fed by the clock locked.
+ */
+struct fclk_settle_stat {
+    unsigned long        count;
+    s64                  last_ns;
+    s64                  max_ns;
+};
+
+/**
+ * struct fclk_target - fclk target clock structure.
+ *
+ * A device controls target0 and, when the device tree node declares a
+ * group, target1..N. Each target has its own clock, resource clock selection
+ * and, for a group, its own attribute group "target<N>" in sysfs.
+ */
+struct fclk_target {
+    struct clk*              clk;
+    int                      resource_clk_id;
+    unsigned int             enable_refs;
+    unsigned int             prepare_refs;
+    unsigned long            requested_rate;
+    char                     name[16];
+    struct dev_ext_attribute enable_attr;
+    struct dev_ext_attribute rate_attr;
+    struct dev_ext_attribute resource_attr;
+    struct dev_ext_attribute foreign_enable_count_attr;
+    struct attribute*        attrs[5];
+    struct attribute_group   attr_group;
+};
+
+/**
+ * struct fclk_transition_stat - measured transition time statistics.
+ */
+struct fclk_transition_stat {
+    unsigned long        count;
+    unsigned long        failures;
+    unsigned long        rollbacks;
+    s64                  last_ns;
+    s64                  min_ns;
+    s64                  max_ns;
+    s64                  total_ns;
+    unsigned long        gated_count;
+    s64                  gated_last_ns;
+    s64                  gated_max_ns;
+};
+
+/**
+ * struct fclk_schedule - transition scheduled at an absolute time.
+ */
+struct fclk_schedule {
+    struct hrtimer       timer;
+    struct work_struct   work;
+    clockid_t            clock;
+    ktime_t              time;
+    struct fclk_state    state;
+    bool                 armed;
+    unsigned long        count;
+    ktime_t              last_time;
+    ktime_t              last_applied;
+    int                  last_result;
+};
+
+/**
+ * struct fclk_search - maximum stable frequency search.
+ */
+struct fclk_search {
+    struct delayed_work  timeout_work;
+    bool                 active;
+    bool                 testing;
+    unsigned long        min_rate;
+    unsigned long        max_rate;
+    unsigned long        step;
+    unsigned int         timeout_ms;
+    unsigned int         margin_ppm;
+    unsigned long        orig_rate;
+    unsigned long        candidate;
+    unsigned long        pass_rate;
+    unsigned long        fail_rate;
+    unsigned long        deadline;
+    unsigned long        count;
+    unsigned long        final_rate;
+    int                  result;
+};
+
+/**
+ * struct fclk_cpufreq_band - rate of fclk for a band of cpu frequency.
+ */
+struct fclk_cpufreq_band {
+    unsigned int         cpu_khz;
+    unsigned long        rate;
+};
+
+/**
+ * struct fclk_cpufreq - coupling of fclk rate to cpu frequency.
+ */
+struct fclk_cpufreq {
+    struct notifier_block notifier;
+    bool                 notifier_done;
+    struct work_struct   work;
+    bool                 active;
+    unsigned int         cpu;
+    unsigned int         cpu_khz;
+    unsigned int         hysteresis_khz;
+    struct fclk_cpufreq_band* bands;
+    int                  bands_size;
+    int                  band;
+    unsigned long        transitions;
+};
+
+/**
+ * struct fclk_power_point - power of fclk at a rate.
+ */
+struct fclk_power_point {
+    unsigned long        rate;
+    unsigned long        uw;
+};
+
+/**
+ * struct fclk_power - power model and energy counter.
+ *
+ * power_uw, active_uw, energy_uj, energy_rem and last are protected by
+ * atomic_lock, so that the atomic API can account them too.
+ */
+struct fclk_power {
+    bool                 valid;
+    unsigned int         dynamic_uw_per_mhz;
+    unsigned int         static_uw;
+    struct fclk_power_point* table;
+    int                  table_size;
+    unsigned long        power_uw;
+    unsigned long        active_uw;
+    u64                  energy_uj;
+    u32                  energy_rem;
+    ktime_t              last;
+};
+
 /**
  * DOC: fclk device data structure
  *
@@ -208,1134 +523,6834 @@ static void of_get_fclk_state(
  */
 struct fclk_device_data {
     struct device*       device;
-    struct clk*          clk;
+    struct fclk_target   target;
+    struct fclk_target*  group_targets;
+    int                  group_targets_size;
+    const struct attribute_group** target_groups;
     struct clk**         resource_clks;
     int                  resource_clks_size;
-    int                  resource_clk_id;
     unsigned long        round_rate;
     struct fclk_state    insert;
     struct fclk_state    remove;
+    struct fclk_state    program;
     dev_t                device_number;
-    unsigned int         disable_retry;
+    struct reset_control* resets;
+    bool                 reset_asserted;
+    unsigned int         reset_assert_delay_us;
+    unsigned int         reset_deassert_delay_us;
+    unsigned int         enable_settle_us;
+    unsigned int         resource_settle_us;
+    unsigned int         rate_settle_us;
+    unsigned int         rate_tolerance_ppm;
+    unsigned int         rate_tolerance_hz;
+    unsigned long        min_rate;
+    unsigned long        max_rate;
+    unsigned long        resource_retunable;
+    unsigned long        retunable_min_rate;
+    unsigned long        retunable_max_rate;
+    unsigned long*       resource_saved_rates;
+    char*                ratio_device;
+    unsigned int         ratio_num;
+    unsigned int         ratio_den;
+    bool                 ratio_linked;
+    struct fclk_search   search;
+    struct fclk_cpufreq  cpufreq;
+    struct fclk_power    power;
+    struct fclk_settle_stat enable_settle;
+    struct fclk_settle_stat resource_settle;
+    struct fclk_settle_stat rate_settle;
+    struct fclk_transition_stat transition_stat;
+    struct device_node*  fpga_region;
+    struct notifier_block overlay_notifier;
+    bool                 overlay_notifier_done;
+    bool                 overlay_programming;
+    unsigned int         program_timeout_ms;
+    struct delayed_work  overlay_timeout_work;
+    struct fclk_schedule schedule;
+    bool                 in_transition;
+    bool                 enforce;
+    unsigned int         enforce_interval_ms;
+    struct fclk_state    enforce_desired;
+    unsigned long        enforce_corrections;
+    unsigned int         enforce_backoff_ms;
+    unsigned long        enforce_next;
+    struct notifier_block enforce_notifier;
+    bool                 enforce_notifier_done;
+    struct delayed_work  enforce_work;
+    bool                 keep_prepared;
+    spinlock_t           atomic_lock;
+    bool                 staged;
+    struct fclk_state    pending;
+    struct mutex         lock;
+    struct kref          kref;
+    bool                 removed;
 };
 
+/**
+ * DOC: fclk device locking
+ *
+ * Each fclk device has its own mutex (lock) and no lock is shared between
+ * devices. Every change of the clock state holds the lock of the device for
+ * the whole transition: the device files, the scheduled transition, enforce
+ * mode, the fpga-region notifier, the manifest and the remove path. So the
+ * steps of two writers to the same device never interleave, while different
+ * devices can change their clocks in parallel on different cores.
+ *
+ * The clock framework serializes clk_prepare(), clk_set_rate() and
+ * clk_set_parent() with its own global lock, so only the rest of a
+ * transition (settle times, reset delays) overlaps between devices.
+ *
+ * The manifest takes the lock of one device at a time, so other writers may
+ * change a device between the steps of a manifest.
+ *
+ * The schedule and enforce settings are also changed under the lock. Their
+ * works take the lock, so the *_sync cancels are called without it.
+ *
+ * The atomic API uses atomic_lock instead, and is refused while a transition
+ * is in progress.
+ *
+ * The fclk device data is freed when its last reference (kref) is put. One
+ * reference is held by the creator until fclkcfg_device_destroy(), one by
+ * the device until its release, and one by every fclkcfg_get() until the
+ * matching fclkcfg_put(). fclkcfg_device_destroy() sets removed under both
+ * locks before the clocks are put. After that, a change of the clock state
+ * and the atomic API return -ENODEV, so a holder such as the manifest never
+ * touches put clocks.
+ */
 /**
  * DOC: fclk device clock operations
  *
  * This section defines the clock operation.
  *
+ * * __fclk_delay()            - wait for settle time.
+ * * __fclk_settle()           - wait for settle time and measure it.
+ * * __fclk_settle_changes()   - wait for settle times of resource and rate changes.
+ * * __fclk_assert_reset()     - assert resets.
+ * * __fclk_deassert_reset()   - deassert resets.
+ * * __fclk_targets_size()     - number of targets of the device.
+ * * __fclk_get_target()       - get target by index.
+ * * __fclk_foreign_enable_count() - number of enables held by others.
  * * __fclk_set_enable()       - enable/disable clock.
+ * * __fclk_keep_prepare()     - prepare targets that are not prepared.
+ * * __fclk_release_prepare()  - unprepare targets that are not enabled.
+ * * __fclk_set_keep_prepared() - set/clear keep prepared mode.
+ * * __fclk_clk_is_ancestor()  - check that a clock is an ancestor of another.
+ * * __fclk_retune_shared()    - check that a resource clock feeds other targets.
+ * * __fclk_retune_resource()  - retune resource clock for exact rate.
+ * * __fclk_save_resource_rates()    - save rates of retunable resource clocks.
+ * * __fclk_restore_resource_rates() - restore rates of retunable resource clocks.
  * * __fclk_set_rate()         - set clock rate.
- * * __fclk_change_state()     - change clock state.
+ * * __fclk_rate_error_ppm()   - error of achieved rate in ppm.
+ * * __fclk_rate_in_tolerance() - check achieved rate against tolerance.
  * * __fclk_change_resource()  - change resource clock.
+ * * __fclk_round_rate_on_resource() - estimate rate of a target on a resource clock.
+ * * __fclk_round_rate_down()  - highest rate not exceeding a limit.
+ * * __fclk_round_rate_in_range() - highest rate within min_rate and max_rate.
+ * * __fclk_round_rate_max_on_resource() - estimate highest rate in range on a resource clock.
+ * * __fclk_set_rate_max()     - set highest rate within min_rate and max_rate.
+ * * __fclk_group_enable()     - enable clocks of targets together.
+ * * __fclk_set_rate_verified() - set clock rate and verify it by read back.
+ * * __fclk_enforce_record()   - record current state of target0 as desired state.
+ * * __fclk_rollback_state()   - restore clock state after failed change.
+ * * __fclk_transition_record() - record time of transition.
+ * * __fclk_power_of_rate()    - estimate power of a target at a rate.
+ * * __fclk_power_account()    - integrate energy and set current power.
+ * * __fclk_power_update()     - update current power from clock state.
+ * * __fclk_ratio_refused()    - rate change refused by rate ratios.
+ * * __fclk_change_group_state()  - change clock state of all targets.
+ * * __fclk_change_target_state() - change clock state of one target.
+ * * __fclk_change_state()     - change clock state.
+ * * __fclk_change_all_state() - change clock state of every target.
+ * * __fclk_change_state_staged() - change clock state, staging changes while gated.
+ * * __fclk_set_rate_range()   - set rate range of every target.
+ * * __fclk_change_rate_range() - change min_rate and max_rate.
+ * * __fclk_schedule_now()     - current time of schedule clock.
+ * * __fclk_schedule_init()    - initialize schedule timer.
+ * * __fclk_schedule_arm()     - arm scheduled transition.
+ * * __fclk_schedule_disarm()  - disarm scheduled transition.
+ * * __fclk_schedule_cancel()  - cancel scheduled transition.
+ * * __fclk_resource_selected() - check that resource clock is a parent of target.
+ * * __fclk_enforce_diverged() - check that target0 diverged from desired state.
+ * * __fclk_enforce_start()    - start enforce mode.
+ * * __fclk_enforce_stop()     - stop enforce mode.
+ * * __fclk_search_notify()    - notify search state to user space.
+ * * __fclk_search_finish()    - finish search and apply final rate.
+ * * __fclk_search_apply()     - apply candidate rate of search.
+ * * __fclk_search_next()      - select and apply next candidate rate.
+ * * __fclk_search_timeout()   - no verdict within timeout.
+ * * __fclk_search_start()     - start search.
+ * * __fclk_search_verdict()   - pass/fail verdict of candidate rate.
+ * * __fclk_search_abort()     - abort search and restore rate.
+ * * __fclk_search_stop()      - stop search timeout.
+ * * __fclk_cpufreq_band()     - select band of cpu frequency.
+ * * __fclk_cpufreq_work()     - change rate to the band of cpu frequency.
+ * * __fclk_cpufreq_notify()   - cpufreq transition notifier.
+ * * __fclk_cpufreq_start()    - start coupling to cpu frequency.
+ * * __fclk_cpufreq_stop()     - stop coupling to cpu frequency.
  *
  */
 /**
- * __fclk_set_enable() - enable/disable clock.
+ * __fclk_delay() - wait for settle time.
  *
- * @this:       Pointer to the fclk device data.
- * @enable:	enable/disable value.
- * Return:      Success(=0) or error status(<0).
+ * @usec:       settle time in microseconds.
  *
+ * Short waits are busy-waited, longer ones sleep on an hrtimer through
+ * usleep_range() so that the wait is precise without spinning.
  */
-static int __fclk_set_enable(struct fclk_device_data* this, bool enable)
+static void __fclk_delay(unsigned int usec)
 {
-    int status = 0;
-
-    if (enable == true) {
-        if (__clk_is_enabled(this->clk) == false) {
-            status = clk_prepare_enable(this->clk);
-            if (status) 
-                dev_err(this->device, "enable failed.");
-            else 
-                DEV_DBG(this->device, "enable success.");
-        }
-    } else {
-        if (__clk_is_enabled(this->clk) == true) {
-            int  i;
-            status = -EBUSY;
-            for (i = 0; i <= this->disable_retry; i++) {
-                clk_disable_unprepare(this->clk);
-                if (__clk_is_enabled(this->clk) == false) {
-                    status = 0;
-                    break;
-                }
-            }
-            if (status) 
-                dev_err(this->device, "disable failed.");
-            else 
-                DEV_DBG(this->device, "disable success.");
-        }
-    }
-    return status;
+    if (usec == 0)
+        return;
+    if (usec < 10)
+        udelay(usec);
+    else
+        usleep_range(usec, usec + (usec >> 4) + 1);
 }
 
 /**
- * __fclk_set_rate() - set clock rate.
- *
- * @this:       Pointer to the fclk device data.
- * @rate:       rate.
- * Return:      Success(=0) or error status(<0).
+ * __fclk_settle() - wait for settle time and measure it.
  *
+ * @usec:       settle time in microseconds.
+ * @stat:       Pointer to the statistics updated with the time spent waiting.
  */
-static int __fclk_set_rate(struct fclk_device_data* this, unsigned long rate)
+static void __fclk_settle(unsigned int usec, struct fclk_settle_stat* stat)
 {
-    int           status;
-    unsigned long round_rate;
+    ktime_t start;
+    s64     elapsed;
 
-    round_rate = clk_round_rate(this->clk, rate);
-    status     = clk_set_rate(this->clk, round_rate);
+    if (usec == 0)
+        return;
 
-    if (status)
-        dev_err(this->device, "set_rate(%lu=>%lu) failed." , rate, round_rate);
-    else
-        DEV_DBG(this->device, "set_rate(%lu=>%lu) success.", rate, round_rate);
+    start   = ktime_get();
+    __fclk_delay(usec);
+    elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
 
-    return status;
+    stat->count++;
+    stat->last_ns = elapsed;
+    if (elapsed > stat->max_ns)
+        stat->max_ns = elapsed;
 }
 
 /**
- * __fclk_change_resource() - change resource clock.
+ * __fclk_settle_changes() - wait for settle times of resource and rate changes.
  *
  * @this:       Pointer to the fclk device data.
- * @index:	index of resource_clks.
- * Return:      Success(=0) or error status(<0).
+ * @resclk_changed: a resource clock has been changed.
+ * @rate_changed:   a rate has been changed.
  *
+ * Resource clocks and rates are changed while the clocks are stopped, but a
+ * circuit fed by the clock (e.g. an MMCM) can only lock on a running clock.
+ * So the waits are done after the clocks are started again (after the enable
+ * settle time) and before the resets are deasserted.
  */
-static int __fclk_change_resource(struct fclk_device_data* this, int index)
+static void __fclk_settle_changes(struct fclk_device_data* this, bool resclk_changed, bool rate_changed)
 {
-    struct device* dev = this-> device;
-
-    if ((this->resource_clks == NULL) && index == 0) {
-        this->resource_clk_id = index;
-        return 0;
-    }
-
-    if ((this->resource_clks != NULL) && (index >= 0) && (index < this->resource_clks_size)) {
-        struct clk*    resource_clk       = this->resource_clks[index];
-        int            set_parent_status  = 0;
-        bool           found_resource_clk = false;
-        struct clk*    curr_clk           = this->clk;
-        while (!IS_ERR_OR_NULL(curr_clk)) {
-            if (clk_has_parent(curr_clk, resource_clk) == true) {
-                found_resource_clk = true;
-                set_parent_status  = clk_set_parent(curr_clk, resource_clk);
-                break;
-            }
-            curr_clk = clk_get_parent(curr_clk);
-        }
-        if (set_parent_status != 0) {
-            dev_err(dev, "clk_set_parent(%s, %s) failed.\n" , __clk_get_name(curr_clk), __clk_get_name(resource_clk));
-            return set_parent_status;
-        }
-        if (found_resource_clk == false) {
-            dev_err(dev, "%s is not resource clock of %s.\n", __clk_get_name(resource_clk), __clk_get_name(this->clk));
-            return -EINVAL;
-        }
-        this->resource_clk_id = index;
-        return 0;
-    }
-    return -EINVAL;
+    if (resclk_changed == true)
+        __fclk_settle(this->resource_settle_us, &this->resource_settle);
+    if (rate_changed == true)
+        __fclk_settle(this->rate_settle_us, &this->rate_settle);
 }
 
 /**
- * __fclk_change_state() - change clock state.
+ * __fclk_assert_reset() - assert resets.
  *
  * @this:       Pointer to the fclk device data.
- * @next:	next state to change.
  * Return:      Success(=0) or error status(<0).
  *
+ * After asserting, wait reset_assert_delay_us so that the PL is quiescent
+ * before its clock is stopped.
  */
-static int __fclk_change_state(struct fclk_device_data* this, struct fclk_state* next)
+static int __fclk_assert_reset(struct fclk_device_data* this)
 {
-    int  retval      = 0;
-    bool prev_enable = __clk_is_enabled(this->clk);
-    bool next_enable = (next->enable_valid == true) ? next->enable : prev_enable;
-    bool next_resclk = ((next->resclk_valid == true) &&
-                        (next->resclk != this->resource_clk_id));
+    int status;
 
-    if (((next->rate_valid == true) || (next_resclk == true)) && (prev_enable == true)) {
-        if (0 != (retval = __fclk_set_enable(this, false)))
-            return retval;
-        prev_enable = false;
-    }
-    if (next_resclk == true) {
-        if (0 != (retval = __fclk_change_resource(this, next->resclk)))
-            return retval;
-    }
-    if (next->rate_valid == true) {
-        if (0 != (retval = __fclk_set_rate(this, next->rate)))
-            return retval;
-    }
-    if (prev_enable != next_enable) {
-        if (0 != (retval = __fclk_set_enable(this, next_enable)))
-            return retval;
+    if ((this->resets == NULL) || (this->reset_asserted == true))
+        return 0;
+
+    status = reset_control_assert(this->resets);
+    if (status) {
+        dev_err(this->device, "reset assert failed(%d).\n", status);
+        return status;
     }
-    return retval;
+    DEV_DBG(this->device, "reset assert success.");
+    this->reset_asserted = true;
+    __fclk_delay(this->reset_assert_delay_us);
+    return 0;
 }
 
 /**
- * DOC: fclk system class device file show/set operations.
+ * __fclk_deassert_reset() - deassert resets.
  *
- * The device file created in system class is as follows.
+ * @this:       Pointer to the fclk device data.
+ * Return:      Success(=0) or error status(<0).
  *
- * * /sys/class/<class-name>/<device-name>/driver_version
- * * /sys/class/<class-name>/<device-name>/enable
- * * /sys/class/<class-name>/<device-name>/rate
- * * /sys/class/<class-name>/<device-name>/round_rate
- * * /sys/class/<class-name>/<device-name>/resource_clks
- * * /sys/class/<class-name>/<device-name>/resource
- * * /sys/class/<class-name>/<device-name>/remove_enable
- * * /sys/class/<class-name>/<device-name>/remove_rate
- * * /sys/class/<class-name>/<device-name>/remove_resource
- */
-/**
- * fclk_show_driver_version()
+ * Wait reset_deassert_delay_us with the clock running before deasserting,
+ * so that the PL leaves reset on a stable clock.
  */
-static ssize_t fclk_show_driver_version(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+static int __fclk_deassert_reset(struct fclk_device_data* this)
 {
-    if (!this)
-        return -ENODEV;
-    return sprintf(buf, "%s\n", DRIVER_VERSION);
+    int status;
+
+    if ((this->resets == NULL) || (this->reset_asserted == false))
+        return 0;
+
+    __fclk_delay(this->reset_deassert_delay_us);
+    status = reset_control_deassert(this->resets);
+    if (status) {
+        dev_err(this->device, "reset deassert failed(%d).\n", status);
+        return status;
+    }
+    DEV_DBG(this->device, "reset deassert success.");
+    this->reset_asserted = false;
+    return 0;
 }
 
 /**
- * fclk_show_enable()
+ * __fclk_targets_size() - number of targets of the device.
+ *
+ * @this:       Pointer to the fclk device data.
+ * Return:      number of targets (target0 and group targets).
  */
-static ssize_t fclk_show_enable(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+static inline int __fclk_targets_size(struct fclk_device_data* this)
 {
-    if (!this)
-        return -ENODEV;
-    return sprintf(buf, "%d\n", __clk_is_enabled(this->clk));
+    return 1 + this->group_targets_size;
 }
 
 /**
- * fclk_set_enable()
+ * __fclk_get_target() - get target by index.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @index:      index of target (0 is target0).
+ * Return:      Pointer to the fclk target.
  */
-static ssize_t fclk_set_enable(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+static inline struct fclk_target* __fclk_get_target(struct fclk_device_data* this, int index)
 {
-    ssize_t       get_result;
-    int           set_result;
-    unsigned long enable;
-
-    if (!this)
-        return -ENODEV;
-
-    if (0 != (get_result = kstrtoul(buf, 0, &enable)))
-        return get_result;
-
-    if (0 != (set_result = __fclk_set_enable(this, (enable != 0))))
-        return (ssize_t)set_result;
-
-    return size;
+    return (index == 0) ? &this->target : &this->group_targets[index-1];
 }
 
 /**
- * fclk_show_rate()
+ * __fclk_foreign_enable_count() - number of enables held by others.
+ *
+ * @target:     Pointer to the fclk target.
+ * Return:      enable count of the clock minus the references held by fclkcfg.
  */
-static ssize_t fclk_show_rate(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+static inline unsigned int __fclk_foreign_enable_count(struct fclk_target* target)
 {
-    if (!this)
-        return -ENODEV;
-    return sprintf(buf, "%lu\n", clk_get_rate(this->clk));
+    unsigned int count = __clk_get_enable_count(target->clk);
+    return (count > target->enable_refs) ? count - target->enable_refs : 0;
 }
 
 /**
- * fclk_set_rate()
+ * __fclk_set_enable() - enable/disable clock.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @target:     Pointer to the fclk target.
+ * @enable:	enable/disable value.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * fclkcfg holds at most one enable reference of a target (see enable_refs)
+ * and one prepare reference (see prepare_refs), and a disable releases
+ * exactly the references it holds. In keep prepared mode the prepare
+ * reference is kept. If the clock is still running after that and other
+ * consumers hold enable references, -EBUSY is returned. If nobody holds an
+ * enable reference, the clock framework has gated it and is_enabled of the
+ * hardware only lags, so the disable succeeds.
  */
-static ssize_t fclk_set_rate(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+static int __fclk_set_enable(struct fclk_device_data* this, struct fclk_target* target, bool enable)
 {
-    ssize_t           get_result;
-    int               set_result;
-    struct fclk_state next_state;
-
-    if (!this)
-        return -ENODEV;
+    int status = 0;
 
-    if (0 != (get_result = kstrtoul(buf, 0, &next_state.rate)))
-        return get_result;
-
-    next_state.rate_valid   = true;
-    next_state.enable       = false;
-    next_state.enable_valid = false;
-    next_state.resclk       = 0;
-    next_state.resclk_valid = false;
-
-    if (0 != (set_result = __fclk_change_state(this, &next_state)))
-        return (ssize_t)set_result;
-
-    return size;
+    if (enable == true) {
+        if (target->enable_refs == 0) {
+            bool was_enabled = __clk_is_enabled(target->clk);
+            bool prepared    = false;
+            if (target->prepare_refs == 0) {
+                if (0 != (status = clk_prepare(target->clk))) {
+                    dev_err(this->device, "enable failed.");
+                    return status;
+                }
+                target->prepare_refs++;
+                prepared = true;
+            }
+            status = clk_enable(target->clk);
+            if (status) {
+                dev_err(this->device, "enable failed.");
+                if (prepared == true) {
+                    clk_unprepare(target->clk);
+                    target->prepare_refs--;
+                }
+            } else {
+                target->enable_refs++;
+                DEV_DBG(this->device, "enable success.");
+                if (was_enabled == false)
+                    __fclk_settle(this->enable_settle_us, &this->enable_settle);
+            }
+        }
+    } else {
+        while (target->enable_refs > 0) {
+            clk_disable(target->clk);
+            target->enable_refs--;
+        }
+        if (this->keep_prepared == false) {
+            while (target->prepare_refs > 0) {
+                clk_unprepare(target->clk);
+                target->prepare_refs--;
+            }
+        }
+        if (__clk_is_enabled(target->clk) == false) {
+            DEV_DBG(this->device, "disable success.");
+        } else if (__fclk_foreign_enable_count(target) == 0) {
+            DEV_DBG(this->device, "disable success, is_enabled lags.");
+        } else {
+            status = -EBUSY;
+            dev_err(this->device, "disable failed, %u enable references are held by others.",
+                    __fclk_foreign_enable_count(target));
+        }
+    }
+    return status;
 }
 
 /**
- * fclk_show_round_rate()
+ * __fclk_keep_prepare() - prepare targets that are not prepared.
+ *
+ * @this:       Pointer to the fclk device data.
+ * Return:      Success(=0) or error status(<0).
  */
-static ssize_t fclk_show_round_rate(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+static int __fclk_keep_prepare(struct fclk_device_data* this)
 {
-    if (!this)
-        return -ENODEV;
+    int status;
+    int i;
 
-    return sprintf(buf, "%lu => %lu\n",
-                   this->round_rate,
-                   clk_round_rate(this->clk, this->round_rate)
-    );
+    for (i = 0; i < __fclk_targets_size(this); i++) {
+        struct fclk_target* target = __fclk_get_target(this, i);
+        if (target->prepare_refs > 0)
+            continue;
+        if (0 != (status = clk_prepare(target->clk))) {
+            dev_err(this->device, "prepare %s failed(%d).\n", __clk_get_name(target->clk), status);
+            return status;
+        }
+        target->prepare_refs++;
+    }
+    return 0;
 }
 
 /**
- * fclk_set_round_rate()
+ * __fclk_release_prepare() - unprepare targets that are not enabled.
+ *
+ * @this:       Pointer to the fclk device data.
+ *
+ * A rate or resource clock change may require the clock to be unprepared
+ * (CLK_SET_RATE_GATE, CLK_SET_PARENT_GATE), so the prepare references kept
+ * in keep prepared mode are dropped while the targets are gated.
  */
-static ssize_t fclk_set_round_rate(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+static void __fclk_release_prepare(struct fclk_device_data* this)
 {
-    ssize_t       get_result;
-    unsigned long round_rate;
-
-    if (!this)
-        return -ENODEV;
+    int i;
 
-    if (0 != (get_result = kstrtoul(buf, 0, &round_rate)))
-        return get_result;
-
-    this->round_rate = round_rate;
-    return size;
+    for (i = 0; i < __fclk_targets_size(this); i++) {
+        struct fclk_target* target = __fclk_get_target(this, i);
+        if (target->enable_refs > 0)
+            continue;
+        while (target->prepare_refs > 0) {
+            clk_unprepare(target->clk);
+            target->prepare_refs--;
+        }
+    }
 }
 
 /**
- * fclk_set_resource()
+ * __fclk_set_keep_prepared() - set/clear keep prepared mode.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @keep:       keep the targets prepared.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The mode flag is changed under atomic_lock, so that the atomic API never
+ * sees the flag set on a target that is not prepared.
  */
-static ssize_t fclk_set_resource(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+static int __fclk_set_keep_prepared(struct fclk_device_data* this, bool keep)
 {
-    ssize_t           get_result;
-    int               set_result;
-    unsigned long     resclk;
-    struct fclk_state next_state;
-
-    if (!this)
-        return -ENODEV;
-
-    if (this->resource_clks == NULL)
-        return size;
-
-    if (0 != (get_result = kstrtoul(buf, 0, &resclk)))
-        return get_result;
-    
-    if (resclk >= this->resource_clks_size)
-        return -EINVAL;
+    unsigned long flags;
+    int           status = 0;
 
-    next_state.rate         = 0;
-    next_state.rate_valid   = false;
-    next_state.enable       = false;
-    next_state.enable_valid = false;
-    next_state.resclk       = resclk;
-    next_state.resclk_valid = true;
+    if (keep == true) {
+        if (this->keep_prepared == true)
+            return 0;
+        if (0 != (status = __fclk_keep_prepare(this))) {
+            __fclk_release_prepare(this);
+            return status;
+        }
+        spin_lock_irqsave(&this->atomic_lock, flags);
+        this->keep_prepared = true;
+        spin_unlock_irqrestore(&this->atomic_lock, flags);
+    } else {
+        if (this->keep_prepared == false)
+            return 0;
+        spin_lock_irqsave(&this->atomic_lock, flags);
+        this->keep_prepared = false;
+        spin_unlock_irqrestore(&this->atomic_lock, flags);
+        __fclk_release_prepare(this);
+    }
+    return 0;
+}
 
-    if (0 != (set_result = __fclk_change_state(this, &next_state)))
-        return (ssize_t)set_result;
+/**
+ * __fclk_clk_is_ancestor() - check that a clock is an ancestor of another.
+ *
+ * @clk:        clock.
+ * @ancestor:   clock to look for among the parents of @clk.
+ * Return:      true if @ancestor is a parent, grandparent, ... of @clk.
+ */
+static bool __fclk_clk_is_ancestor(struct clk* clk, struct clk* ancestor)
+{
+    struct clk* curr_clk;
 
-    return size;
+    for (curr_clk = clk_get_parent(clk); !IS_ERR_OR_NULL(curr_clk); curr_clk = clk_get_parent(curr_clk)) {
+        if (clk_is_match(curr_clk, ancestor))
+            return true;
+    }
+    return false;
 }
 
 /**
- * fclk_show_resource()
+ * __fclk_retune_shared() - check that a resource clock feeds other targets.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @target:     Pointer to the fclk target to be retuned.
+ * @resource_clk: resource clock.
+ * Return:      true if @resource_clk is an ancestor of any other target.
+ *
+ * Retuning such a resource clock would change the rates already set for the
+ * other targets of the group.
  */
-static ssize_t fclk_show_resource(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+static bool __fclk_retune_shared(struct fclk_device_data* this, struct fclk_target* target, struct clk* resource_clk)
 {
-    if (!this)
-        return -ENODEV;
+    int i;
 
-    return sprintf(buf, "%d\n", this->resource_clk_id);
+    for (i = 0; i < __fclk_targets_size(this); i++) {
+        struct fclk_target* other = __fclk_get_target(this, i);
+        if (other == target)
+            continue;
+        if (__fclk_clk_is_ancestor(other->clk, resource_clk) == true)
+            return true;
+    }
+    return false;
 }
 
 /**
- * fclk_show_resource_clks()
+ * __fclk_retune_resource() - retune resource clock for exact rate.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @target:     Pointer to the fclk target.
+ * @rate:       rate.
+ * Return:      Success(=0) or -ERANGE if no parent rate gives @rate exactly.
+ *
+ * The selected resource clock must be marked in retunable-resources. Parent
+ * rates that are multiples of @rate within retunable-min-rate and
+ * retunable-max-rate are tried from the lowest one, until the resource clock
+ * accepts the parent rate exactly and the dividers down to the target give
+ * @rate exactly. If none does, the resource clock is restored.
+ *
+ * A resource clock that also feeds another target of the group is never
+ * retuned, see __fclk_retune_shared().
  */
-static ssize_t fclk_show_resource_clks(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+static int __fclk_retune_resource(struct fclk_device_data* this, struct fclk_target* target, unsigned long rate)
 {
-    size_t size = 0;
+    const unsigned long max_div = 4096;
+    struct clk*         resource_clk;
+    unsigned long       prev_rate;
+    unsigned long       min_rate;
+    unsigned long       max_rate;
+    unsigned long       parent_rate;
+    unsigned long       div;
+    bool                changed = false;
+    int                 status;
 
-    if (!this)
-        return -ENODEV;
+    if ((rate == 0) || (this->resource_clks == NULL) || (target->resource_clk_id < 0) ||
+        (target->resource_clk_id >= BITS_PER_LONG) ||
+        ((this->resource_retunable & BIT(target->resource_clk_id)) == 0))
+        return -ERANGE;
 
-    if ((this->resource_clks != NULL) && (this->resource_clks_size > 0)) {
-        int    i;
-        char*  ptr  = buf;
-        for (i = 0; i < this->resource_clks_size; i++) {
-            struct clk* resource_clk = this->resource_clks[i];
-            size_t      len;
-            if (i == this->resource_clks_size-1)
-                len  = sprintf(ptr, "%s\n", __clk_get_name(resource_clk));
-            else
-                len  = sprintf(ptr, "%s, ", __clk_get_name(resource_clk));
-            ptr  += len;
-            size += len;
+    resource_clk = this->resource_clks[target->resource_clk_id];
+    if (__fclk_retune_shared(this, target, resource_clk) == true) {
+        DEV_DBG(this->device, "%s feeds other targets, not retuned.\n", __clk_get_name(resource_clk));
+        return -ERANGE;
+    }
+    prev_rate    = clk_get_rate(resource_clk);
+    min_rate     = this->retunable_min_rate;
+    max_rate     = (this->retunable_max_rate != 0) ? this->retunable_max_rate : ULONG_MAX;
+
+    for (div = (min_rate > rate) ? DIV_ROUND_UP(min_rate, rate) : 1; div <= max_div; div++) {
+        parent_rate = rate * div;
+        if ((parent_rate / div != rate) || (parent_rate > max_rate))
+            break;
+        if (clk_round_rate(resource_clk, parent_rate) != parent_rate)
+            continue;
+        if (0 != (status = clk_set_rate(resource_clk, parent_rate))) {
+            dev_err(this->device, "retune %s to %lu failed(%d).\n", __clk_get_name(resource_clk), parent_rate, status);
+            break;
+        }
+        changed = true;
+        if (clk_round_rate(target->clk, rate) == rate) {
+            dev_info(this->device, "retune %s %lu => %lu for %lu.\n",
+                     __clk_get_name(resource_clk), prev_rate, parent_rate, rate);
+            return 0;
         }
     }
-    return size;
+    if (changed == true)
+        clk_set_rate(resource_clk, prev_rate);
+    return -ERANGE;
 }
 
 /**
- * DEF_FCLK_STATE_SHOW_ENABLE() - generate fclk_show_ ## state ## _enable() macro
+ * __fclk_save_resource_rates() - save rates of retunable resource clocks.
+ *
+ * @this:       Pointer to the fclk device data.
  */
-#define DEF_FCLK_STATE_SHOW_ENABLE(state)       \
-static ssize_t fclk_show_ ## state ## _enable(  \
-    struct fclk_device_data* this,              \
-    struct device_attribute* attr,              \
-    char*                    buf)               \
-{                                               \
-    if (!this) return -ENODEV;                  \
-    if (this->state.enable_valid == false) {return sprintf(buf, "%d\n", -1);} \
-    if (this->state.enable       == true ) {return sprintf(buf, "%d\n",  1);} \
-    else                                   {return sprintf(buf, "%d\n",  0);} \
-}
+static void __fclk_save_resource_rates(struct fclk_device_data* this)
+{
+    int i;
 
-/**
- * DEF_FCLK_STATE_SET_ENABLE()  - generate fclk_set_ ## state ## _enable() macro
- */
-#define DEF_FCLK_STATE_SET_ENABLE(state)        \
-static ssize_t fclk_set_ ## state ## _enable(   \
-    struct fclk_device_data* this,              \
-    struct device_attribute* attr,              \
-    const char*              buf,               \
-    size_t                   size)              \
-{                                               \
-    ssize_t                  get_result;        \
-    long                     enable;            \
-    if (!this) return -ENODEV;                  \
-    if (0 != (get_result = kstrtol(buf, 0, &enable))) \
-        return get_result; \
-    if      (enable  > 0) {this->state.enable_valid = true ;this->state.enable = true ;} \
-    else if (enable == 0) {this->state.enable_valid = true ;this->state.enable = false;} \
-    else                  {this->state.enable_valid = false;} \
-    return size; \
+    if (this->resource_saved_rates == NULL)
+        return;
+    for (i = 0; i < this->resource_clks_size; i++) {
+        if ((i < BITS_PER_LONG) && (this->resource_retunable & BIT(i)))
+            this->resource_saved_rates[i] = clk_get_rate(this->resource_clks[i]);
+    }
 }
 
 /**
- * DEF_FCLK_STATE_SHOW_RATE()   - generate fclk_show_ ## state ## _rate() macro
+ * __fclk_restore_resource_rates() - restore rates of retunable resource clocks.
+ *
+ * @this:       Pointer to the fclk device data.
+ * Return:      Success(=0) or error status(<0).
  */
-#define DEF_FCLK_STATE_SHOW_RATE(state)         \
-static ssize_t fclk_show_ ## state ## _rate(    \
-    struct fclk_device_data* this,              \
-    struct device_attribute* attr,              \
-    char*                    buf)               \
-{                                               \
-    if (!this) return -ENODEV;                  \
-    if (this->state.rate_valid == false) {return sprintf(buf, "%d\n" , -1);} \
-    else                                 {return sprintf(buf, "%lu\n", this->state.rate);} \
+static int __fclk_restore_resource_rates(struct fclk_device_data* this)
+{
+    int retval = 0;
+    int status;
+    int i;
+
+    if (this->resource_saved_rates == NULL)
+        return 0;
+    for (i = 0; i < this->resource_clks_size; i++) {
+        struct clk* resource_clk = this->resource_clks[i];
+        if ((i >= BITS_PER_LONG) || ((this->resource_retunable & BIT(i)) == 0))
+            continue;
+        if (clk_get_rate(resource_clk) == this->resource_saved_rates[i])
+            continue;
+        if (0 != (status = clk_set_rate(resource_clk, this->resource_saved_rates[i])))
+            retval = (retval) ? retval : status;
+    }
+    return retval;
 }
 
 /**
- * DEF_FCLK_STATE_SET_RATE()    - generate fclk_set_## state ## _rate() macro
+ * __fclk_set_rate() - set clock rate.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @target:     Pointer to the fclk target.
+ * @rate:       rate.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * If the rate can not be made exactly with the selected resource clock and
+ * the resource clock is retunable, the resource clock is retuned first.
  */
-#define DEF_FCLK_STATE_SET_RATE(state)          \
-static ssize_t fclk_set_ ## state ## _rate(     \
-    struct fclk_device_data* this,              \
-    struct device_attribute* attr,              \
-    const char*              buf,               \
-    size_t                   size)              \
-{                                               \
-    ssize_t                  get_result;        \
-    long                     rate;              \
-    if (!this) return -ENODEV;                  \
-    if (0 != (get_result = kstrtol(buf, 0, &rate))) \
-        return get_result; \
-    if   (rate >= 0) {this->state.rate_valid = true ;this->state.rate = (unsigned long)rate;} \
-    else             {this->state.rate_valid = false;} \
-    return size; \
+static int __fclk_set_rate(struct fclk_device_data* this, struct fclk_target* target, unsigned long rate)
+{
+    int           status;
+    unsigned long round_rate;
+
+    round_rate = clk_round_rate(target->clk, rate);
+    if ((round_rate != rate) && (0 == __fclk_retune_resource(this, target, rate)))
+        round_rate = clk_round_rate(target->clk, rate);
+    status     = clk_set_rate(target->clk, round_rate);
+
+    if (status) {
+        dev_err(this->device, "set_rate(%lu=>%lu) failed." , rate, round_rate);
+    } else {
+        DEV_DBG(this->device, "set_rate(%lu=>%lu) success.", rate, round_rate);
+    }
+
+    return status;
 }
 
 /**
- * DEF_FCLK_STATE_SHOW_RESOURCE() - generate fclk_show_ ## state ## _resource() macro
+ * __fclk_rate_error_ppm() - error of achieved rate in ppm.
+ *
+ * @requested:  requested rate.
+ * @achieved:   achieved rate.
+ * Return:      signed error in ppm (0 if @requested is 0).
  */
-#define DEF_FCLK_STATE_SHOW_RESOURCE(state)      \
-static ssize_t fclk_show_ ## state ## _resource( \
-    struct fclk_device_data* this,               \
-    struct device_attribute* attr,               \
-    char*                    buf)                \
-{                                                \
-    if (!this) return -ENODEV;                   \
-    if (this->state.resclk_valid == false) {return sprintf(buf, "%d\n" , -1);} \
-    else                                   {return sprintf(buf, "%lu\n", this->state.resclk);} \
+static inline s64 __fclk_rate_error_ppm(unsigned long requested, unsigned long achieved)
+{
+    if (requested == 0)
+        return 0;
+    return div64_s64(((s64)achieved - (s64)requested) * 1000000, (s64)requested);
 }
 
 /**
- * DEF_FCLK_STATE_SET_RESOURCE() - generate fclk_set_ ## state ## _resource() macro
+ * __fclk_rate_in_tolerance() - check achieved rate against tolerance.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @requested:  requested rate.
+ * @achieved:   achieved rate.
+ * Return:      true if no tolerance is set or the error is within any of them.
  */
-#define DEF_FCLK_STATE_SET_RESOURCE(state)       \
-static ssize_t fclk_set_ ## state ## _resource(  \
-    struct fclk_device_data* this,               \
-    struct device_attribute* attr,               \
-    const char*              buf,                \
-    size_t                   size)               \
-{                                                \
-    ssize_t                  get_result;         \
-    long                     resource;           \
-    if (!this) return -ENODEV;                   \
-    if ((this->resource_clks != NULL) && (this->resource_clks_size > 0)) { \
-        if (0 != (get_result = kstrtol(buf, 0, &resource))) \
-            return get_result; \
-        if ((resource >= 0) && (resource < this->resource_clks_size)) { \
-            this->state.resclk_valid = true; \
-            this->state.resclk       = (unsigned long)resource; \
-            return size; \
-        } \
-        if (resource < 0) { \
-            this->state.resclk_valid = false; \
-            return size; \
-        } \
-        return -EINVAL; \
-    } \
-    return size;\
+static bool __fclk_rate_in_tolerance(struct fclk_device_data* this, unsigned long requested, unsigned long achieved)
+{
+    u64 diff = (achieved > requested) ? achieved - requested : requested - achieved;
+
+    if ((this->rate_tolerance_ppm == 0) && (this->rate_tolerance_hz == 0))
+        return true;
+    if ((this->rate_tolerance_hz  != 0) && (diff <= this->rate_tolerance_hz))
+        return true;
+    if ((this->rate_tolerance_ppm != 0) && (diff * 1000000 <= (u64)this->rate_tolerance_ppm * requested))
+        return true;
+    return false;
 }
 
 /**
- * fclk_show_remove_enable()
- * fclk_show_remove_rate()
- * fclk_show_remove_resource()
- * fclk_set_remove_enable()
- * fclk_set_remove_rate()
- * fclk_set_remove_resource()
- */
-DEF_FCLK_STATE_SHOW_ENABLE  (remove);
-DEF_FCLK_STATE_SHOW_RATE    (remove);
-DEF_FCLK_STATE_SHOW_RESOURCE(remove);
-DEF_FCLK_STATE_SET_ENABLE   (remove);
-DEF_FCLK_STATE_SET_RATE     (remove);
-DEF_FCLK_STATE_SET_RESOURCE (remove);
-
-/**
- * DOC: fclk device data operations
- *
- * This section defines the operation of fclk device data.
- *
- * * fclk_device_info()      - Print infomation the fclk device data.
- * * fclk_device_setup()     - Set up   the fclk device data.
- * * fclk_device_cleanup()   - Clean up the fclk device data.
- */
-/**
- * fclk_device_info() -  Print infomation the fclk device data.
+ * __fclk_change_resource() - change resource clock.
  *
  * @this:       Pointer to the fclk device data.
- * @pdev:	handle to the platform device structure or NULL.
+ * @target:     Pointer to the fclk target.
+ * @index:	index of resource_clks.
+ * Return:      Success(=0) or error status(<0).
  *
  */
-static void fclk_device_info(struct fclk_device_data* this, struct platform_device* pdev)
+static int __fclk_change_resource(struct fclk_device_data* this, struct fclk_target* target, int index)
 {
-    struct device* dev = (pdev != NULL)? &pdev->dev : this->device;
+    struct device* dev = this-> device;
 
-#define RES_INFO(dev, tag, resclk)                                                    \
-    if (this->resource_clks != NULL) {                                                \
-        if (((resclk) >= 0) && ((resclk) < this->resource_clks_size))                 \
-            dev_info(dev, tag "%s\n",  __clk_get_name(this->resource_clks[(resclk)]));\
-        else                                                                          \
-            dev_info(dev, tag "%d\n",  (int)(resclk));                                \
+    if ((this->resource_clks == NULL) && index == 0) {
+        target->resource_clk_id = index;
+        return 0;
     }
 
-    dev_info(dev, "driver version : %s\n" , DRIVER_VERSION);
-    dev_info(dev, "device name    : %s\n" , dev_name(this->device));
-    dev_info(dev, "clock  name    : %s\n" , __clk_get_name(this->clk));
-    dev_info(dev, "clock  rate    : %lu\n", clk_get_rate(this->clk));
-    dev_info(dev, "clock  enabled : %d\n" , __clk_is_enabled(this->clk));
-    RES_INFO(dev, "resource clock : "     , this->resource_clk_id);
-    if ((this->resource_clks != NULL) && (this->resource_clks_size > 1)) {
-        int i;
-        for (i = 0; i < this->resource_clks_size; i++) {
-            struct clk* resource_clk = this->resource_clks[i];
-            dev_info(dev, "resource clocks: %d => %s"  , i, __clk_get_name(resource_clk));
+    if ((this->resource_clks != NULL) && (index >= 0) && (index < this->resource_clks_size)) {
+        struct clk*    resource_clk       = this->resource_clks[index];
+        int            set_parent_status  = 0;
+        bool           found_resource_clk = false;
+        struct clk*    curr_clk           = target->clk;
+        while (!IS_ERR_OR_NULL(curr_clk)) {
+            if (clk_has_parent(curr_clk, resource_clk) == true) {
+                found_resource_clk = true;
+                set_parent_status  = clk_set_parent(curr_clk, resource_clk);
+                break;
+            }
+            curr_clk = clk_get_parent(curr_clk);
         }
+        if (set_parent_status != 0) {
+            dev_err(dev, "clk_set_parent(%s, %s) failed.\n" , __clk_get_name(curr_clk), __clk_get_name(resource_clk));
+            return set_parent_status;
+        }
+        if (found_resource_clk == false) {
+            dev_err(dev, "%s is not resource clock of %s.\n", __clk_get_name(resource_clk), __clk_get_name(target->clk));
+            return -EINVAL;
+        }
+        target->resource_clk_id = index;
+        return 0;
     }
-    {
-        if (this->remove.rate_valid   == true)
-            dev_info(dev, "remove rate    : %lu\n", this->remove.rate  );
-        if (this->remove.enable_valid == true)
-            dev_info(dev, "remove enable  : %d\n" , this->remove.enable);
-        if (this->remove.resclk_valid == true)
-            RES_INFO(dev, "remove resource: "     , this->remove.resclk);
-    }
+    return -EINVAL;
 }
+
 /**
- * fclk_device_get_state_property() - get rate/enable/resource property from device.
+ * __fclk_round_rate_on_resource() - estimate rate of a target on a resource clock.
  *
- * @this:        Pointer to the fclk device data.
- * @dev:         handle to the device structure.
- * @of_node:     handle to the of node.
- * @rate_name:   rate property name
- * @enable_name: enable property name
- * @resclk_name: resource clock property name
- * @state:       address of fclk state data.
- * Return:       Success(=0) or error status(<0).
+ * @this:       Pointer to the fclk device data.
+ * @target:     Pointer to the fclk target.
+ * @index:      index of resource_clks.
+ * @rate:       requested rate.
+ * Return:      estimated rate, 0 if the rate can not be made, or error status(<0).
  *
+ * The resource clock is not selected by this function. If it is not the one
+ * currently selected, the target is assumed to divide its rate by an integer,
+ * as the PL clock dividers do. A retunable resource clock is rounded at the
+ * multiples of @rate instead.
  */
-static int fclk_device_get_state_property(
-    struct fclk_device_data* this       ,
-    struct device*           dev        ,
-    struct device_node*      of_node    ,
-    const  char*             rate_name  ,
-    const  char*             enable_name,
-    const  char*             resclk_name,
-    struct fclk_state*       state      )
+static long __fclk_round_rate_on_resource(struct fclk_device_data* this, struct fclk_target* target, int index, unsigned long rate)
 {
-    of_get_fclk_state(dev, of_node, rate_name, enable_name, resclk_name, state);
-    if ((this->resource_clks != NULL) &&
-        (state->resclk_valid == true) &&
-        (state->resclk >= this->resource_clks_size)) {
-        dev_err(dev, "invalid %s(=%lu).\n", resclk_name, state->resclk);
+    const unsigned long max_div = 4096;
+    struct clk*         resource_clk = this->resource_clks[index];
+    struct clk*         curr_clk;
+    unsigned long       parent_rate;
+    unsigned long       div;
+    bool                found = false;
+
+    if (index == target->resource_clk_id)
+        return clk_round_rate(target->clk, rate);
+    for (curr_clk = target->clk; !IS_ERR_OR_NULL(curr_clk); curr_clk = clk_get_parent(curr_clk)) {
+        if (clk_has_parent(curr_clk, resource_clk) == true) {
+            found = true;
+            break;
+        }
+    }
+    if (found == false)
         return -EINVAL;
+    if (rate == 0)
+        return 0;
+    if ((index < BITS_PER_LONG) && (this->resource_retunable & BIT(index))) {
+        for (div = 1; div <= max_div; div++) {
+            parent_rate = rate * div;
+            if ((parent_rate / div != rate) ||
+                ((this->retunable_max_rate != 0) && (parent_rate > this->retunable_max_rate)))
+                break;
+            if (clk_round_rate(resource_clk, parent_rate) == parent_rate)
+                return rate;
+        }
     }
-    return 0;
+    parent_rate = clk_get_rate(resource_clk);
+    if (parent_rate < rate)
+        return 0;
+    div = DIV_ROUND_CLOSEST(parent_rate, rate);
+    return parent_rate / div;
 }
 
 /**
- * fclk_device_setup()     - Set up the fclk device data.
+ * __fclk_round_rate_down() - highest rate not exceeding a limit.
  *
- * @this:        Pointer to the fclk device data.
- * @dev:         handle to the device structure.
- * Return:       Success(=0) or error status(<0).
+ * @target:     Pointer to the fclk target.
+ * @max_rate:   upper limit of the rate.
+ * @rate:       address to store the rate.
+ * Return:      Success(=0) or -ERANGE if no rate is below the limit.
  *
+ * clk_round_rate() returns the nearest rate, which may be above @max_rate.
+ * In that case the request is lowered by the excess and rounded again.
  */
-static int fclk_device_setup(struct fclk_device_data* this, struct device *dev)
+static int __fclk_round_rate_down(struct fclk_target* target, unsigned long max_rate, unsigned long* rate)
 {
-    int retval = 0;
-    /*
-     * get clk
-     */
-    DEV_DBG(dev, "of_clk_get(0) start.\n");
-    {
-        this->clk = of_clk_get(dev->of_node, 0);
-        if (IS_ERR_OR_NULL(this->clk)) {
-            dev_err(dev, "of_clk_get(0) failed.\n");
-            retval = PTR_ERR(this->clk);
-            this->clk = NULL;
-            goto failed;
-        }
-    }    
-    DEV_DBG(dev, "of_clk_get(0) done.\n");
-    /*
-     * get resource clock list
-     */
-    DEV_DBG(dev, "of_clk_get(1..) start.\n");
-    {
-        int         clk_index;
-        struct clk* clk_list[32];
-        
-        for (clk_index = 0; clk_index < sizeof(clk_list); clk_index++) {
-            struct clk* resource_clk = of_clk_get(dev->of_node, clk_index+1);
-            if (IS_ERR_OR_NULL(resource_clk))
-                break;
-            clk_list[clk_index] = resource_clk;
-        }
-        this->resource_clks_size = clk_index;
-        if (this->resource_clks_size > 0) {
-            this->resource_clks = kzalloc(this->resource_clks_size*sizeof(struct clk*), GFP_KERNEL);
-            if (IS_ERR_OR_NULL(this->resource_clks)) {
-                dev_err(dev, "create resource_clks falied.\n");
-                for (clk_index = 0; clk_index < this->resource_clks_size; clk_index++) {
-                    clk_put(clk_list[clk_index]);
-                }
-                retval = PTR_ERR(this->resource_clks);
-                this->resource_clks      = NULL;
-                this->resource_clks_size = 0;
-                this->resource_clk_id    = 0;
-                goto failed;
-            } else {
-                for (clk_index = 0; clk_index < this->resource_clks_size; clk_index++) {
-                    this->resource_clks[clk_index] = clk_list[clk_index];
-                }
-                this->resource_clk_id   = -1;   /* Uninitialized resclk flag */
-            }
-        } else {
-                this->resource_clks      = NULL;
-                this->resource_clks_size = 0;
-                this->resource_clk_id    = 0;
-        }
-    }
-    DEV_DBG(dev, "of_clk_get(1..) done.\n");
+    unsigned long request  = max_rate;
+    long          round    = 0;
+    int           retry;
 
-    /*
-     * get insert state
-     */
-    if (this->resource_clks != NULL) {
-        this->insert.resclk_valid = true; 
-        this->insert.resclk       = 0;
+    for (retry = 0; retry < 16; retry++) {
+        round = clk_round_rate(target->clk, request);
+        if (round <= 0)
+            return -ERANGE;
+        if ((unsigned long)round <= max_rate)
+            break;
+        if ((unsigned long)round - max_rate >= request)
+            return -ERANGE;
+        request -= (unsigned long)round - max_rate;
     }
-    retval = fclk_device_get_state_property(
-                 this, dev, dev->of_node,
-                 "insert-rate", "insert-enable", "insert-resource", &this->insert
-             );
-    if (retval)
-        goto failed;
+    if ((unsigned long)round > max_rate)
+        return -ERANGE;
+    *rate = (unsigned long)round;
+    return 0;
+}
 
-    /*
-     * get disable_retry
-     */
-    {
-        const char*  prop_name = "disable-retry";
-        unsigned int prop_value;
+/**
+ * __fclk_round_rate_in_range() - highest rate within min_rate and max_rate.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @target:     Pointer to the fclk target.
+ * @rate:       address to store the rate.
+ * Return:      Success(=0) or -ERANGE if no rate is in range.
+ */
+static int __fclk_round_rate_in_range(struct fclk_device_data* this, struct fclk_target* target, unsigned long* rate)
+{
+    unsigned long max_rate = (this->max_rate != 0) ? this->max_rate : ULONG_MAX;
+    int           status;
+
+    if (0 != (status = __fclk_round_rate_down(target, max_rate, rate)))
+        return status;
+    if (*rate < this->min_rate)
+        return -ERANGE;
+    return 0;
+}
 
-        DEV_DBG(dev, "get %s start.\n", prop_name);
+/**
+ * __fclk_round_rate_max_on_resource() - estimate highest rate in range on a resource clock.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @target:     Pointer to the fclk target.
+ * @index:      index of resource_clks.
+ * @rate:       address to store the rate.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * Like __fclk_round_rate_on_resource(), the resource clock is not selected.
+ * On the selected resource clock the rate is rounded by the clock framework.
+ * On the others the highest rate not above max_rate is estimated, with an
+ * integer divider or a retuned resource clock.
+ */
+static int __fclk_round_rate_max_on_resource(struct fclk_device_data* this, struct fclk_target* target, int index, unsigned long* rate)
+{
+    unsigned long max_rate = (this->max_rate != 0) ? this->max_rate : ULONG_MAX;
+    unsigned long parent_rate;
+    unsigned long div;
+    long          round;
 
-        retval = of_property_read_u32(dev->of_node, prop_name, &prop_value);
+    if (index == target->resource_clk_id)
+        return __fclk_round_rate_in_range(this, target, rate);
 
-        if (retval == 0) {
-            this->disable_retry = prop_value;
-            DEV_DBG(dev, "get %s property (=%d).\n", prop_name, prop_value);
-        } else {
-            this->disable_retry = disable_retry;
-            DEV_DBG(dev, "set %s = %d\n", prop_name, disable_retry);
-        }
-        DEV_DBG(dev, "get %s done.\n", prop_name);
+    round = __fclk_round_rate_on_resource(this, target, index, max_rate);
+    if (round < 0)
+        return (int)round;
+    if ((round == 0) || ((unsigned long)round > max_rate)) {
+        parent_rate = clk_get_rate(this->resource_clks[index]);
+        div   = parent_rate / max_rate + ((parent_rate % max_rate) ? 1 : 0);
+        round = (div > 0) ? parent_rate / div : parent_rate;
     }
-    /*
-     * enable synchronization
-     */
-    {
-        const char*  prog_name = "enable synchronization";
-        const char*  prop_name = "enable-sync";
-        bool         clk_enable_sync;
+    if ((round == 0) || ((unsigned long)round < this->min_rate))
+        return -ERANGE;
+    *rate = (unsigned long)round;
+    return 0;
+}
 
-        if (enable_sync != 0)
-            clk_enable_sync = true;
-        else
-            clk_enable_sync = of_property_read_bool(dev->of_node, prop_name);
+/**
+ * __fclk_set_rate_max() - set highest rate within min_rate and max_rate.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @target:     Pointer to the fclk target.
+ * @resclk_fixed: the resource clock is specified by the same request.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * Unless the resource clock is fixed, the highest rate within range is
+ * estimated on every resource clock without selecting it, and only the
+ * resource clock giving the highest rate is selected, once. -ERANGE is
+ * returned without changing any clock if no resource clock gives a rate
+ * within range.
+ */
+static int __fclk_set_rate_max(struct fclk_device_data* this, struct fclk_target* target, bool resclk_fixed)
+{
+    unsigned long best_rate  = 0;
+    int           best_index = target->resource_clk_id;
+    unsigned long rate;
+    unsigned long achieved;
+    int           status;
+    int           index;
 
-        if (clk_enable_sync == true) {
-            if (__clk_is_enabled(this->clk)) {
-                DEV_DBG(dev, "%s start.\n", prog_name);
-                retval = clk_prepare_enable(this->clk);
-                if (retval) 
-                    dev_err(dev, "%s failed(%d).\n", prog_name, retval);
-                else
-                    DEV_DBG(dev, "%s success.\n", prog_name);
-                DEV_DBG(dev, "%s done.\n", prog_name);
+    if ((resclk_fixed == true) || (this->resource_clks == NULL)) {
+        if (0 == __fclk_round_rate_in_range(this, target, &rate))
+            best_rate = rate;
+    } else {
+        for (index = 0; index < this->resource_clks_size; index++) {
+            if ((0 == __fclk_round_rate_max_on_resource(this, target, index, &rate)) && (rate > best_rate)) {
+                best_rate  = rate;
+                best_index = index;
             }
         }
+        if ((best_rate != 0) && (best_index != target->resource_clk_id)) {
+            if (0 != (status = __fclk_change_resource(this, target, best_index)))
+                return status;
+            /* the estimate is replaced by the rate rounded on the selected resource clock */
+            best_rate = 0;
+            if (0 == __fclk_round_rate_in_range(this, target, &rate))
+                best_rate = rate;
+        }
     }
-    /*
-     * change state to insert
-     */
-    retval = __fclk_change_state(this, &this->insert);
-    if (retval) {
-        dev_err(dev, "fclk change state failed(%d).\n", retval);
-        goto failed;
+    if (best_rate == 0) {
+        dev_err(this->device, "no rate in range %lu..%lu.\n", this->min_rate, this->max_rate);
+        return -ERANGE;
     }
-    this->insert.enable = __clk_is_enabled(this->clk);
-    this->insert.rate   = clk_get_rate(this->clk);
-    this->insert.resclk = this->resource_clk_id;
-
-    /*
-     * get remove state
-     */
-    retval = fclk_device_get_state_property(
-                 this, dev, dev->of_node,
-                 "remove-rate", "remove-enable", "remove-resource", &this->remove
-             );
-    if (retval)
-        goto failed;
 
+    target->requested_rate = best_rate;
+    if (0 != (status = __fclk_set_rate(this, target, best_rate)))
+        return status;
+    achieved = clk_get_rate(target->clk);
+    if ((achieved < this->min_rate) || ((this->max_rate != 0) && (achieved > this->max_rate))) {
+        dev_err(this->device, "rate %lu is out of range %lu..%lu.\n", achieved, this->min_rate, this->max_rate);
+        return -ERANGE;
+    }
     return 0;
+}
 
- failed:
-    return retval;
+/**
+ * __fclk_enforce_record() - record current state of target0 as desired state.
+ *
+ * @this:       Pointer to the fclk device data.
+ */
+static void __fclk_enforce_record(struct fclk_device_data* this)
+{
+    struct fclk_state* desired = &this->enforce_desired;
+
+    desired->rate         = clk_get_rate(this->target.clk);
+    desired->rate_valid   = true;
+    desired->enable       = __clk_is_enabled(this->target.clk);
+    desired->enable_valid = true;
+    desired->resclk       = (this->target.resource_clk_id >= 0) ? this->target.resource_clk_id : 0;
+    desired->resclk_valid = (this->target.resource_clk_id >= 0);
 }
 
 /**
- * fclk_device_cleanup()   - Clean up the fclk device data.
+ * __fclk_set_rate_verified() - set clock rate and verify it by read back.
  *
  * @this:       Pointer to the fclk device data.
+ * @target:     Pointer to the fclk target.
+ * @rate:       rate.
+ * @resclk_fixed: the resource clock is specified by the same request.
  * Return:      Success(=0) or error status(<0).
  *
+ * If the rate read back by clk_get_rate() is out of tolerance and the
+ * resource clock is not fixed, the other resource clocks are tried in order.
+ * Returns -ERANGE if no resource clock gives a rate within tolerance.
  */
-static int fclk_device_cleanup(struct fclk_device_data* this)
+static int __fclk_set_rate_verified(struct fclk_device_data* this, struct fclk_target* target, unsigned long rate, bool resclk_fixed)
 {
-    if (!this)
-        return -ENODEV;
+    int           status;
+    int           index;
+    unsigned long achieved;
 
-    if (this->clk) {
-        clk_put(this->clk);
-        this->clk = NULL;
-    }
-    if (this->resource_clks != NULL) {
-        int i;
-        for (i = 0 ; i < this->resource_clks_size ; i++) {
-            struct clk* resource_clk = this->resource_clks[i];
-            clk_put(resource_clk);
+    target->requested_rate = rate;
+    if (0 != (status = __fclk_set_rate(this, target, rate)))
+        return status;
+    achieved = clk_get_rate(target->clk);
+    if (__fclk_rate_in_tolerance(this, rate, achieved) == true)
+        return 0;
+    dev_warn(this->device, "rate %lu is out of tolerance (requested %lu, %lld ppm).\n",
+             achieved, rate, (long long)__fclk_rate_error_ppm(rate, achieved));
+
+    if ((resclk_fixed == false) && (this->resource_clks != NULL)) {
+        int first = target->resource_clk_id;
+        for (index = 0; index < this->resource_clks_size; index++) {
+            if (index == first)
+                continue;
+            if (0 != __fclk_change_resource(this, target, index))
+                continue;
+            if (0 != __fclk_set_rate(this, target, rate))
+                continue;
+            achieved = clk_get_rate(target->clk);
+            if (__fclk_rate_in_tolerance(this, rate, achieved) == true) {
+                dev_info(this->device, "rate %lu is in tolerance with resource %d.\n", achieved, index);
+                return 0;
+            }
         }
-        kfree(this->resource_clks);
-        this->resource_clks  = NULL;
     }
-    this->resource_clks_size = 0;
-    this->resource_clk_id    = 0;
-    return 0;
+    dev_err(this->device, "set_rate(%lu) failed, out of tolerance.\n", rate);
+    return -ERANGE;
 }
 
 /**
- * DOC: fclkcfg device operations
+ * struct fclk_transition - per target record of a state change.
+ */
+struct fclk_transition {
+    struct fclk_state    prev;
+    bool                 held;
+    bool                 next_enable;
+    bool                 next_resclk;
+    bool                 start;
+    bool                 prepare;
+};
+
+/**
+ * __fclk_group_enable() - enable clocks of targets together.
  *
- * This section defines the operation of fclkcfg device.
+ * @this:       Pointer to the fclk device data.
+ * @trans:      transition records, targets with start=true are enabled.
+ * Return:      Success(=0) or error status(<0).
  *
- * * fclkcfg_sys_class        - fclkcfg system class.
- * * fclkcfg_device_number    - fclkcfg device major number.
- * * fclkcfg_device_ida       - fclkcfg device minor number allocator variable.
- * * fclkcfg_device_attrs     - fclkcfg device attribute table.
+ * All clocks are prepared first, then enabled back to back, so that the
+ * skew between the enables is not stretched by the sleeping prepare step.
+ * Targets already prepared (keep prepared mode) skip the prepare step.
+ */
+static int __fclk_group_enable(struct fclk_device_data* this, struct fclk_transition* trans)
+{
+    int size   = __fclk_targets_size(this);
+    int status = 0;
+    int prepared;
+    int enabled;
+    int started = 0;
+
+    for (prepared = 0; prepared < size; prepared++) {
+        trans[prepared].prepare = false;
+        if ((trans[prepared].start == false) || (__fclk_get_target(this, prepared)->prepare_refs > 0))
+            continue;
+        if (0 != (status = clk_prepare(__fclk_get_target(this, prepared)->clk)))
+            goto unprepare;
+        trans[prepared].prepare = true;
+    }
+    for (enabled = 0; enabled < size; enabled++) {
+        if (trans[enabled].start == false)
+            continue;
+        if (0 != (status = clk_enable(__fclk_get_target(this, enabled)->clk)))
+            goto disable;
+        started++;
+    }
+    for (enabled = 0; enabled < size; enabled++) {
+        struct fclk_target* target = __fclk_get_target(this, enabled);
+        if (trans[enabled].prepare == true)
+            target->prepare_refs++;
+        if (trans[enabled].start == true)
+            target->enable_refs++;
+    }
+    if (started > 0) {
+        DEV_DBG(this->device, "enable success.");
+        __fclk_settle(this->enable_settle_us, &this->enable_settle);
+    }
+    return 0;
+
+ disable:
+    while (--enabled >= 0) {
+        if (trans[enabled].start == true)
+            clk_disable(__fclk_get_target(this, enabled)->clk);
+    }
+ unprepare:
+    while (--prepared >= 0) {
+        if (trans[prepared].prepare == true)
+            clk_unprepare(__fclk_get_target(this, prepared)->clk);
+    }
+    dev_err(this->device, "enable failed.");
+    return status;
+}
+
+/**
+ * __fclk_rollback_state() - restore clock state after failed change.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @trans:	transition records with the state recorded before the change.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * Undo the steps of __fclk_change_group_state() in reverse order: stop the
+ * clocks, then restore the rates of retunable resource clocks, resource
+ * clock and rate of each target, and enable the clocks that fclkcfg held
+ * enabled before the change. Every step is attempted even if an earlier one fails, and the first error
+ * is returned. The only exception: if a target can not be stopped because
+ * other consumers hold it, the resource clocks and rates are left as they
+ * are, since changing them would glitch the running clock.
+ */
+static int __fclk_rollback_state(struct fclk_device_data* this, struct fclk_transition* trans)
+{
+    int  size    = __fclk_targets_size(this);
+    int  retval  = 0;
+    bool stopped = true;
+    int  status;
+    int  i;
+
+    for (i = 0; i < size; i++) {
+        struct fclk_target* target = __fclk_get_target(this, i);
+        if (__clk_is_enabled(target->clk) == true) {
+            if (0 != (status = __fclk_set_enable(this, target, false))) {
+                retval  = (retval) ? retval : status;
+                stopped = false;
+            }
+        }
+    }
+    if (this->keep_prepared == true)
+        __fclk_release_prepare(this);
+    if (stopped == true) {
+        if (0 != (status = __fclk_restore_resource_rates(this)))
+            retval = (retval) ? retval : status;
+    }
+    for (i = size-1; i >= 0; i--) {
+        struct fclk_target* target = __fclk_get_target(this, i);
+        struct fclk_state*  prev   = &trans[i].prev;
+        if ((stopped == true) && (prev->resclk_valid == true) && (prev->resclk != target->resource_clk_id)) {
+            if (0 != (status = __fclk_change_resource(this, target, prev->resclk)))
+                retval = (retval) ? retval : status;
+        }
+        if ((stopped == true) && (prev->rate_valid == true) && (prev->rate != clk_get_rate(target->clk))) {
+            if (0 != (status = __fclk_set_rate(this, target, prev->rate)))
+                retval = (retval) ? retval : status;
+        }
+        trans[i].start = ((trans[i].held == true) && (target->enable_refs == 0));
+    }
+    if (0 != (status = __fclk_group_enable(this, trans)))
+        retval = (retval) ? retval : status;
+    return retval;
+}
+
+/**
+ * __fclk_transition_record() - record time of transition.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @start:      time the transition started.
+ * @gated:      time the first clock was stopped, or 0.
+ * @enabled:    time the clocks were started again, or 0.
+ * @retval:     result of the transition.
+ * @rollback:   the transition was rolled back.
+ */
+static void __fclk_transition_record(struct fclk_device_data* this, ktime_t start, ktime_t gated, ktime_t enabled, int retval, bool rollback)
+{
+    struct fclk_transition_stat* stat    = &this->transition_stat;
+    s64                          elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+    stat->count++;
+    stat->last_ns   = elapsed;
+    stat->total_ns += elapsed;
+    if ((stat->count == 1) || (elapsed < stat->min_ns))
+        stat->min_ns = elapsed;
+    if (elapsed > stat->max_ns)
+        stat->max_ns = elapsed;
+    if (retval)
+        stat->failures++;
+    if (rollback)
+        stat->rollbacks++;
+    if ((gated != 0) && (enabled != 0)) {
+        s64 gated_ns = ktime_to_ns(ktime_sub(enabled, gated));
+        stat->gated_count++;
+        stat->gated_last_ns = gated_ns;
+        if (gated_ns > stat->gated_max_ns)
+            stat->gated_max_ns = gated_ns;
+    }
+}
+
+/**
+ * __fclk_power_of_rate() - estimate power of a target at a rate.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @rate:       clock rate.
+ * Return:      power in uW while the target is enabled.
+ *
+ * The power table is interpolated linearly between its points and clamped
+ * at both ends. Without the table, static_uw plus dynamic_uw_per_mhz per MHz.
+ */
+static unsigned long __fclk_power_of_rate(struct fclk_device_data* this, unsigned long rate)
+{
+    struct fclk_power*       power = &this->power;
+    struct fclk_power_point* table = power->table;
+    int                      i;
+
+    if (table == NULL)
+        return power->static_uw + (unsigned long)div_u64((u64)rate * power->dynamic_uw_per_mhz, 1000000);
+    if (rate <= table[0].rate)
+        return table[0].uw;
+    for (i = 1; i < power->table_size; i++) {
+        if (rate <= table[i].rate) {
+            u32 span = (u32)(table[i].rate - table[i-1].rate);
+            u64 pos  = rate - table[i-1].rate;
+            if (table[i].uw >= table[i-1].uw)
+                return table[i-1].uw + (unsigned long)div_u64((table[i].uw - table[i-1].uw) * pos, span);
+            else
+                return table[i-1].uw - (unsigned long)div_u64((table[i-1].uw - table[i].uw) * pos, span);
+        }
+    }
+    return table[power->table_size-1].uw;
+}
+
+/**
+ * __fclk_power_account() - integrate energy and set current power.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @power_uw:   new current power in uW.
+ *
+ * The energy since the last call is counted with the previous power.
+ * Called with atomic_lock held.
+ */
+static void __fclk_power_account(struct fclk_device_data* this, unsigned long power_uw)
+{
+    struct fclk_power* power = &this->power;
+    ktime_t            now   = ktime_get();
+    s64                delta = ktime_to_ns(ktime_sub(now, power->last));
+    u32                delta_ns;
+    u64                delta_s;
+
+    if (delta > 0) {
+        delta_s  = div_u64_rem((u64)delta, NSEC_PER_SEC, &delta_ns);
+        power->energy_uj += (u64)power->power_uw * delta_s;
+        power->energy_uj += div_u64_rem((u64)power->power_uw * delta_ns + power->energy_rem,
+                                        NSEC_PER_SEC, &power->energy_rem);
+    }
+    power->last     = now;
+    power->power_uw = power_uw;
+}
+
+/**
+ * __fclk_power_update() - update current power from clock state.
+ *
+ * @this:       Pointer to the fclk device data.
+ *
+ * Called with this->lock held after a change of the clocks.
+ */
+static void __fclk_power_update(struct fclk_device_data* this)
+{
+    unsigned long active_uw = 0;
+    unsigned long power_uw  = 0;
+    unsigned long flags;
+    int           i;
+
+    if (this->power.valid == false)
+        return;
+    for (i = 0; i < __fclk_targets_size(this); i++) {
+        struct fclk_target* target = __fclk_get_target(this, i);
+        unsigned long       uw     = __fclk_power_of_rate(this, clk_get_rate(target->clk));
+        active_uw += uw;
+        if (__clk_is_enabled(target->clk) == true)
+            power_uw += uw;
+    }
+    spin_lock_irqsave(&this->atomic_lock, flags);
+    __fclk_power_account(this, power_uw);
+    this->power.active_uw = active_uw;
+    spin_unlock_irqrestore(&this->atomic_lock, flags);
+}
+
+/**
+ * __fclk_ratio_refused() - rate change refused by rate ratios.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @next:       next state of target0.
+ * Return:      true if @next changes the rate or resource clock of a device
+ *              linked by rate ratios without solving the ratios.
+ *
+ * ratio_linked is kept by fclkcfg_ratio_update(). Called with this->lock held.
+ */
+static inline bool __fclk_ratio_refused(struct fclk_device_data* this, struct fclk_state* next)
+{
+    return (this->ratio_linked == true) && (next->ratio_solved == false) &&
+           ((next->rate_valid == true) || (next->rate_max == true) || (next->resclk_valid == true));
+}
+
+/**
+ * __fclk_change_group_state() - change clock state of all targets.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @next:	array of next state to change, one for each target.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The targets are changed as one unit: if the rate or resource clock of
+ * any target changes, all running clocks are stopped first, every target is
+ * changed, and then the clocks are started together.
+ *
+ * If a step fails after the clocks have been stopped, the rate, resource
+ * clock and enable recorded before the change are restored, and the error
+ * of the failed step is returned.
+ *
+ * When @next does not set the enable of a target, it keeps the enable
+ * reference held by fclkcfg (not the hardware state). So a clock that only
+ * other consumers enable is left to them: fclkcfg neither takes a new enable
+ * reference for it, nor can it stop the clock for a change (-EBUSY).
+ *
+ * If resets are specified, they are asserted before the clocks are changed
+ * and deasserted after the clocks are running again. On every error exit
+ * the resets are also deasserted if any target is still running, so that
+ * the PL is never left in reset on a running clock.
+ *
+ * A rate or resource clock change of target0 of a device linked by rate
+ * ratios is refused with -EBUSY, unless it is solved by
+ * fclkcfg_ratio_set_rate(), see __fclk_ratio_refused().
+ *
+ * In keep prepared mode the gated targets are unprepared for the rate and
+ * resource clock change and prepared again before returning. The atomic API
+ * is refused with -EBUSY while in_transition is set.
+ *
+ * The caller must hold this->lock. The same applies to every function that
+ * changes the clock state, see "fclk device locking".
+ */
+static int __fclk_change_group_state(struct fclk_device_data* this, struct fclk_state* next)
+{
+    unsigned long           flags;
+    int                     size       = __fclk_targets_size(this);
+    int                     retval     = 0;
+    int                     rollback;
+    int                     gated      = 0;
+    int                     i;
+    bool                    transition = false;
+    bool                    changed    = false;
+    bool                    running    = false;
+    bool                    rolled_back = false;
+    bool                    resclk_changed = false;
+    bool                    rate_changed   = false;
+    ktime_t                 start      = 0;
+    ktime_t                 gated_at   = 0;
+    ktime_t                 enabled_at = 0;
+    struct fclk_transition* trans;
+
+    lockdep_assert_held(&this->lock);
+
+    if (this->removed == true)
+        return -ENODEV;
+    if (__fclk_ratio_refused(this, &next[0]) == true)
+        return -EBUSY;
+
+    trans = kcalloc(size, sizeof(*trans), GFP_KERNEL);
+    if (trans == NULL)
+        return -ENOMEM;
+    spin_lock_irqsave(&this->atomic_lock, flags);
+    this->in_transition = true;
+    spin_unlock_irqrestore(&this->atomic_lock, flags);
+
+    for (i = 0; i < size; i++) {
+        struct fclk_target* target = __fclk_get_target(this, i);
+        struct fclk_state*  prev   = &trans[i].prev;
+        prev->rate           = clk_get_rate(target->clk);
+        prev->rate_valid     = true;
+        prev->enable         = __clk_is_enabled(target->clk);
+        prev->enable_valid   = true;
+        prev->resclk         = target->resource_clk_id;
+        prev->resclk_valid   = (target->resource_clk_id >= 0);
+        trans[i].held        = (target->enable_refs > 0);
+        trans[i].next_enable = (next[i].enable_valid == true) ? next[i].enable : trans[i].held;
+        trans[i].next_resclk = ((next[i].resclk_valid == true) &&
+                                (next[i].resclk != target->resource_clk_id));
+        if ((next[i].rate_valid == true) || (next[i].rate_max == true) || (trans[i].next_resclk == true))
+            transition = true;
+        if (trans[i].next_enable != prev->enable)
+            changed    = true;
+    }
+    if ((transition == false) && (changed == false))
+        goto done;
+    start = ktime_get();
+    __fclk_save_resource_rates(this);
+
+    if (0 != (retval = __fclk_assert_reset(this)))
+        goto done;
+
+    if (transition == true) {
+        for (i = 0; i < size; i++) {
+            struct fclk_target* target = __fclk_get_target(this, i);
+            if (__clk_is_enabled(target->clk) == false)
+                continue;
+            if (gated == 0)
+                gated_at = ktime_get();
+            if (0 != (retval = __fclk_set_enable(this, target, false))) {
+                if (gated == 0) {
+                    /* nothing has been stopped, take back the enable reference held before */
+                    if (trans[i].held == true)
+                        __fclk_set_enable(this, target, true);
+                    goto release;
+                }
+                goto failed;
+            }
+            gated++;
+        }
+        if (this->keep_prepared == true)
+            __fclk_release_prepare(this);
+    }
+    for (i = 0; i < size; i++) {
+        struct fclk_target* target = __fclk_get_target(this, i);
+        if (trans[i].next_resclk == true) {
+            if (0 != (retval = __fclk_change_resource(this, target, next[i].resclk)))
+                goto failed;
+        }
+        if (next[i].rate_valid == true) {
+            if (0 != (retval = __fclk_set_rate_verified(this, target, next[i].rate, next[i].resclk_valid)))
+                goto failed;
+        } else if (next[i].rate_max == true) {
+            if (0 != (retval = __fclk_set_rate_max(this, target, next[i].resclk_valid)))
+                goto failed;
+        }
+    }
+    for (i = 0; i < size; i++) {
+        struct fclk_target* target = __fclk_get_target(this, i);
+        if (target->resource_clk_id != trans[i].prev.resclk)
+            resclk_changed = true;
+        if (clk_get_rate(target->clk) != trans[i].prev.rate)
+            rate_changed   = true;
+    }
+    for (i = 0; i < size; i++) {
+        struct fclk_target* target = __fclk_get_target(this, i);
+        if ((trans[i].next_enable == false) && (__clk_is_enabled(target->clk) == true)) {
+            if (0 != (retval = __fclk_set_enable(this, target, false))) {
+                if (transition == false)
+                    goto release;
+                goto failed;
+            }
+        }
+        trans[i].start = ((trans[i].next_enable == true) && (target->enable_refs == 0));
+    }
+    if (0 != (retval = __fclk_group_enable(this, trans))) {
+        if (transition == false)
+            goto release;
+        goto failed;
+    }
+    enabled_at = ktime_get();
+    for (i = 0; i < size; i++) {
+        if (__clk_is_enabled(__fclk_get_target(this, i)->clk) == true)
+            running = true;
+    }
+    if (running == true) {
+        __fclk_settle_changes(this, resclk_changed, rate_changed);
+        retval = __fclk_deassert_reset(this);
+    }
+    goto done;
+
+ failed:
+    rollback = __fclk_rollback_state(this, trans);
+    rolled_back = true;
+    resclk_changed = true;
+    rate_changed   = true;
+    if (rollback)
+        dev_err(this->device, "change state failed(%d), rollback failed(%d).\n", retval, rollback);
+    else
+        dev_err(this->device, "change state failed(%d), rollback done.\n", retval);
+ release:
+    for (i = 0; i < size; i++) {
+        if (__clk_is_enabled(__fclk_get_target(this, i)->clk) == true)
+            running = true;
+    }
+    if (running == true) {
+        __fclk_settle_changes(this, resclk_changed, rate_changed);
+        __fclk_deassert_reset(this);
+    }
+ done:
+    if (retval == 0)
+        __fclk_enforce_record(this);
+    if (start != 0)
+        __fclk_transition_record(this, start, gated_at, enabled_at, retval, rolled_back);
+    if (this->keep_prepared == true)
+        __fclk_keep_prepare(this);
+    if (start != 0)
+        __fclk_power_update(this);
+    spin_lock_irqsave(&this->atomic_lock, flags);
+    this->in_transition = false;
+    spin_unlock_irqrestore(&this->atomic_lock, flags);
+    kfree(trans);
+    return retval;
+}
+
+/**
+ * __fclk_change_target_state() - change clock state of one target.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @index:      index of target.
+ * @next:	next state to change.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The other targets keep their state, but are stopped and started together
+ * with the target if its rate or resource clock changes.
+ */
+static int __fclk_change_target_state(struct fclk_device_data* this, int index, struct fclk_state* next)
+{
+    int                size = __fclk_targets_size(this);
+    int                retval;
+    int                i;
+    struct fclk_state* next_list;
+
+    if (size == 1)
+        return __fclk_change_group_state(this, next);
+
+    next_list = kcalloc(size, sizeof(*next_list), GFP_KERNEL);
+    if (next_list == NULL)
+        return -ENOMEM;
+    for (i = 0; i < size; i++)
+        fclk_state_clear(&next_list[i]);
+    next_list[index] = *next;
+    retval = __fclk_change_group_state(this, next_list);
+    kfree(next_list);
+    return retval;
+}
+
+/**
+ * __fclk_change_state() - change clock state.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @next:	next state to change.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The rate and resource clock of @next are applied to target0. The enable
+ * of @next is applied to all targets, so that a group is started and
+ * stopped as one unit.
+ */
+static int __fclk_change_state(struct fclk_device_data* this, struct fclk_state* next)
+{
+    int                size = __fclk_targets_size(this);
+    int                retval;
+    int                i;
+    struct fclk_state* next_list;
+
+    if (size == 1)
+        return __fclk_change_group_state(this, next);
+
+    next_list = kcalloc(size, sizeof(*next_list), GFP_KERNEL);
+    if (next_list == NULL)
+        return -ENOMEM;
+    next_list[0] = *next;
+    for (i = 1; i < size; i++) {
+        fclk_state_clear(&next_list[i]);
+        next_list[i].enable       = next->enable;
+        next_list[i].enable_valid = next->enable_valid;
+    }
+    retval = __fclk_change_group_state(this, next_list);
+    kfree(next_list);
+    return retval;
+}
+
+/**
+ * __fclk_change_all_state() - change clock state of every target.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @next:	next state to change.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * Unlike __fclk_change_state(), the rate and resource clock of @next are
+ * applied to every target. Used for the insert, remove and program states,
+ * which are applied even if the device is linked by rate ratios.
+ */
+static int __fclk_change_all_state(struct fclk_device_data* this, struct fclk_state* next)
+{
+    int                size = __fclk_targets_size(this);
+    int                retval;
+    int                i;
+    struct fclk_state  state = *next;
+    struct fclk_state* next_list;
+
+    state.ratio_solved = true;
+    if (size == 1)
+        return __fclk_change_group_state(this, &state);
+
+    next_list = kcalloc(size, sizeof(*next_list), GFP_KERNEL);
+    if (next_list == NULL)
+        return -ENOMEM;
+    for (i = 0; i < size; i++)
+        next_list[i] = state;
+    retval = __fclk_change_group_state(this, next_list);
+    kfree(next_list);
+    return retval;
+}
+
+/**
+ * __fclk_change_state_staged() - change clock state, staging changes while gated.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @next:	next state to change.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * Without staged mode this is __fclk_change_state(). In staged mode, if
+ * target0 stays gated after @next, the rate and resource clock of @next are
+ * only stored in the pending state. If target0 runs after @next, the pending
+ * state is merged into @next (the values of @next take precedence) and
+ * applied in one transition, and the pending state is cleared on success.
+ */
+static int __fclk_change_state_staged(struct fclk_device_data* this, struct fclk_state* next)
+{
+    struct fclk_state state;
+    bool              running;
+    int               status;
+
+    if (this->staged == false)
+        return __fclk_change_state(this, next);
+    if (__fclk_ratio_refused(this, next) == true)
+        return -EBUSY;
+
+    running = __clk_is_enabled(this->target.clk);
+    if (((next->enable_valid == true) && (next->enable == false)) ||
+        ((next->enable_valid == false) && (running == false))) {
+        if ((next->rate_valid == true) || (next->rate_max == true)) {
+            this->pending.rate         = next->rate;
+            this->pending.rate_valid   = next->rate_valid;
+            this->pending.rate_max     = next->rate_max;
+        }
+        if (next->resclk_valid == true) {
+            this->pending.resclk       = next->resclk;
+            this->pending.resclk_valid = true;
+        }
+        if (running == false)
+            return 0;
+        fclk_state_clear(&state);
+        state.enable       = false;
+        state.enable_valid = true;
+        return __fclk_change_state(this, &state);
+    }
+
+    state = *next;
+    if ((state.rate_valid == false) && (state.rate_max == false)) {
+        state.rate         = this->pending.rate;
+        state.rate_valid   = this->pending.rate_valid;
+        state.rate_max     = this->pending.rate_max;
+    }
+    if ((state.resclk_valid == false) && (this->pending.resclk_valid == true)) {
+        state.resclk       = this->pending.resclk;
+        state.resclk_valid = true;
+    }
+    if (0 != (status = __fclk_change_state(this, &state)))
+        return status;
+    fclk_state_clear(&this->pending);
+    return 0;
+}
+
+/**
+ * __fclk_set_rate_range() - set rate range of every target.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @min_rate:   minimum rate.
+ * @max_rate:   maximum rate (0 means no limit).
+ * Return:      Success(=0) or error status(<0).
+ *
+ * Every target is tried even if an earlier one fails, and the first error
+ * is returned.
+ */
+static int __fclk_set_rate_range(struct fclk_device_data* this, unsigned long min_rate, unsigned long max_rate)
+{
+    int retval = 0;
+    int status;
+    int i;
+
+    for (i = 0; i < __fclk_targets_size(this); i++) {
+        struct fclk_target* target = __fclk_get_target(this, i);
+        status = clk_set_rate_range(target->clk, min_rate, (max_rate != 0) ? max_rate : ULONG_MAX);
+        if (status) {
+            dev_err(this->device, "clk_set_rate_range(%s, %lu, %lu) failed(%d).\n",
+                    __clk_get_name(target->clk), min_rate, max_rate, status);
+            retval = (retval) ? retval : status;
+        }
+    }
+    return retval;
+}
+
+/**
+ * __fclk_change_rate_range() - change min_rate and max_rate.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @min_rate:   minimum rate.
+ * @max_rate:   maximum rate (0 means no limit).
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The range applies to every target, as rate=max does, and is passed to
+ * clk_set_rate_range() of each of them. The targets whose current rate is
+ * out of the new range are first moved to the highest rate within range by
+ * one transition, so that the clock framework does not change the rate of a
+ * running clock by itself. On failure the previous range is restored.
+ */
+static int __fclk_change_rate_range(struct fclk_device_data* this, unsigned long min_rate, unsigned long max_rate)
+{
+    int                size     = __fclk_targets_size(this);
+    unsigned long      prev_min = this->min_rate;
+    unsigned long      prev_max = this->max_rate;
+    bool               out      = false;
+    struct fclk_state* next_list;
+    int                status;
+    int                i;
+
+    if ((max_rate != 0) && (min_rate > max_rate))
+        return -EINVAL;
+
+    next_list = kcalloc(size, sizeof(*next_list), GFP_KERNEL);
+    if (next_list == NULL)
+        return -ENOMEM;
+
+    this->min_rate = min_rate;
+    this->max_rate = max_rate;
+    for (i = 0; i < size; i++) {
+        unsigned long rate = clk_get_rate(__fclk_get_target(this, i)->clk);
+        fclk_state_clear(&next_list[i]);
+        if ((rate < min_rate) || ((max_rate != 0) && (rate > max_rate))) {
+            next_list[i].rate_max = true;
+            out = true;
+        }
+    }
+    if (out == true) {
+        status = __fclk_set_rate_range(this, 0, 0);
+        if (status == 0)
+            status = __fclk_change_group_state(this, next_list);
+        if (status)
+            goto failed;
+    }
+    status = __fclk_set_rate_range(this, min_rate, max_rate);
+    if (status)
+        goto failed;
+    kfree(next_list);
+    return 0;
+
+ failed:
+    this->min_rate = prev_min;
+    this->max_rate = prev_max;
+    __fclk_set_rate_range(this, prev_min, prev_max);
+    kfree(next_list);
+    return status;
+}
+
+/**
+ * __fclk_schedule_now() - current time of schedule clock.
+ *
+ * @clock:      CLOCK_MONOTONIC or CLOCK_REALTIME.
+ * Return:      current time.
+ */
+static inline ktime_t __fclk_schedule_now(clockid_t clock)
+{
+    return (clock == CLOCK_REALTIME) ? ktime_get_real() : ktime_get();
+}
+
+/**
+ * __fclk_schedule_work() - apply scheduled transition.
+ *
+ * @work:       work_struct of the fclk schedule.
+ */
+static void __fclk_schedule_work(struct work_struct* work)
+{
+    struct fclk_device_data* this = container_of(work, struct fclk_device_data, schedule.work);
+    ktime_t                  applied;
+    s64                      lateness;
+    int                      result;
+
+    mutex_lock(&this->lock);
+    applied = __fclk_schedule_now(this->schedule.clock);
+    if ((this->schedule.armed == false) || ktime_before(applied, this->schedule.time)) {
+        /* disarmed, or armed again after this work was queued */
+        mutex_unlock(&this->lock);
+        return;
+    }
+    result  = __fclk_change_state(this, &this->schedule.state);
+    lateness = ktime_to_ns(ktime_sub(applied, this->schedule.time));
+    this->schedule.last_time    = this->schedule.time;
+    this->schedule.last_applied = applied;
+    this->schedule.last_result  = result;
+    this->schedule.count++;
+    this->schedule.armed        = false;
+    mutex_unlock(&this->lock);
+    DEV_DBG(this->device, "scheduled transition done(%d), lateness=%lldns.\n", result, (long long)lateness);
+}
+
+/**
+ * __fclk_schedule_timer() - schedule timer expiry.
+ *
+ * @timer:      hrtimer of the fclk schedule.
+ * Return:      HRTIMER_NORESTART.
+ *
+ * Clock operations may sleep, so the transition is applied by a work on
+ * the high priority workqueue.
+ */
+static enum hrtimer_restart __fclk_schedule_timer(struct hrtimer* timer)
+{
+    struct fclk_device_data* this = container_of(timer, struct fclk_device_data, schedule.timer);
+
+    queue_work(system_highpri_wq, &this->schedule.work);
+    return HRTIMER_NORESTART;
+}
+
+/**
+ * __fclk_schedule_init() - initialize schedule timer.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @clock:      CLOCK_MONOTONIC or CLOCK_REALTIME.
+ */
+static void __fclk_schedule_init(struct fclk_device_data* this, clockid_t clock)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0))
+    hrtimer_setup(&this->schedule.timer, __fclk_schedule_timer, clock, HRTIMER_MODE_ABS);
+#else
+    hrtimer_init(&this->schedule.timer, clock, HRTIMER_MODE_ABS);
+    this->schedule.timer.function = __fclk_schedule_timer;
+#endif
+    this->schedule.clock = clock;
+}
+
+/**
+ * __fclk_schedule_disarm() - disarm scheduled transition.
+ *
+ * @this:       Pointer to the fclk device data.
+ *
+ * The caller must hold this->lock. The timer callback does not take the
+ * lock, so it is canceled synchronously. A work that is already queued
+ * finds the schedule disarmed, or armed for a later time, and does nothing.
+ */
+static void __fclk_schedule_disarm(struct fclk_device_data* this)
+{
+    lockdep_assert_held(&this->lock);
+    hrtimer_cancel(&this->schedule.timer);
+    this->schedule.armed = false;
+}
+
+/**
+ * __fclk_schedule_cancel() - cancel scheduled transition.
+ *
+ * @this:       Pointer to the fclk device data.
+ *
+ * Waits for a transition that has already started. Must be called without
+ * this->lock.
+ */
+static void __fclk_schedule_cancel(struct fclk_device_data* this)
+{
+    mutex_lock(&this->lock);
+    __fclk_schedule_disarm(this);
+    mutex_unlock(&this->lock);
+    cancel_work_sync(&this->schedule.work);
+}
+
+/**
+ * __fclk_schedule_arm() - arm scheduled transition.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @clock:      CLOCK_MONOTONIC or CLOCK_REALTIME.
+ * @time:       absolute time to apply @next.
+ * @next:	next state to change.
+ *
+ * A transition already armed is canceled. If @time has passed, the
+ * transition is applied at once and the lateness is recorded. The caller
+ * must hold this->lock.
+ */
+static void __fclk_schedule_arm(struct fclk_device_data* this, clockid_t clock, ktime_t time, struct fclk_state* next)
+{
+    __fclk_schedule_disarm(this);
+    __fclk_schedule_init(this, clock);
+    this->schedule.time  = time;
+    this->schedule.state = *next;
+    this->schedule.armed = true;
+    hrtimer_start(&this->schedule.timer, time, HRTIMER_MODE_ABS);
+}
+
+/**
+ * __fclk_resource_selected() - check that resource clock is a parent of target.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @target:     Pointer to the fclk target.
+ * Return:      false if the recorded resource clock is no longer an ancestor.
+ */
+static bool __fclk_resource_selected(struct fclk_device_data* this, struct fclk_target* target)
+{
+    if ((this->resource_clks == NULL) || (target->resource_clk_id < 0))
+        return true;
+
+    return __fclk_clk_is_ancestor(target->clk, this->resource_clks[target->resource_clk_id]);
+}
+
+/**
+ * __fclk_enforce_diverged() - check that target0 diverged from desired state.
+ *
+ * @this:       Pointer to the fclk device data.
+ * Return:      true if rate, enable or resource clock differs.
+ *
+ * The rate is compared with __fclk_rate_in_tolerance() when a tolerance is
+ * set, otherwise it must be equal.
+ */
+static bool __fclk_enforce_diverged(struct fclk_device_data* this)
+{
+    struct fclk_state* desired = &this->enforce_desired;
+    unsigned long      rate    = clk_get_rate(this->target.clk);
+
+    if ((desired->rate_valid   == true) && (desired->rate   != rate)) {
+        if ((this->rate_tolerance_ppm == 0) && (this->rate_tolerance_hz == 0))
+            return true;
+        if (__fclk_rate_in_tolerance(this, desired->rate, rate) == false)
+            return true;
+    }
+    if ((desired->enable_valid == true) && (desired->enable != __clk_is_enabled(this->target.clk)))
+        return true;
+    if ((desired->resclk_valid == true) && (__fclk_resource_selected(this, &this->target) == false))
+        return true;
+    return false;
+}
+
+/*
+ * Backoff of enforce corrections. The first correction after a quiet period
+ * is made at once; while the clock keeps diverging, the wait before the next
+ * correction doubles from FCLK_ENFORCE_BACKOFF_MIN_MS up to *_MAX_MS.
+ */
+#define FCLK_ENFORCE_BACKOFF_MIN_MS  10
+#define FCLK_ENFORCE_BACKOFF_MAX_MS  10000
+
+/**
+ * __fclk_enforce_work() - check and correct divergence from desired state.
+ *
+ * @work:       work_struct of enforce_work.
+ *
+ * A correction is reported by KOBJ_CHANGE uevent with FCLKCFG_EVENT=enforce.
+ * The desired state is recorded again after the correction, so the next check
+ * compares with the rate that the correction actually achieved.
+ */
+static void __fclk_enforce_work(struct work_struct* work)
+{
+    struct fclk_device_data* this  = container_of(to_delayed_work(work), struct fclk_device_data, enforce_work);
+    unsigned long            retry = 0;
+
+    mutex_lock(&this->lock);
+    if ((this->enforce == true) && (this->in_transition == false) && (__fclk_enforce_diverged(this) == true)) {
+        unsigned long     rate    = clk_get_rate(this->target.clk);
+        struct fclk_state desired = this->enforce_desired;
+        int               result;
+        char              event_env[32];
+        char              rate_env[48];
+        char              result_env[32];
+        char              count_env[48];
+        char*             envp[] = {event_env, rate_env, result_env, count_env, NULL};
+
+        if ((this->enforce_backoff_ms != 0) && time_before(jiffies, this->enforce_next)) {
+            /* corrected a short time ago, wait for the backoff */
+            retry = this->enforce_next - jiffies;
+            goto unlock;
+        }
+        if (__fclk_resource_selected(this, &this->target) == false) {
+            /* the parent was changed by others, select the resource clock again */
+            this->target.resource_clk_id = -1;
+        }
+        /* the desired state is the state solved before, if linked by rate ratios */
+        desired.ratio_solved = true;
+        result = __fclk_change_state(this, &desired);
+        this->enforce_corrections++;
+        dev_warn(this->device, "enforce: rate %lu => %lu, correction %lu done(%d).\n",
+                 rate, clk_get_rate(this->target.clk), this->enforce_corrections, result);
+        snprintf(event_env , sizeof(event_env) , "FCLKCFG_EVENT=enforce");
+        snprintf(rate_env  , sizeof(rate_env)  , "FCLKCFG_RATE=%lu", rate);
+        snprintf(result_env, sizeof(result_env), "FCLKCFG_RESULT=%d", result);
+        snprintf(count_env , sizeof(count_env) , "FCLKCFG_CORRECTIONS=%lu", this->enforce_corrections);
+        kobject_uevent_env(&this->device->kobj, KOBJ_CHANGE, envp);
+        /* restart the backoff after a quiet period, otherwise double it */
+        if ((this->enforce_backoff_ms != 0) &&
+            time_after_eq(jiffies, this->enforce_next + msecs_to_jiffies(this->enforce_backoff_ms)))
+            this->enforce_backoff_ms = 0;
+        if (this->enforce_backoff_ms == 0)
+            this->enforce_backoff_ms = FCLK_ENFORCE_BACKOFF_MIN_MS;
+        else
+            this->enforce_backoff_ms = min_t(unsigned int, this->enforce_backoff_ms * 2, FCLK_ENFORCE_BACKOFF_MAX_MS);
+        this->enforce_next = jiffies + msecs_to_jiffies(this->enforce_backoff_ms);
+        if ((result != 0) || (__fclk_enforce_diverged(this) == true))
+            retry = msecs_to_jiffies(this->enforce_backoff_ms);
+    }
+ unlock:
+    if ((this->enforce == true) && (this->enforce_interval_ms > 0)) {
+        unsigned long delay = msecs_to_jiffies(this->enforce_interval_ms);
+        queue_delayed_work(system_wq, &this->enforce_work, ((retry != 0) && (retry < delay)) ? retry : delay);
+    } else if ((this->enforce == true) && (retry != 0)) {
+        queue_delayed_work(system_wq, &this->enforce_work, retry);
+    }
+    mutex_unlock(&this->lock);
+}
+
+/**
+ * __fclk_enforce_notify() - clock rate change notifier of target0.
+ *
+ * Changes made by fclkcfg itself are ignored. The clock framework holds its
+ * lock while calling notifiers, so the check is done by enforce_work.
+ */
+static int __fclk_enforce_notify(struct notifier_block* nb, unsigned long action, void* data)
+{
+    struct fclk_device_data* this = container_of(nb, struct fclk_device_data, enforce_notifier);
+
+    if ((action == POST_RATE_CHANGE) && (this->in_transition == false))
+        mod_delayed_work(system_wq, &this->enforce_work, 0);
+    return NOTIFY_OK;
+}
+
+/**
+ * __fclk_enforce_start() - start enforce mode.
+ *
+ * @this:       Pointer to the fclk device data.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The current state of target0 is recorded as the desired state. The caller
+ * must hold this->lock.
+ */
+static int __fclk_enforce_start(struct fclk_device_data* this)
+{
+    int retval;
+
+    lockdep_assert_held(&this->lock);
+    if (this->enforce == true)
+        return 0;
+    this->enforce_notifier.notifier_call = __fclk_enforce_notify;
+    retval = clk_notifier_register(this->target.clk, &this->enforce_notifier);
+    if (retval) {
+        dev_err(this->device, "clk_notifier_register failed(%d).\n", retval);
+        return retval;
+    }
+    __fclk_enforce_record(this);
+    this->enforce_backoff_ms    = 0;
+    this->enforce_notifier_done = true;
+    this->enforce               = true;
+    queue_delayed_work(system_wq, &this->enforce_work, 0);
+    return 0;
+}
+
+/**
+ * __fclk_enforce_stop() - stop enforce mode.
+ *
+ * @this:       Pointer to the fclk device data.
+ *
+ * Must be called without this->lock, because enforce_work takes it. If
+ * enforce mode is started again while the work is canceled, the work is
+ * queued again.
+ */
+static void __fclk_enforce_stop(struct fclk_device_data* this)
+{
+    mutex_lock(&this->lock);
+    this->enforce = false;
+    if (this->enforce_notifier_done == true) {
+        clk_notifier_unregister(this->target.clk, &this->enforce_notifier);
+        this->enforce_notifier_done = false;
+    }
+    mutex_unlock(&this->lock);
+    cancel_delayed_work_sync(&this->enforce_work);
+    mutex_lock(&this->lock);
+    if (this->enforce == true)
+        queue_delayed_work(system_wq, &this->enforce_work, 0);
+    mutex_unlock(&this->lock);
+}
+
+/**
+ * __fclk_search_notify() - notify search state to user space.
+ *
+ * @this:       Pointer to the fclk device data.
+ *
+ * User space waits for a new candidate with poll() on the search file.
+ */
+static void __fclk_search_notify(struct fclk_device_data* this)
+{
+    sysfs_notify(&this->device->kobj, NULL, "search");
+}
+
+/**
+ * __fclk_search_finish() - finish search and apply final rate.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @result:     result of the search.
+ *
+ * The final rate is the highest passing rate lowered by margin_ppm, or the
+ * rate before the search if no rate passed. Called with this->lock held.
+ */
+static void __fclk_search_finish(struct fclk_device_data* this, int result)
+{
+    struct fclk_search* search = &this->search;
+    struct fclk_state   state;
+    unsigned long       rate   = search->orig_rate;
+    int                 status;
+
+    if (search->pass_rate != 0) {
+        unsigned long margin = (unsigned long)div_u64((u64)search->pass_rate * search->margin_ppm, 1000000);
+        if (0 != __fclk_round_rate_down(&this->target, search->pass_rate - margin, &rate))
+            rate = search->pass_rate;
+    } else if (result == 0) {
+        result = -ERANGE;
+    }
+    fclk_state_clear(&state);
+    state.rate       = rate;
+    state.rate_valid = true;
+    if (0 != (status = __fclk_change_state(this, &state)))
+        result = (result) ? result : status;
+
+    search->active     = false;
+    search->testing    = false;
+    search->final_rate = clk_get_rate(this->target.clk);
+    search->result     = result;
+    dev_info(this->device, "search done(%d), pass=%lu final=%lu after %lu candidates.\n",
+             result, search->pass_rate, search->final_rate, search->count);
+    __fclk_search_notify(this);
+}
+
+/**
+ * __fclk_search_apply() - apply candidate rate of search.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @rate:       candidate rate.
+ *
+ * Called with this->lock held.
+ */
+static void __fclk_search_apply(struct fclk_device_data* this, unsigned long rate)
+{
+    struct fclk_search* search = &this->search;
+    struct fclk_state   state;
+    int                 status;
+
+    fclk_state_clear(&state);
+    state.rate       = rate;
+    state.rate_valid = true;
+    if (0 != (status = __fclk_change_state(this, &state))) {
+        __fclk_search_finish(this, status);
+        return;
+    }
+    search->candidate = clk_get_rate(this->target.clk);
+    search->testing   = true;
+    search->count++;
+    search->deadline  = jiffies + msecs_to_jiffies(search->timeout_ms);
+    if (search->timeout_ms > 0)
+        mod_delayed_work(system_wq, &search->timeout_work, msecs_to_jiffies(search->timeout_ms));
+    __fclk_search_notify(this);
+}
+
+/**
+ * __fclk_search_next() - select and apply next candidate rate.
+ *
+ * @this:       Pointer to the fclk device data.
+ *
+ * With step, the candidates go up from min_rate by step until one fails.
+ * Without step, the candidates are a binary search of the achievable rates
+ * between the highest passing and the lowest failing rate, starting from
+ * max_rate. Called with this->lock held.
+ */
+static void __fclk_search_next(struct fclk_device_data* this)
+{
+    struct fclk_search* search = &this->search;
+    unsigned long       rate;
+    unsigned long       base;
+
+    if (search->step != 0) {
+        unsigned long limit = (search->pass_rate != 0) ? search->pass_rate + search->step : search->min_rate;
+        if (search->fail_rate != 0) {
+            __fclk_search_finish(this, 0);
+            return;
+        }
+        for (; limit <= search->max_rate; limit += search->step) {
+            if ((0 == __fclk_round_rate_down(&this->target, limit, &rate)) &&
+                (rate >= search->min_rate) && (rate > search->pass_rate)) {
+                __fclk_search_apply(this, rate);
+                return;
+            }
+        }
+        __fclk_search_finish(this, 0);
+        return;
+    }
+
+    if (search->fail_rate == 0) {
+        if ((search->pass_rate == 0) && (0 == __fclk_round_rate_down(&this->target, search->max_rate, &rate)) &&
+            (rate >= search->min_rate)) {
+            __fclk_search_apply(this, rate);
+            return;
+        }
+        __fclk_search_finish(this, 0);
+        return;
+    }
+    base = (search->pass_rate != 0) ? search->pass_rate : search->min_rate;
+    if ((base >= search->fail_rate) ||
+        (0 != __fclk_round_rate_down(&this->target, base + (search->fail_rate - base) / 2, &rate)) ||
+        (rate < search->min_rate) || (rate <= search->pass_rate)) {
+        if ((search->pass_rate != 0) ||
+            (0 != __fclk_round_rate_down(&this->target, search->fail_rate - 1, &rate)) ||
+            (rate < search->min_rate)) {
+            __fclk_search_finish(this, 0);
+            return;
+        }
+    }
+    __fclk_search_apply(this, rate);
+}
+
+/**
+ * __fclk_search_timeout() - no verdict within timeout.
+ *
+ * @work:       work_struct of search timeout_work.
+ *
+ * The search ends with -ETIMEDOUT and the clock is reverted to the highest
+ * passing rate (or the rate before the search).
+ */
+static void __fclk_search_timeout(struct work_struct* work)
+{
+    struct fclk_device_data* this = container_of(to_delayed_work(work), struct fclk_device_data, search.timeout_work);
+
+    mutex_lock(&this->lock);
+    if ((this->search.testing == true) && time_after_eq(jiffies, this->search.deadline)) {
+        dev_warn(this->device, "search: no verdict for %lu within %u ms.\n",
+                 this->search.candidate, this->search.timeout_ms);
+        __fclk_search_finish(this, -ETIMEDOUT);
+    }
+    mutex_unlock(&this->lock);
+}
+
+/**
+ * __fclk_search_start() - start search.
+ *
+ * @this:       Pointer to the fclk device data.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * min_rate, max_rate, step, timeout_ms and margin_ppm of this->search must
+ * be set. A device linked by rate ratios can not be searched (-EBUSY).
+ * Called with this->lock held.
+ */
+static int __fclk_search_start(struct fclk_device_data* this)
+{
+    struct fclk_search* search = &this->search;
+
+    if ((search->active == true) || (this->ratio_linked == true))
+        return -EBUSY;
+    if ((search->max_rate == 0) || (search->min_rate > search->max_rate) || (search->margin_ppm >= 1000000))
+        return -EINVAL;
+    search->active     = true;
+    search->testing    = false;
+    search->orig_rate  = clk_get_rate(this->target.clk);
+    search->candidate  = 0;
+    search->pass_rate  = 0;
+    search->fail_rate  = 0;
+    search->count      = 0;
+    search->final_rate = 0;
+    search->result     = 0;
+    __fclk_search_next(this);
+    return 0;
+}
+
+/**
+ * __fclk_search_verdict() - pass/fail verdict of candidate rate.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @pass:       the candidate rate passed the test.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * Called with this->lock held.
+ */
+static int __fclk_search_verdict(struct fclk_device_data* this, bool pass)
+{
+    struct fclk_search* search = &this->search;
+
+    if (search->testing == false)
+        return -EINVAL;
+    search->testing = false;
+    cancel_delayed_work(&search->timeout_work);
+    if (pass == true)
+        search->pass_rate = search->candidate;
+    else
+        search->fail_rate = search->candidate;
+    __fclk_search_next(this);
+    return 0;
+}
+
+/**
+ * __fclk_search_abort() - abort search and restore rate.
+ *
+ * @this:       Pointer to the fclk device data.
+ *
+ * Called with this->lock held.
+ */
+static void __fclk_search_abort(struct fclk_device_data* this)
+{
+    if (this->search.active == false)
+        return;
+    cancel_delayed_work(&this->search.timeout_work);
+    this->search.pass_rate = 0;
+    __fclk_search_finish(this, -ECANCELED);
+}
+
+/**
+ * __fclk_search_stop() - stop search timeout.
+ *
+ * @this:       Pointer to the fclk device data.
+ *
+ * Must be called without this->lock.
+ */
+static void __fclk_search_stop(struct fclk_device_data* this)
+{
+    cancel_delayed_work_sync(&this->search.timeout_work);
+    this->search.active  = false;
+    this->search.testing = false;
+}
+
+/**
+ * __fclk_cpufreq_band() - select band of cpu frequency.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @khz:        cpu frequency.
+ * Return:      index of band.
+ *
+ * A band is entered as soon as the cpu frequency reaches its cpu_khz, but
+ * left downward only when the cpu frequency falls hysteresis_khz below it.
+ */
+static int __fclk_cpufreq_band(struct fclk_device_data* this, unsigned int khz)
+{
+    struct fclk_cpufreq* cpufreq = &this->cpufreq;
+    int                  band    = 0;
+    int                  i;
+
+    for (i = 1; i < cpufreq->bands_size; i++) {
+        if (khz >= cpufreq->bands[i].cpu_khz)
+            band = i;
+    }
+    if ((cpufreq->band > band) &&
+        ((u64)khz + cpufreq->hysteresis_khz >= cpufreq->bands[cpufreq->band].cpu_khz))
+        band = cpufreq->band;
+    return band;
+}
+
+/**
+ * __fclk_cpufreq_work() - change rate to the band of cpu frequency.
+ *
+ * @work:       work_struct of cpufreq.work.
+ *
+ * Nothing is changed while a search is active or while the device is linked
+ * by rate ratios. A failed change is retried at the next cpu frequency
+ * transition.
+ */
+static void __fclk_cpufreq_work(struct work_struct* work)
+{
+    struct fclk_device_data* this    = container_of(work, struct fclk_device_data, cpufreq.work);
+    struct fclk_cpufreq*     cpufreq = &this->cpufreq;
+    unsigned int             khz     = READ_ONCE(cpufreq->cpu_khz);
+    int                      band;
+
+    mutex_lock(&this->lock);
+    band = __fclk_cpufreq_band(this, khz);
+    if ((cpufreq->active == true) && (this->search.active == false) && (this->ratio_linked == false) &&
+        (band != cpufreq->band)) {
+        struct fclk_state state;
+        int               result;
+
+        fclk_state_clear(&state);
+        state.rate       = cpufreq->bands[band].rate;
+        state.rate_valid = true;
+        result = __fclk_change_state(this, &state);
+        if (result == 0) {
+            cpufreq->band = band;
+            cpufreq->transitions++;
+            DEV_DBG(this->device, "cpufreq %u kHz => band %d rate %lu\n", khz, band, clk_get_rate(this->target.clk));
+        } else {
+            dev_warn(this->device, "cpufreq %u kHz => band %d failed(%d).\n", khz, band, result);
+        }
+    }
+    mutex_unlock(&this->lock);
+}
+
+#if (USE_CPUFREQ == 1)
+/**
+ * __fclk_cpufreq_notify() - cpufreq transition notifier.
+ *
+ * Transitions of other policies are ignored. The rate is changed by
+ * cpufreq.work, not in the notifier.
+ */
+static int __fclk_cpufreq_notify(struct notifier_block* nb, unsigned long action, void* data)
+{
+    struct fclk_device_data* this  = container_of(nb, struct fclk_device_data, cpufreq.notifier);
+    struct cpufreq_freqs*    freqs = data;
+
+    if (action != CPUFREQ_POSTCHANGE)
+        return NOTIFY_OK;
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 2, 0))
+    if (cpumask_test_cpu(this->cpufreq.cpu, freqs->policy->cpus) == false)
+        return NOTIFY_OK;
+#else
+    if (freqs->cpu != this->cpufreq.cpu)
+        return NOTIFY_OK;
+#endif
+    WRITE_ONCE(this->cpufreq.cpu_khz, freqs->new);
+    queue_work(system_wq, &this->cpufreq.work);
+    return NOTIFY_OK;
+}
+
+/**
+ * __fclk_cpufreq_start() - start coupling to cpu frequency.
+ *
+ * @this:       Pointer to the fclk device data.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * cpufreq.bands must be set. The rate of the current cpu frequency is
+ * applied by cpufreq.work.
+ */
+static int __fclk_cpufreq_start(struct fclk_device_data* this)
+{
+    unsigned int khz;
+    int          retval;
+
+    if (this->cpufreq.active == true)
+        return 0;
+    this->cpufreq.notifier.notifier_call = __fclk_cpufreq_notify;
+    retval = cpufreq_register_notifier(&this->cpufreq.notifier, CPUFREQ_TRANSITION_NOTIFIER);
+    if (retval) {
+        dev_err(this->device, "cpufreq_register_notifier failed(%d).\n", retval);
+        return retval;
+    }
+    this->cpufreq.notifier_done = true;
+    this->cpufreq.active        = true;
+    this->cpufreq.band          = -1;
+    khz = cpufreq_quick_get(this->cpufreq.cpu);
+    if (khz != 0) {
+        WRITE_ONCE(this->cpufreq.cpu_khz, khz);
+        queue_work(system_wq, &this->cpufreq.work);
+    }
+    return 0;
+}
+#endif
+
+/**
+ * __fclk_cpufreq_stop() - stop coupling to cpu frequency.
+ *
+ * @this:       Pointer to the fclk device data.
+ *
+ * Must be called without this->lock.
+ */
+static void __fclk_cpufreq_stop(struct fclk_device_data* this)
+{
+    this->cpufreq.active = false;
+    if (this->cpufreq.notifier_done == true) {
+        cpufreq_unregister_notifier(&this->cpufreq.notifier, CPUFREQ_TRANSITION_NOTIFIER);
+        this->cpufreq.notifier_done = false;
+    }
+    cancel_work_sync(&this->cpufreq.work);
+}
+
+/**
+ * DOC: fclk system class device file show/set operations.
+ *
+ * The device file created in system class is as follows.
+ *
+ * * /sys/class/<class-name>/<device-name>/driver_version
+ * * /sys/class/<class-name>/<device-name>/enable
+ * * /sys/class/<class-name>/<device-name>/rate
+ * * /sys/class/<class-name>/<device-name>/round_rate
+ * * /sys/class/<class-name>/<device-name>/resource_clks
+ * * /sys/class/<class-name>/<device-name>/resource
+ * * /sys/class/<class-name>/<device-name>/state
+ * * /sys/class/<class-name>/<device-name>/remove_enable
+ * * /sys/class/<class-name>/<device-name>/remove_rate
+ * * /sys/class/<class-name>/<device-name>/remove_resource
+ * * /sys/class/<class-name>/<device-name>/program_enable
+ * * /sys/class/<class-name>/<device-name>/program_rate
+ * * /sys/class/<class-name>/<device-name>/program_resource
+ * * /sys/class/<class-name>/<device-name>/reset_assert_delay_us
+ * * /sys/class/<class-name>/<device-name>/reset_deassert_delay_us
+ * * /sys/class/<class-name>/<device-name>/enable_settle_us
+ * * /sys/class/<class-name>/<device-name>/resource_settle_us
+ * * /sys/class/<class-name>/<device-name>/rate_settle_us
+ * * /sys/class/<class-name>/<device-name>/settle_stats
+ * * /sys/class/<class-name>/<device-name>/foreign_enable_count
+ * * /sys/class/<class-name>/<device-name>/transition_stats
+ * * /sys/class/<class-name>/<device-name>/schedule
+ * * /sys/class/<class-name>/<device-name>/enforce
+ * * /sys/class/<class-name>/<device-name>/enforce_interval_ms
+ * * /sys/class/<class-name>/<device-name>/enforce_corrections
+ * * /sys/class/<class-name>/<device-name>/rate_tolerance_ppm
+ * * /sys/class/<class-name>/<device-name>/rate_tolerance_hz
+ * * /sys/class/<class-name>/<device-name>/achieved_rate
+ * * /sys/class/<class-name>/<device-name>/error_ppm
+ * * /sys/class/<class-name>/<device-name>/keep_prepared
+ * * /sys/class/<class-name>/<device-name>/staged
+ * * /sys/class/<class-name>/<device-name>/pending
+ * * /sys/class/<class-name>/<device-name>/min_rate
+ * * /sys/class/<class-name>/<device-name>/max_rate
+ * * /sys/class/<class-name>/<device-name>/resource_rate
+ * * /sys/class/<class-name>/<device-name>/rate_ratio
+ * * /sys/class/<class-name>/<device-name>/search
+ * * /sys/class/<class-name>/<device-name>/cpufreq
+ * * /sys/class/<class-name>/<device-name>/power_uw
+ * * /sys/class/<class-name>/<device-name>/energy_uj
+ * * /sys/class/<class-name>/<device-name>/target<N>/enable
+ * * /sys/class/<class-name>/<device-name>/target<N>/rate
+ * * /sys/class/<class-name>/<device-name>/target<N>/resource
+ * * /sys/class/<class-name>/<device-name>/target<N>/foreign_enable_count
+ *
+ * The target<N> directories exist only when the device has group targets.
+ */
+/**
+ * fclk_show_driver_version()
+ */
+static ssize_t fclk_show_driver_version(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    if (!this)
+        return -ENODEV;
+    return sprintf(buf, "%s\n", DRIVER_VERSION);
+}
+
+/**
+ * fclk_show_enable()
+ */
+static ssize_t fclk_show_enable(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    if (!this)
+        return -ENODEV;
+    return sprintf(buf, "%d\n", __clk_is_enabled(this->target.clk));
+}
+
+/**
+ * fclk_set_enable()
+ */
+static ssize_t fclk_set_enable(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+{
+    ssize_t           get_result;
+    int               set_result;
+    unsigned long     enable;
+    struct fclk_state next_state;
+
+    if (!this)
+        return -ENODEV;
+
+    if (0 != (get_result = kstrtoul(buf, 0, &enable)))
+        return get_result;
+
+    fclk_state_clear(&next_state);
+    next_state.enable       = (enable != 0);
+    next_state.enable_valid = true;
+
+    mutex_lock(&this->lock);
+    set_result = __fclk_change_state_staged(this, &next_state);
+    mutex_unlock(&this->lock);
+    if (set_result)
+        return (ssize_t)set_result;
+
+    return size;
+}
+
+/**
+ * fclk_show_rate()
+ */
+static ssize_t fclk_show_rate(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    if (!this)
+        return -ENODEV;
+    return sprintf(buf, "%lu\n", clk_get_rate(this->target.clk));
+}
+
+static int  fclkcfg_ratio_set_rate(struct fclk_device_data* this, unsigned long rate);
+static void fclkcfg_ratio_update(void);
+
+/**
+ * fclk_set_rate()
+ *
+ * If the device is linked by rate ratios, the rate is solved jointly with
+ * the linked devices, see fclkcfg_ratio_set_rate().
+ */
+static ssize_t fclk_set_rate(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+{
+    ssize_t           get_result;
+    int               set_result;
+    struct fclk_state next_state;
+
+    if (!this)
+        return -ENODEV;
+
+    fclk_state_clear(&next_state);
+
+    if (sysfs_streq(buf, "max")) {
+        next_state.rate_max = true;
+    } else {
+        if (0 != (get_result = kstrtoul(buf, 0, &next_state.rate)))
+            return get_result;
+        next_state.rate_valid   = true;
+        set_result = fclkcfg_ratio_set_rate(this, next_state.rate);
+        if (set_result != -ENOENT)
+            return (set_result) ? (ssize_t)set_result : size;
+    }
+
+    mutex_lock(&this->lock);
+    set_result = __fclk_change_state_staged(this, &next_state);
+    mutex_unlock(&this->lock);
+    if (set_result)
+        return (ssize_t)set_result;
+
+    return size;
+}
+
+/**
+ * fclk_show_round_rate()
+ */
+static ssize_t fclk_show_round_rate(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    if (!this)
+        return -ENODEV;
+
+    return sprintf(buf, "%lu => %lu\n",
+                   this->round_rate,
+                   clk_round_rate(this->target.clk, this->round_rate)
+    );
+}
+
+/**
+ * fclk_set_round_rate()
+ */
+static ssize_t fclk_set_round_rate(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+{
+    ssize_t       get_result;
+    unsigned long round_rate;
+
+    if (!this)
+        return -ENODEV;
+
+    if (0 != (get_result = kstrtoul(buf, 0, &round_rate)))
+        return get_result;
+
+    this->round_rate = round_rate;
+    return size;
+}
+
+/**
+ * fclk_set_resource()
+ */
+static ssize_t fclk_set_resource(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+{
+    ssize_t           get_result;
+    int               set_result;
+    unsigned long     resclk;
+    struct fclk_state next_state;
+
+    if (!this)
+        return -ENODEV;
+
+    if (this->resource_clks == NULL)
+        return size;
+
+    if (0 != (get_result = kstrtoul(buf, 0, &resclk)))
+        return get_result;
+    
+    if (resclk >= this->resource_clks_size)
+        return -EINVAL;
+
+    fclk_state_clear(&next_state);
+    next_state.resclk       = resclk;
+    next_state.resclk_valid = true;
+
+    mutex_lock(&this->lock);
+    set_result = __fclk_change_state_staged(this, &next_state);
+    mutex_unlock(&this->lock);
+    if (set_result)
+        return (ssize_t)set_result;
+
+    return size;
+}
+
+/**
+ * fclk_show_resource()
+ */
+static ssize_t fclk_show_resource(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    if (!this)
+        return -ENODEV;
+
+    return sprintf(buf, "%d\n", this->target.resource_clk_id);
+}
+
+/**
+ * fclk_show_state()
+ *
+ * The number of targets is not limited, so the output is bounded by
+ * PAGE_SIZE and the last segments are cut off if it does not fit.
+ */
+static ssize_t fclk_show_state(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    ssize_t len = 0;
+    int     i;
+
+    if (!this)
+        return -ENODEV;
+
+    for (i = 0; i < __fclk_targets_size(this); i++) {
+        struct fclk_target* target = __fclk_get_target(this, i);
+        len += scnprintf(buf+len, PAGE_SIZE-len, "%srate=%lu enable=%d resource=%d",
+                         (i > 0) ? "; " : "",
+                         clk_get_rate(target->clk),
+                         __clk_is_enabled(target->clk),
+                         target->resource_clk_id
+        );
+    }
+    len += scnprintf(buf+len, PAGE_SIZE-len, "\n");
+    return len;
+}
+
+/**
+ * fclk_check_state() - check resource clock index of state.
+ */
+static int fclk_check_state(struct fclk_device_data* this, struct fclk_state* state)
+{
+    if (state->resclk_valid == true) {
+        if (this->resource_clks == NULL)
+            state->resclk_valid = false;
+        else if (state->resclk >= this->resource_clks_size)
+            return -EINVAL;
+    }
+    return 0;
+}
+
+/**
+ * fclk_set_state()
+ *
+ * When the device has group targets and @buf is separated by ';', each
+ * segment is the state of target0, target1, ... in order and is applied at
+ * once, bypassing staged mode. Otherwise @buf is the state of the device,
+ * see __fclk_change_state_staged(). A state with only a rate is solved like
+ * a write to the rate file if the device is linked by rate ratios.
+ */
+static ssize_t fclk_set_state(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+{
+    ssize_t           get_result;
+    int               set_result;
+    struct fclk_state next_state;
+
+    if (!this)
+        return -ENODEV;
+
+    if ((this->group_targets_size > 0) && (strchr(buf, ';') != NULL)) {
+        int                targets_size = __fclk_targets_size(this);
+        int                index        = 0;
+        char*              line;
+        char*              curr;
+        char*              segment;
+        struct fclk_state* next_list;
+
+        next_list = kcalloc(targets_size, sizeof(*next_list), GFP_KERNEL);
+        if (next_list == NULL)
+            return -ENOMEM;
+        line = kstrdup(buf, GFP_KERNEL);
+        if (line == NULL) {
+            kfree(next_list);
+            return -ENOMEM;
+        }
+        for (index = 0; index < targets_size; index++)
+            fclk_state_clear(&next_list[index]);
+        curr  = line;
+        index = 0;
+        set_result = 0;
+        while ((segment = strsep(&curr, ";")) != NULL) {
+            if (index >= targets_size) {
+                set_result = -EINVAL;
+                break;
+            }
+            if (0 != (set_result = parse_fclk_state(segment, &next_list[index])))
+                break;
+            if (0 != (set_result = fclk_check_state(this, &next_list[index])))
+                break;
+            index++;
+        }
+        if (set_result == 0) {
+            mutex_lock(&this->lock);
+            set_result = __fclk_change_group_state(this, next_list);
+            mutex_unlock(&this->lock);
+        }
+        kfree(line);
+        kfree(next_list);
+        return (set_result) ? (ssize_t)set_result : size;
+    }
+
+    if (0 != (get_result = parse_fclk_state(buf, &next_state)))
+        return get_result;
+
+    if (0 != (get_result = fclk_check_state(this, &next_state)))
+        return get_result;
+
+    if ((next_state.rate_valid   == true ) && (next_state.rate_max     == false) &&
+        (next_state.enable_valid == false) && (next_state.resclk_valid == false)) {
+        set_result = fclkcfg_ratio_set_rate(this, next_state.rate);
+        if (set_result != -ENOENT)
+            return (set_result) ? (ssize_t)set_result : size;
+    }
+
+    mutex_lock(&this->lock);
+    set_result = __fclk_change_state_staged(this, &next_state);
+    mutex_unlock(&this->lock);
+    if (set_result)
+        return (ssize_t)set_result;
+
+    return size;
+}
+
+/**
+ * fclk_show_target_enable()
+ */
+static ssize_t fclk_show_target_enable(struct fclk_device_data* this, int index, char *buf)
+{
+    return sprintf(buf, "%d\n", __clk_is_enabled(__fclk_get_target(this, index)->clk));
+}
+
+/**
+ * fclk_set_target_enable()
+ */
+static ssize_t fclk_set_target_enable(struct fclk_device_data* this, int index, const char *buf, size_t size)
+{
+    ssize_t           get_result;
+    int               set_result;
+    int               value;
+    struct fclk_state next_state;
+
+    if (0 != (get_result = kstrtoint(buf, 0, &value)))
+        return get_result;
+
+    fclk_state_clear(&next_state);
+    next_state.enable       = (value != 0);
+    next_state.enable_valid = true;
+    mutex_lock(&this->lock);
+    set_result = __fclk_change_target_state(this, index, &next_state);
+    mutex_unlock(&this->lock);
+    if (set_result)
+        return (ssize_t)set_result;
+
+    return size;
+}
+
+/**
+ * fclk_show_target_rate()
+ */
+static ssize_t fclk_show_target_rate(struct fclk_device_data* this, int index, char *buf)
+{
+    return sprintf(buf, "%lu\n", clk_get_rate(__fclk_get_target(this, index)->clk));
+}
+
+/**
+ * fclk_set_target_rate()
+ */
+static ssize_t fclk_set_target_rate(struct fclk_device_data* this, int index, const char *buf, size_t size)
+{
+    ssize_t           get_result;
+    int               set_result;
+    unsigned long     value;
+    struct fclk_state next_state;
+
+    if (0 != (get_result = kstrtoul(buf, 0, &value)))
+        return get_result;
+
+    fclk_state_clear(&next_state);
+    next_state.rate       = value;
+    next_state.rate_valid = true;
+    mutex_lock(&this->lock);
+    set_result = __fclk_change_target_state(this, index, &next_state);
+    mutex_unlock(&this->lock);
+    if (set_result)
+        return (ssize_t)set_result;
+
+    return size;
+}
+
+/**
+ * fclk_show_target_resource()
+ */
+static ssize_t fclk_show_target_resource(struct fclk_device_data* this, int index, char *buf)
+{
+    return sprintf(buf, "%d\n", __fclk_get_target(this, index)->resource_clk_id);
+}
+
+/**
+ * fclk_show_target_foreign_enable_count()
+ */
+static ssize_t fclk_show_target_foreign_enable_count(struct fclk_device_data* this, int index, char *buf)
+{
+    return sprintf(buf, "%u\n", __fclk_foreign_enable_count(__fclk_get_target(this, index)));
+}
+
+/**
+ * fclk_set_target_resource()
+ */
+static ssize_t fclk_set_target_resource(struct fclk_device_data* this, int index, const char *buf, size_t size)
+{
+    ssize_t           get_result;
+    int               set_result;
+    int               value;
+    struct fclk_state next_state;
+
+    if (0 != (get_result = kstrtoint(buf, 0, &value)))
+        return get_result;
+
+    if ((this->resource_clks == NULL) || (value < 0) || (value >= this->resource_clks_size))
+        return -EINVAL;
+
+    fclk_state_clear(&next_state);
+    next_state.resclk       = value;
+    next_state.resclk_valid = true;
+    mutex_lock(&this->lock);
+    set_result = __fclk_change_target_state(this, index, &next_state);
+    mutex_unlock(&this->lock);
+    if (set_result)
+        return (ssize_t)set_result;
+
+    return size;
+}
+
+/**
+ * fclk_show_resource_clks()
+ */
+static ssize_t fclk_show_resource_clks(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    size_t size = 0;
+
+    if (!this)
+        return -ENODEV;
+
+    if ((this->resource_clks != NULL) && (this->resource_clks_size > 0)) {
+        int    i;
+        char*  ptr  = buf;
+        for (i = 0; i < this->resource_clks_size; i++) {
+            struct clk* resource_clk = this->resource_clks[i];
+            size_t      len;
+            if (i == this->resource_clks_size-1)
+                len  = sprintf(ptr, "%s\n", __clk_get_name(resource_clk));
+            else
+                len  = sprintf(ptr, "%s, ", __clk_get_name(resource_clk));
+            ptr  += len;
+            size += len;
+        }
+    }
+    return size;
+}
+
+/**
+ * DEF_FCLK_STATE_SHOW_ENABLE() - generate fclk_show_ ## state ## _enable() macro
+ */
+#define DEF_FCLK_STATE_SHOW_ENABLE(state)       \
+static ssize_t fclk_show_ ## state ## _enable(  \
+    struct fclk_device_data* this,              \
+    struct device_attribute* attr,              \
+    char*                    buf)               \
+{                                               \
+    if (!this) return -ENODEV;                  \
+    if (this->state.enable_valid == false) {return sprintf(buf, "%d\n", -1);} \
+    if (this->state.enable       == true ) {return sprintf(buf, "%d\n",  1);} \
+    else                                   {return sprintf(buf, "%d\n",  0);} \
+}
+
+/**
+ * DEF_FCLK_STATE_SET_ENABLE()  - generate fclk_set_ ## state ## _enable() macro
+ */
+#define DEF_FCLK_STATE_SET_ENABLE(state)        \
+static ssize_t fclk_set_ ## state ## _enable(   \
+    struct fclk_device_data* this,              \
+    struct device_attribute* attr,              \
+    const char*              buf,               \
+    size_t                   size)              \
+{                                               \
+    ssize_t                  get_result;        \
+    long                     enable;            \
+    if (!this) return -ENODEV;                  \
+    if (0 != (get_result = kstrtol(buf, 0, &enable))) \
+        return get_result; \
+    if      (enable  > 0) {this->state.enable_valid = true ;this->state.enable = true ;} \
+    else if (enable == 0) {this->state.enable_valid = true ;this->state.enable = false;} \
+    else                  {this->state.enable_valid = false;} \
+    return size; \
+}
+
+/**
+ * DEF_FCLK_STATE_SHOW_RATE()   - generate fclk_show_ ## state ## _rate() macro
+ */
+#define DEF_FCLK_STATE_SHOW_RATE(state)         \
+static ssize_t fclk_show_ ## state ## _rate(    \
+    struct fclk_device_data* this,              \
+    struct device_attribute* attr,              \
+    char*                    buf)               \
+{                                               \
+    if (!this) return -ENODEV;                  \
+    if (this->state.rate_valid == false) {return sprintf(buf, "%d\n" , -1);} \
+    else                                 {return sprintf(buf, "%lu\n", this->state.rate);} \
+}
+
+/**
+ * DEF_FCLK_STATE_SET_RATE()    - generate fclk_set_## state ## _rate() macro
+ */
+#define DEF_FCLK_STATE_SET_RATE(state)          \
+static ssize_t fclk_set_ ## state ## _rate(     \
+    struct fclk_device_data* this,              \
+    struct device_attribute* attr,              \
+    const char*              buf,               \
+    size_t                   size)              \
+{                                               \
+    ssize_t                  get_result;        \
+    long                     rate;              \
+    if (!this) return -ENODEV;                  \
+    if (0 != (get_result = kstrtol(buf, 0, &rate))) \
+        return get_result; \
+    if   (rate >= 0) {this->state.rate_valid = true ;this->state.rate = (unsigned long)rate;} \
+    else             {this->state.rate_valid = false;} \
+    return size; \
+}
+
+/**
+ * DEF_FCLK_STATE_SHOW_RESOURCE() - generate fclk_show_ ## state ## _resource() macro
+ */
+#define DEF_FCLK_STATE_SHOW_RESOURCE(state)      \
+static ssize_t fclk_show_ ## state ## _resource( \
+    struct fclk_device_data* this,               \
+    struct device_attribute* attr,               \
+    char*                    buf)                \
+{                                                \
+    if (!this) return -ENODEV;                   \
+    if (this->state.resclk_valid == false) {return sprintf(buf, "%d\n" , -1);} \
+    else                                   {return sprintf(buf, "%lu\n", this->state.resclk);} \
+}
+
+/**
+ * DEF_FCLK_STATE_SET_RESOURCE() - generate fclk_set_ ## state ## _resource() macro
+ */
+#define DEF_FCLK_STATE_SET_RESOURCE(state)       \
+static ssize_t fclk_set_ ## state ## _resource(  \
+    struct fclk_device_data* this,               \
+    struct device_attribute* attr,               \
+    const char*              buf,                \
+    size_t                   size)               \
+{                                                \
+    ssize_t                  get_result;         \
+    long                     resource;           \
+    if (!this) return -ENODEV;                   \
+    if ((this->resource_clks != NULL) && (this->resource_clks_size > 0)) { \
+        if (0 != (get_result = kstrtol(buf, 0, &resource))) \
+            return get_result; \
+        if ((resource >= 0) && (resource < this->resource_clks_size)) { \
+            this->state.resclk_valid = true; \
+            this->state.resclk       = (unsigned long)resource; \
+            return size; \
+        } \
+        if (resource < 0) { \
+            this->state.resclk_valid = false; \
+            return size; \
+        } \
+        return -EINVAL; \
+    } \
+    return size;\
+}
+
+/**
+ * fclk_show_remove_enable()
+ * fclk_show_remove_rate()
+ * fclk_show_remove_resource()
+ * fclk_set_remove_enable()
+ * fclk_set_remove_rate()
+ * fclk_set_remove_resource()
+ */
+DEF_FCLK_STATE_SHOW_ENABLE  (remove);
+DEF_FCLK_STATE_SHOW_RATE    (remove);
+DEF_FCLK_STATE_SHOW_RESOURCE(remove);
+DEF_FCLK_STATE_SET_ENABLE   (remove);
+DEF_FCLK_STATE_SET_RATE     (remove);
+DEF_FCLK_STATE_SET_RESOURCE (remove);
+
+/**
+ * fclk_show_program_enable()
+ * fclk_show_program_rate()
+ * fclk_show_program_resource()
+ * fclk_set_program_enable()
+ * fclk_set_program_rate()
+ * fclk_set_program_resource()
+ */
+DEF_FCLK_STATE_SHOW_ENABLE  (program);
+DEF_FCLK_STATE_SHOW_RATE    (program);
+DEF_FCLK_STATE_SHOW_RESOURCE(program);
+DEF_FCLK_STATE_SET_ENABLE   (program);
+DEF_FCLK_STATE_SET_RATE     (program);
+DEF_FCLK_STATE_SET_RESOURCE (program);
+
+/**
+ * DEF_FCLK_SHOW_PARAM()  - generate fclk_show_ ## param() macro
+ */
+#define DEF_FCLK_SHOW_PARAM(param)               \
+static ssize_t fclk_show_ ## param(              \
+    struct fclk_device_data* this,               \
+    struct device_attribute* attr,               \
+    char*                    buf)                \
+{                                                \
+    if (!this) return -ENODEV;                   \
+    return sprintf(buf, "%u\n", this->param);    \
+}
+
+/**
+ * DEF_FCLK_SET_PARAM()   - generate fclk_set_ ## param() macro
+ */
+#define DEF_FCLK_SET_PARAM(param)                \
+static ssize_t fclk_set_ ## param(               \
+    struct fclk_device_data* this,               \
+    struct device_attribute* attr,               \
+    const char*              buf,                \
+    size_t                   size)               \
+{                                                \
+    ssize_t                  get_result;         \
+    unsigned int             value;              \
+    if (!this) return -ENODEV;                   \
+    if (0 != (get_result = kstrtouint(buf, 0, &value))) \
+        return get_result; \
+    this->param = value; \
+    return size; \
+}
+
+/**
+ * fclk_show_reset_assert_delay_us()
+ * fclk_show_reset_deassert_delay_us()
+ * fclk_set_reset_assert_delay_us()
+ * fclk_set_reset_deassert_delay_us()
+ */
+DEF_FCLK_SHOW_PARAM(reset_assert_delay_us);
+DEF_FCLK_SHOW_PARAM(reset_deassert_delay_us);
+DEF_FCLK_SET_PARAM (reset_assert_delay_us);
+DEF_FCLK_SET_PARAM (reset_deassert_delay_us);
+
+/**
+ * fclk_show_enable_settle_us()
+ * fclk_show_resource_settle_us()
+ * fclk_show_rate_settle_us()
+ * fclk_set_enable_settle_us()
+ * fclk_set_resource_settle_us()
+ * fclk_set_rate_settle_us()
+ */
+DEF_FCLK_SHOW_PARAM(enable_settle_us);
+DEF_FCLK_SHOW_PARAM(resource_settle_us);
+DEF_FCLK_SHOW_PARAM(rate_settle_us);
+DEF_FCLK_SET_PARAM (enable_settle_us);
+DEF_FCLK_SET_PARAM (resource_settle_us);
+DEF_FCLK_SET_PARAM (rate_settle_us);
+
+/**
+ * fclk_show_settle_stats()
+ */
+static ssize_t fclk_show_settle_stats(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    size_t size = 0;
+
+    if (!this)
+        return -ENODEV;
+
+#define SETTLE_STAT_SHOW(tag, stat)                                         \
+    size += sprintf(buf + size, tag " count=%lu last_us=%lld max_us=%lld\n", \
+                    (stat).count,                                           \
+                    (long long)div_s64((stat).last_ns, NSEC_PER_USEC),      \
+                    (long long)div_s64((stat).max_ns , NSEC_PER_USEC));
+
+    SETTLE_STAT_SHOW("enable  ", this->enable_settle);
+    SETTLE_STAT_SHOW("resource", this->resource_settle);
+    SETTLE_STAT_SHOW("rate    ", this->rate_settle);
+    return size;
+}
+
+/**
+ * fclk_set_settle_stats()
+ */
+static ssize_t fclk_set_settle_stats(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+{
+    if (!this)
+        return -ENODEV;
+
+    memset(&this->enable_settle  , 0, sizeof(this->enable_settle  ));
+    memset(&this->resource_settle, 0, sizeof(this->resource_settle));
+    memset(&this->rate_settle    , 0, sizeof(this->rate_settle    ));
+    return size;
+}
+
+/**
+ * fclk_show_foreign_enable_count()
+ */
+static ssize_t fclk_show_foreign_enable_count(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    if (!this)
+        return -ENODEV;
+    return sprintf(buf, "%u\n", __fclk_foreign_enable_count(&this->target));
+}
+
+/**
+ * fclk_show_keep_prepared()
+ */
+static ssize_t fclk_show_keep_prepared(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    if (!this)
+        return -ENODEV;
+    return sprintf(buf, "%d\n", this->keep_prepared);
+}
+
+/**
+ * fclk_set_keep_prepared()
+ */
+static ssize_t fclk_set_keep_prepared(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+{
+    ssize_t get_result;
+    int     value;
+    int     retval;
+
+    if (!this)
+        return -ENODEV;
+    if (0 != (get_result = kstrtoint(buf, 0, &value)))
+        return get_result;
+    mutex_lock(&this->lock);
+    retval = __fclk_set_keep_prepared(this, (value != 0));
+    mutex_unlock(&this->lock);
+    if (retval)
+        return retval;
+    return size;
+}
+
+/**
+ * fclk_show_staged()
+ */
+static ssize_t fclk_show_staged(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    if (!this)
+        return -ENODEV;
+    return sprintf(buf, "%d\n", this->staged);
+}
+
+/**
+ * fclk_set_staged()
+ *
+ * Leaving staged mode applies the pending state at once.
+ */
+static ssize_t fclk_set_staged(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+{
+    ssize_t get_result;
+    int     value;
+    int     retval;
+
+    if (!this)
+        return -ENODEV;
+    if (0 != (get_result = kstrtoint(buf, 0, &value)))
+        return get_result;
+    mutex_lock(&this->lock);
+    if ((value == 0) && (this->staged == true) &&
+        ((this->pending.rate_valid == true) || (this->pending.rate_max == true) || (this->pending.resclk_valid == true))) {
+        if (0 != (retval = __fclk_change_state(this, &this->pending))) {
+            mutex_unlock(&this->lock);
+            return retval;
+        }
+        fclk_state_clear(&this->pending);
+    }
+    this->staged = (value != 0);
+    mutex_unlock(&this->lock);
+    return size;
+}
+
+/**
+ * fclk_show_pending()
+ */
+static ssize_t fclk_show_pending(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    ssize_t len = 0;
+
+    if (!this)
+        return -ENODEV;
+    if (this->pending.rate_valid == true)
+        len += sprintf(buf+len, "rate=%lu ", this->pending.rate);
+    if (this->pending.rate_max   == true)
+        len += sprintf(buf+len, "rate=max ");
+    if (this->pending.resclk_valid == true)
+        len += sprintf(buf+len, "resource=%lu ", this->pending.resclk);
+    if (len == 0)
+        return sprintf(buf, "none\n");
+    buf[len-1] = '\n';
+    return len;
+}
+
+/**
+ * fclk_set_pending()
+ *
+ * Writing any value discards the pending state.
+ */
+static ssize_t fclk_set_pending(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+{
+    if (!this)
+        return -ENODEV;
+    mutex_lock(&this->lock);
+    fclk_state_clear(&this->pending);
+    mutex_unlock(&this->lock);
+    return size;
+}
+
+/**
+ * fclk_show_transition_stats()
+ */
+static ssize_t fclk_show_transition_stats(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    struct fclk_transition_stat* stat;
+    size_t                       size = 0;
+
+    if (!this)
+        return -ENODEV;
+
+    stat  = &this->transition_stat;
+    size += sprintf(buf + size, "count=%lu failures=%lu rollbacks=%lu\n",
+                    stat->count, stat->failures, stat->rollbacks);
+    size += sprintf(buf + size, "time   last_us=%lld min_us=%lld max_us=%lld avg_us=%lld\n",
+                    (long long)div_s64(stat->last_ns, NSEC_PER_USEC),
+                    (long long)div_s64(stat->min_ns , NSEC_PER_USEC),
+                    (long long)div_s64(stat->max_ns , NSEC_PER_USEC),
+                    (long long)((stat->count) ? div_s64(div_s64(stat->total_ns, stat->count), NSEC_PER_USEC) : 0));
+    size += sprintf(buf + size, "gated  count=%lu last_us=%lld max_us=%lld\n",
+                    stat->gated_count,
+                    (long long)div_s64(stat->gated_last_ns, NSEC_PER_USEC),
+                    (long long)div_s64(stat->gated_max_ns , NSEC_PER_USEC));
+    return size;
+}
+
+/**
+ * fclk_set_transition_stats()
+ */
+static ssize_t fclk_set_transition_stats(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+{
+    if (!this)
+        return -ENODEV;
+
+    memset(&this->transition_stat, 0, sizeof(this->transition_stat));
+    return size;
+}
+
+/**
+ * fclk_show_schedule()
+ */
+static ssize_t fclk_show_schedule(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    size_t size = 0;
+
+    if (!this)
+        return -ENODEV;
+
+    mutex_lock(&this->lock);
+    if (this->schedule.armed == true)
+        size += sprintf(buf + size, "armed clock=%s time_ns=%lld rate=%lu enable=%d resource=%lu\n",
+                        (this->schedule.clock == CLOCK_REALTIME) ? "realtime" : "monotonic",
+                        (long long)ktime_to_ns(this->schedule.time),
+                        this->schedule.state.rate,
+                        this->schedule.state.enable,
+                        this->schedule.state.resclk);
+    else
+        size += sprintf(buf + size, "idle\n");
+    if (this->schedule.count > 0)
+        size += sprintf(buf + size, "last count=%lu time_ns=%lld applied_ns=%lld lateness_ns=%lld result=%d\n",
+                        this->schedule.count,
+                        (long long)ktime_to_ns(this->schedule.last_time),
+                        (long long)ktime_to_ns(this->schedule.last_applied),
+                        (long long)ktime_to_ns(ktime_sub(this->schedule.last_applied, this->schedule.last_time)),
+                        this->schedule.last_result);
+    mutex_unlock(&this->lock);
+    return size;
+}
+
+/**
+ * fclk_set_schedule()
+ *
+ * "<monotonic|realtime> <time_ns> rate=... enable=... resource=..." arms a
+ * transition at the absolute time, or at the time relative to now when
+ * <time_ns> starts with '+'. "cancel" cancels the armed transition.
+ * A rate or resource clock change of a device linked by rate ratios is
+ * refused (-EBUSY).
+ */
+static ssize_t fclk_set_schedule(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+{
+    ssize_t           retval = 0;
+    char*             str;
+    char*             ptr;
+    char*             clock_name;
+    char*             time_str;
+    clockid_t         clock;
+    bool              relative;
+    s64               time_ns;
+    struct fclk_state next_state;
+
+    if (!this)
+        return -ENODEV;
+
+    str = kstrdup(buf, GFP_KERNEL);
+    if (str == NULL)
+        return -ENOMEM;
+    ptr        = skip_spaces(str);
+    clock_name = strsep(&ptr, " \t\n");
+
+    if        (strcmp(clock_name, "cancel"   ) == 0) {
+        mutex_lock(&this->lock);
+        __fclk_schedule_disarm(this);
+        mutex_unlock(&this->lock);
+        goto done;
+    } else if (strcmp(clock_name, "monotonic") == 0) {
+        clock = CLOCK_MONOTONIC;
+    } else if (strcmp(clock_name, "realtime" ) == 0) {
+        clock = CLOCK_REALTIME;
+    } else {
+        retval = -EINVAL;
+        goto done;
+    }
+    ptr      = (ptr != NULL) ? skip_spaces(ptr) : NULL;
+    time_str = (ptr != NULL) ? strsep(&ptr, " \t\n") : NULL;
+    if ((time_str == NULL) || (*time_str == '\0')) {
+        retval = -EINVAL;
+        goto done;
+    }
+    relative = (*time_str == '+');
+    if (0 != (retval = kstrtos64(time_str + ((relative) ? 1 : 0), 0, &time_ns)))
+        goto done;
+    if (0 != (retval = parse_fclk_state((ptr != NULL) ? ptr : "", &next_state)))
+        goto done;
+    if (0 != (retval = fclk_check_state(this, &next_state)))
+        goto done;
+
+    if (relative == true)
+        time_ns += ktime_to_ns(__fclk_schedule_now(clock));
+    mutex_lock(&this->lock);
+    if (__fclk_ratio_refused(this, &next_state) == true)
+        retval = -EBUSY;
+    else
+        __fclk_schedule_arm(this, clock, ns_to_ktime(time_ns), &next_state);
+    mutex_unlock(&this->lock);
+
+ done:
+    kfree(str);
+    return (retval) ? retval : size;
+}
+
+/**
+ * fclk_show_enforce()
+ */
+static ssize_t fclk_show_enforce(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    if (!this)
+        return -ENODEV;
+    return sprintf(buf, "%d\n", this->enforce);
+}
+
+/**
+ * fclk_set_enforce()
+ */
+static ssize_t fclk_set_enforce(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+{
+    ssize_t get_result;
+    int     value;
+
+    if (!this)
+        return -ENODEV;
+    if (0 != (get_result = kstrtoint(buf, 0, &value)))
+        return get_result;
+    if (value != 0) {
+        int retval;
+        mutex_lock(&this->lock);
+        retval = __fclk_enforce_start(this);
+        mutex_unlock(&this->lock);
+        if (retval)
+            return retval;
+    } else {
+        __fclk_enforce_stop(this);
+    }
+    return size;
+}
+
+/**
+ * fclk_show_enforce_interval_ms()
+ */
+DEF_FCLK_SHOW_PARAM(enforce_interval_ms);
+
+/**
+ * fclk_set_enforce_interval_ms()
+ */
+static ssize_t fclk_set_enforce_interval_ms(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+{
+    ssize_t      get_result;
+    unsigned int value;
+
+    if (!this)
+        return -ENODEV;
+    if (0 != (get_result = kstrtouint(buf, 0, &value)))
+        return get_result;
+    mutex_lock(&this->lock);
+    this->enforce_interval_ms = value;
+    if ((this->enforce == true) && (value > 0))
+        mod_delayed_work(system_wq, &this->enforce_work, msecs_to_jiffies(value));
+    mutex_unlock(&this->lock);
+    return size;
+}
+
+/**
+ * fclk_show_enforce_corrections()
+ */
+static ssize_t fclk_show_enforce_corrections(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    if (!this)
+        return -ENODEV;
+    return sprintf(buf, "%lu\n", this->enforce_corrections);
+}
+
+/**
+ * fclk_show_rate_tolerance_ppm()
+ * fclk_show_rate_tolerance_hz()
+ * fclk_set_rate_tolerance_ppm()
+ * fclk_set_rate_tolerance_hz()
+ */
+DEF_FCLK_SHOW_PARAM(rate_tolerance_ppm);
+DEF_FCLK_SHOW_PARAM(rate_tolerance_hz);
+DEF_FCLK_SET_PARAM (rate_tolerance_ppm);
+DEF_FCLK_SET_PARAM (rate_tolerance_hz);
+
+/**
+ * fclk_show_achieved_rate()
+ */
+static ssize_t fclk_show_achieved_rate(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    if (!this)
+        return -ENODEV;
+    return sprintf(buf, "%lu\n", clk_get_rate(this->target.clk));
+}
+
+/**
+ * fclk_show_error_ppm()
+ */
+static ssize_t fclk_show_error_ppm(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    if (!this)
+        return -ENODEV;
+    return sprintf(buf, "%lld\n",
+                   (long long)__fclk_rate_error_ppm(this->target.requested_rate, clk_get_rate(this->target.clk)));
+}
+
+/**
+ * fclk_show_min_rate()
+ */
+static ssize_t fclk_show_min_rate(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    if (!this)
+        return -ENODEV;
+    return sprintf(buf, "%lu\n", this->min_rate);
+}
+
+/**
+ * fclk_set_min_rate()
+ */
+static ssize_t fclk_set_min_rate(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+{
+    ssize_t       get_result;
+    int           set_result;
+    unsigned long rate;
+
+    if (!this)
+        return -ENODEV;
+    if (0 != (get_result = kstrtoul(buf, 0, &rate)))
+        return get_result;
+    mutex_lock(&this->lock);
+    set_result = __fclk_change_rate_range(this, rate, this->max_rate);
+    mutex_unlock(&this->lock);
+    if (set_result)
+        return (ssize_t)set_result;
+    return size;
+}
+
+/**
+ * fclk_show_max_rate()
+ */
+static ssize_t fclk_show_max_rate(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    if (!this)
+        return -ENODEV;
+    return sprintf(buf, "%lu\n", this->max_rate);
+}
+
+/**
+ * fclk_set_max_rate()
+ */
+static ssize_t fclk_set_max_rate(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+{
+    ssize_t       get_result;
+    int           set_result;
+    unsigned long rate;
+
+    if (!this)
+        return -ENODEV;
+    if (0 != (get_result = kstrtoul(buf, 0, &rate)))
+        return get_result;
+    mutex_lock(&this->lock);
+    set_result = __fclk_change_rate_range(this, this->min_rate, rate);
+    mutex_unlock(&this->lock);
+    if (set_result)
+        return (ssize_t)set_result;
+    return size;
+}
+
+/**
+ * fclk_show_rate_ratio()
+ */
+static ssize_t fclk_show_rate_ratio(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    if (!this)
+        return -ENODEV;
+    if (this->ratio_device == NULL)
+        return sprintf(buf, "none\n");
+    return sprintf(buf, "%s %u/%u\n", this->ratio_device, this->ratio_num, this->ratio_den);
+}
+
+/**
+ * fclk_set_rate_ratio()
+ *
+ * "<device-name> <num>[/<den>]" sets the ratio, "none" clears it.
+ */
+static ssize_t fclk_set_rate_ratio(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+{
+    char*        str;
+    char*        ptr;
+    char*        name;
+    char*        ratio;
+    char*        den_str;
+    unsigned int num;
+    unsigned int den    = 1;
+    int          retval = 0;
+
+    if (!this)
+        return -ENODEV;
+    if (sysfs_streq(buf, "none")) {
+        mutex_lock(&this->lock);
+        kfree(this->ratio_device);
+        this->ratio_device = NULL;
+        mutex_unlock(&this->lock);
+        fclkcfg_ratio_update();
+        return size;
+    }
+    str = kstrdup(buf, GFP_KERNEL);
+    if (str == NULL)
+        return -ENOMEM;
+    ptr   = strim(str);
+    name  = strsep(&ptr, " \t");
+    ratio = (ptr != NULL) ? strim(ptr) : NULL;
+    if ((ratio == NULL) || (*name == '\0') || (strcmp(name, dev_name(this->device)) == 0)) {
+        retval = -EINVAL;
+        goto done;
+    }
+    den_str = strchr(ratio, '/');
+    if (den_str != NULL)
+        *den_str++ = '\0';
+    if ((0 != (retval = kstrtouint(ratio, 0, &num))) ||
+        ((den_str != NULL) && (0 != (retval = kstrtouint(den_str, 0, &den)))))
+        goto done;
+    if ((num == 0) || (den == 0)) {
+        retval = -EINVAL;
+        goto done;
+    }
+    name = kstrdup(name, GFP_KERNEL);
+    if (name == NULL) {
+        retval = -ENOMEM;
+        goto done;
+    }
+    mutex_lock(&this->lock);
+    kfree(this->ratio_device);
+    this->ratio_device = name;
+    this->ratio_num    = num;
+    this->ratio_den    = den;
+    mutex_unlock(&this->lock);
+    fclkcfg_ratio_update();
+ done:
+    kfree(str);
+    return (retval) ? retval : size;
+}
+
+/**
+ * fclk_show_search()
+ */
+static ssize_t fclk_show_search(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    struct fclk_search* search;
+    ssize_t             len;
+
+    if (!this)
+        return -ENODEV;
+    search = &this->search;
+    mutex_lock(&this->lock);
+    if (search->testing == true)
+        len = sprintf(buf, "testing rate=%lu pass=%lu fail=%lu count=%lu\n",
+                      search->candidate, search->pass_rate, search->fail_rate, search->count);
+    else if ((search->active == false) && (search->count > 0))
+        len = sprintf(buf, "done rate=%lu pass=%lu result=%d\n",
+                      search->final_rate, search->pass_rate, search->result);
+    else
+        len = sprintf(buf, "idle\n");
+    mutex_unlock(&this->lock);
+    return len;
+}
+
+/**
+ * fclk_set_search()
+ *
+ * "start min=<rate> max=<rate> [step=<rate>] [timeout_ms=<ms>] [margin_ppm=<ppm>]"
+ * starts a search, "pass" or "fail" is the verdict of the current candidate,
+ * "abort" aborts the search and restores the rate.
+ */
+static ssize_t fclk_set_search(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+{
+    struct fclk_search* search;
+    char*               str;
+    char*               ptr;
+    char*               token;
+    unsigned long       min_rate   = 0;
+    unsigned long       max_rate   = 0;
+    unsigned long       step       = 0;
+    unsigned long       timeout_ms = 1000;
+    unsigned long       margin_ppm = 0;
+    int                 retval     = 0;
+
+    if (!this)
+        return -ENODEV;
+    search = &this->search;
+    if (sysfs_streq(buf, "pass") || sysfs_streq(buf, "fail")) {
+        mutex_lock(&this->lock);
+        retval = __fclk_search_verdict(this, sysfs_streq(buf, "pass"));
+        mutex_unlock(&this->lock);
+        return (retval) ? retval : size;
+    }
+    if (sysfs_streq(buf, "abort")) {
+        mutex_lock(&this->lock);
+        __fclk_search_abort(this);
+        mutex_unlock(&this->lock);
+        return size;
+    }
+    str = kstrdup(buf, GFP_KERNEL);
+    if (str == NULL)
+        return -ENOMEM;
+    ptr   = strim(str);
+    token = strsep(&ptr, " \t");
+    if (strcmp(token, "start") != 0) {
+        retval = -EINVAL;
+        goto done;
+    }
+    while ((token = strsep(&ptr, " \t\n,")) != NULL) {
+        char*         value;
+        unsigned long number;
+        if (*token == '\0')
+            continue;
+        value = strchr(token, '=');
+        if (value == NULL) {
+            retval = -EINVAL;
+            goto done;
+        }
+        *value++ = '\0';
+        if (0 != (retval = kstrtoul(value, 0, &number)))
+            goto done;
+        if      (strcmp(token, "min"       ) == 0)
+            min_rate   = number;
+        else if (strcmp(token, "max"       ) == 0)
+            max_rate   = number;
+        else if (strcmp(token, "step"      ) == 0)
+            step       = number;
+        else if (strcmp(token, "timeout_ms") == 0)
+            timeout_ms = number;
+        else if (strcmp(token, "margin_ppm") == 0)
+            margin_ppm = number;
+        else {
+            retval = -EINVAL;
+            goto done;
+        }
+    }
+    if ((timeout_ms > UINT_MAX) || (margin_ppm > UINT_MAX)) {
+        retval = -EINVAL;
+        goto done;
+    }
+    mutex_lock(&this->lock);
+    if (search->active == true) {
+        retval = -EBUSY;
+    } else {
+        search->min_rate   = min_rate;
+        search->max_rate   = max_rate;
+        search->step       = step;
+        search->timeout_ms = (unsigned int)timeout_ms;
+        search->margin_ppm = (unsigned int)margin_ppm;
+        retval = __fclk_search_start(this);
+    }
+    mutex_unlock(&this->lock);
+ done:
+    kfree(str);
+    return (retval) ? retval : size;
+}
+
+/**
+ * fclk_show_cpufreq()
+ */
+static ssize_t fclk_show_cpufreq(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    struct fclk_cpufreq* cpufreq;
+    ssize_t              len;
+
+    if (!this)
+        return -ENODEV;
+    cpufreq = &this->cpufreq;
+    mutex_lock(&this->lock);
+    if (cpufreq->active == false)
+        len = sprintf(buf, "none\n");
+    else
+        len = sprintf(buf, "cpu=%u khz=%u band=%d rate=%lu transitions=%lu\n",
+                      cpufreq->cpu, READ_ONCE(cpufreq->cpu_khz), cpufreq->band,
+                      (cpufreq->band >= 0) ? cpufreq->bands[cpufreq->band].rate : 0,
+                      cpufreq->transitions);
+    mutex_unlock(&this->lock);
+    return len;
+}
+
+/**
+ * fclk_show_power_uw()
+ */
+static ssize_t fclk_show_power_uw(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    unsigned long flags;
+    unsigned long power_uw;
+
+    if (!this)
+        return -ENODEV;
+    if (this->power.valid == false)
+        return sprintf(buf, "none\n");
+    spin_lock_irqsave(&this->atomic_lock, flags);
+    power_uw = this->power.power_uw;
+    spin_unlock_irqrestore(&this->atomic_lock, flags);
+    return sprintf(buf, "%lu\n", power_uw);
+}
+
+/**
+ * fclk_show_energy_uj()
+ */
+static ssize_t fclk_show_energy_uj(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    unsigned long flags;
+    u64           energy_uj;
+
+    if (!this)
+        return -ENODEV;
+    if (this->power.valid == false)
+        return sprintf(buf, "none\n");
+    spin_lock_irqsave(&this->atomic_lock, flags);
+    __fclk_power_account(this, this->power.power_uw);
+    energy_uj = this->power.energy_uj;
+    spin_unlock_irqrestore(&this->atomic_lock, flags);
+    return sprintf(buf, "%llu\n", (unsigned long long)energy_uj);
+}
+
+/**
+ * fclk_set_energy_uj()
+ */
+static ssize_t fclk_set_energy_uj(struct fclk_device_data* this, struct device_attribute *attr, const char *buf, size_t size)
+{
+    unsigned long flags;
+
+    if (!this)
+        return -ENODEV;
+    spin_lock_irqsave(&this->atomic_lock, flags);
+    __fclk_power_account(this, this->power.power_uw);
+    this->power.energy_uj  = 0;
+    this->power.energy_rem = 0;
+    spin_unlock_irqrestore(&this->atomic_lock, flags);
+    return size;
+}
+
+/**
+ * fclk_show_resource_rate()
+ */
+static ssize_t fclk_show_resource_rate(struct fclk_device_data* this, struct device_attribute *attr, char *buf)
+{
+    int resclk;
+
+    if (!this)
+        return -ENODEV;
+    resclk = this->target.resource_clk_id;
+    if ((this->resource_clks == NULL) || (resclk < 0) || (resclk >= this->resource_clks_size))
+        return sprintf(buf, "0\n");
+    return sprintf(buf, "%lu\n", clk_get_rate(this->resource_clks[resclk]));
+}
+
+/**
+ * DOC: fclk device data operations
+ *
+ * This section defines the operation of fclk device data.
+ *
+ * * fclk_device_info()      - Print infomation the fclk device data.
+ * * fclk_device_info_summary() - Print one line summary of the fclk device data.
+ * * fclk_device_get_u32_property() - get u32 property from device.
+ * * fclk_device_get_rate_property() - get rate property from device.
+ * * fclk_device_validate_state()     - check that state is achievable.
+ * * fclk_device_get_manifest_state() - get state from clock manifest.
+ * * fclk_device_count_clock_names() - count "<prefix><N>" entries in clock-names.
+ * * fclk_device_get_group_clocks() - get clocks by "target<N>" and "resource<M>" names.
+ * * fclk_device_overlay_restore()  - change back from program state to insert state.
+ * * fclk_device_overlay_timeout()  - fpga region programming did not finish in time.
+ * * fclk_device_overlay_notify()   - fpga region reconfiguration notifier.
+ * * fclk_device_init()      - Initialize the fclk device data.
+ * * fclk_device_get()       - Get a reference of the fclk device data.
+ * * fclk_device_put()       - Put a reference of the fclk device data.
+ * * fclk_device_setup()     - Set up   the fclk device data.
+ * * fclk_device_cleanup()   - Clean up the fclk device data.
+ */
+/**
+ * fclk_device_info() -  Print infomation the fclk device data.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @pdev:	handle to the platform device structure or NULL.
+ *
+ */
+static void fclk_device_info(struct fclk_device_data* this, struct platform_device* pdev)
+{
+    struct device* dev = (pdev != NULL)? &pdev->dev : this->device;
+
+#define RES_INFO(dev, tag, resclk)                                                    \
+    if (this->resource_clks != NULL) {                                                \
+        if (((resclk) >= 0) && ((resclk) < this->resource_clks_size))                 \
+            dev_info(dev, tag "%s\n",  __clk_get_name(this->resource_clks[(resclk)]));\
+        else                                                                          \
+            dev_info(dev, tag "%d\n",  (int)(resclk));                                \
+    }
+
+    dev_info(dev, "driver version : %s\n" , DRIVER_VERSION);
+    dev_info(dev, "device name    : %s\n" , dev_name(this->device));
+    dev_info(dev, "clock  name    : %s\n" , __clk_get_name(this->target.clk));
+    dev_info(dev, "clock  rate    : %lu\n", clk_get_rate(this->target.clk));
+    dev_info(dev, "clock  enabled : %d\n" , __clk_is_enabled(this->target.clk));
+    RES_INFO(dev, "resource clock : "     , this->target.resource_clk_id);
+    if ((this->resource_clks != NULL) && (this->resource_clks_size > 1)) {
+        int i;
+        for (i = 0; i < this->resource_clks_size; i++) {
+            struct clk* resource_clk = this->resource_clks[i];
+            dev_info(dev, "resource clocks: %d => %s"  , i, __clk_get_name(resource_clk));
+        }
+    }
+    if (this->group_targets_size > 0) {
+        int i;
+        for (i = 0; i < this->group_targets_size; i++) {
+            struct clk* target_clk = this->group_targets[i].clk;
+            dev_info(dev, "group targets  : %d => %s", i+1, __clk_get_name(target_clk));
+        }
+    }
+    {
+        if (this->remove.rate_valid   == true)
+            dev_info(dev, "remove rate    : %lu\n", this->remove.rate  );
+        if (this->remove.enable_valid == true)
+            dev_info(dev, "remove enable  : %d\n" , this->remove.enable);
+        if (this->remove.resclk_valid == true)
+            RES_INFO(dev, "remove resource: "     , this->remove.resclk);
+    }
+}
+/**
+ * fclk_device_info_summary() - Print one line summary of the fclk device data.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @pdev:	handle to the platform device structure or NULL.
+ * @msg:        message printed at the head of the line.
+ *
+ */
+static void fclk_device_info_summary(struct fclk_device_data* this, struct platform_device* pdev, const char* msg)
+{
+    struct device* dev      = (pdev != NULL)? &pdev->dev : this->device;
+    const char*    resource = "-";
+
+    if ((this->resource_clks != NULL) &&
+        (this->target.resource_clk_id >= 0 ) &&
+        (this->target.resource_clk_id < this->resource_clks_size))
+        resource = __clk_get_name(this->resource_clks[this->target.resource_clk_id]);
+
+    dev_info(dev, "%s device=%s clock=%s rate=%lu enable=%d resource=%s\n",
+             msg,
+             dev_name(this->device),
+             __clk_get_name(this->target.clk),
+             clk_get_rate(this->target.clk),
+             __clk_is_enabled(this->target.clk),
+             resource);
+}
+
+/**
+ * fclk_device_get_state_property() - get rate/enable/resource property from device.
+ *
+ * @this:        Pointer to the fclk device data.
+ * @dev:         handle to the device structure.
+ * @of_node:     handle to the of node.
+ * @rate_name:   rate property name
+ * @enable_name: enable property name
+ * @resclk_name: resource clock property name
+ * @state:       address of fclk state data.
+ * Return:       Success(=0) or error status(<0).
+ *
+ */
+static int fclk_device_get_state_property(
+    struct fclk_device_data* this       ,
+    struct device*           dev        ,
+    struct device_node*      of_node    ,
+    const  char*             rate_name  ,
+    const  char*             enable_name,
+    const  char*             resclk_name,
+    struct fclk_state*       state      )
+{
+    of_get_fclk_state(dev, of_node, rate_name, enable_name, resclk_name, state);
+    if ((this->resource_clks != NULL) &&
+        (state->resclk_valid == true) &&
+        (state->resclk >= this->resource_clks_size)) {
+        dev_err(dev, "invalid %s(=%lu).\n", resclk_name, state->resclk);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/**
+ * fclk_device_get_u32_property() - get u32 property from device.
+ *
+ * @dev:           handle to the device structure.
+ * @prop_name:     property name.
+ * @default_value: value used when the property is not specified.
+ * Return:         property value or default value.
+ *
+ */
+static unsigned int fclk_device_get_u32_property(
+    struct device*           dev          ,
+    const  char*             prop_name    ,
+    unsigned int             default_value)
+{
+    unsigned int prop_value;
+
+    if (of_property_read_u32(dev->of_node, prop_name, &prop_value) == 0) {
+        DEV_DBG(dev, "get %s property (=%u).\n", prop_name, prop_value);
+        return prop_value;
+    } else {
+        DEV_DBG(dev, "set %s = %u\n", prop_name, default_value);
+        return default_value;
+    }
+}
+
+/**
+ * fclk_device_get_rate_property() - get rate property from device.
+ *
+ * @dev:           handle to the device structure.
+ * @prop_name:     property name.
+ * @default_value: value used when the property is not specified.
+ * Return:         property value or default value.
+ *
+ * The rate is a string property, as insert-rate.
+ */
+static unsigned long fclk_device_get_rate_property(
+    struct device*           dev          ,
+    const  char*             prop_name    ,
+    unsigned long            default_value)
+{
+    const char*   prop = of_get_property(dev->of_node, prop_name, NULL);
+    unsigned long prop_value;
+
+    if (!IS_ERR_OR_NULL(prop) && (kstrtoul(prop, 0, &prop_value) == 0)) {
+        DEV_DBG(dev, "get %s property (=%lu).\n", prop_name, prop_value);
+        return prop_value;
+    }
+    if (!IS_ERR_OR_NULL(prop))
+        dev_err(dev, "invalid %s.\n", prop_name);
+    DEV_DBG(dev, "set %s = %lu\n", prop_name, default_value);
+    return default_value;
+}
+
+/**
+ * fclk_device_overlay_restore() - change back from program state to insert state.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @reason:     why the programming ended, for the log.
+ *
+ * Does nothing unless the program state was applied by
+ * fclk_device_overlay_notify(). Called with this->lock held.
+ */
+static void fclk_device_overlay_restore(struct fclk_device_data* this, const char* reason)
+{
+    struct fclk_state next_state;
+    int               retval;
+
+    if (this->overlay_programming == false)
+        return;
+    this->overlay_programming = false;
+    cancel_delayed_work(&this->overlay_timeout_work);
+    next_state              = this->insert;
+    next_state.rate_valid   = true;
+    next_state.enable_valid = true;
+    next_state.resclk_valid = (this->resource_clks != NULL);
+    retval = __fclk_change_all_state(this, &next_state);
+    if (retval)
+        dev_err(this->device, "change to insert state after %s failed(%d).\n", reason, retval);
+    else
+        DEV_DBG(this->device, "change to insert state after %s done.\n", reason);
+}
+
+/**
+ * fclk_device_overlay_timeout() - fpga region programming did not finish in time.
+ *
+ * @work:       work_struct of overlay_timeout_work.
+ */
+static void fclk_device_overlay_timeout(struct work_struct* work)
+{
+    struct fclk_device_data* this = container_of(to_delayed_work(work), struct fclk_device_data, overlay_timeout_work);
+
+    mutex_lock(&this->lock);
+    if (this->overlay_programming == true) {
+        dev_warn(this->device, "fpga region was not applied within %u ms.\n", this->program_timeout_ms);
+        fclk_device_overlay_restore(this, "timeout");
+    }
+    mutex_unlock(&this->lock);
+}
+
+#if (USE_OF_OVERLAY_NOTIFIER == 1)
+/**
+ * fclk_device_overlay_notify() - fpga region reconfiguration notifier.
+ *
+ * @nb:         Pointer to the notifier block in the fclk device data.
+ * @action:     overlay notify action.
+ * @arg:        Pointer to the overlay notify data.
+ * Return:      notifier status.
+ *
+ * The fpga region driver programs the FPGA from OF_OVERLAY_PRE_APPLY, so
+ * this notifier is registered with a higher priority to change to the
+ * program state before programming, and changes back to the insert state
+ * at OF_OVERLAY_POST_APPLY.
+ *
+ * If the overlay fails after the program state is applied, POST_APPLY
+ * never comes. So overlay_programming is set at PRE_APPLY, and the insert
+ * state is also restored at the next notification of the region that is
+ * not POST_APPLY (a new PRE_APPLY, PRE_REMOVE or POST_REMOVE), or when
+ * program_timeout_ms passes without POST_APPLY.
+ */
+static int fclk_device_overlay_notify(struct notifier_block* nb, unsigned long action, void* arg)
+{
+    struct fclk_device_data*       this = container_of(nb, struct fclk_device_data, overlay_notifier);
+    struct of_overlay_notify_data* nd   = arg;
+    int                            retval;
+
+    if ((nd == NULL) || (nd->target != this->fpga_region))
+        return NOTIFY_OK;
+
+    switch (action) {
+    case OF_OVERLAY_PRE_APPLY:
+        DEV_DBG(this->device, "fpga region pre apply.\n");
+        mutex_lock(&this->lock);
+        if (this->overlay_programming == true) {
+            dev_warn(this->device, "previous fpga region apply did not finish.\n");
+            fclk_device_overlay_restore(this, "unfinished apply");
+        }
+        retval = __fclk_change_all_state(this, &this->program);
+        if (retval == 0) {
+            this->overlay_programming = true;
+            if (this->program_timeout_ms > 0)
+                mod_delayed_work(system_wq, &this->overlay_timeout_work, msecs_to_jiffies(this->program_timeout_ms));
+        }
+        mutex_unlock(&this->lock);
+        if (retval) {
+            dev_err(this->device, "change to program state failed(%d).\n", retval);
+            return notifier_from_errno(retval);
+        }
+        break;
+    case OF_OVERLAY_POST_APPLY:
+        DEV_DBG(this->device, "fpga region post apply.\n");
+        mutex_lock(&this->lock);
+        fclk_device_overlay_restore(this, "apply");
+        mutex_unlock(&this->lock);
+        break;
+    case OF_OVERLAY_PRE_REMOVE:
+    case OF_OVERLAY_POST_REMOVE:
+        mutex_lock(&this->lock);
+        fclk_device_overlay_restore(this, "remove");
+        mutex_unlock(&this->lock);
+        break;
+    default:
+        break;
+    }
+    return NOTIFY_OK;
+}
+#endif
+
+/**
+ * fclk_device_validate_state() - check that state is achievable.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @state:      state to check.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The rate is rounded on the resource clock of @state, or by clk_round_rate()
+ * on the current resource clock. With rate tolerance, the rounded rate must
+ * be within it. Without rate tolerance, the rounded rate must not be above
+ * the requested rate, as a divider rounds down.
+ */
+static int fclk_device_validate_state(struct fclk_device_data* this, struct fclk_state* state)
+{
+    long round;
+    int  retval;
+
+    if (0 != (retval = fclk_check_state(this, state)))
+        return retval;
+    if (state->rate_valid == false)
+        return 0;
+    if (state->resclk_valid == true) {
+        round = __fclk_round_rate_on_resource(this, &this->target, state->resclk, state->rate);
+        if (round < 0)
+            return (int)round;
+    } else {
+        round = clk_round_rate(this->target.clk, state->rate);
+    }
+    if (round <= 0)
+        return -ERANGE;
+    if ((this->rate_tolerance_ppm == 0) && (this->rate_tolerance_hz == 0))
+        return ((unsigned long)round > state->rate) ? -ERANGE : 0;
+    if (__fclk_rate_in_tolerance(this, state->rate, (unsigned long)round) == false)
+        return -ERANGE;
+    return 0;
+}
+
+/**
+ * fclk_device_get_manifest_state() - get state from clock manifest.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @dev:        handle to the device structure.
+ * @state:      address of fclk state data to be updated.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * When the "firmware-name" property is specified, the manifest is loaded by
+ * request_firmware() and the fields of the line for this device override
+ * @state.
+ */
+static int fclk_device_get_manifest_state(struct fclk_device_data* this, struct device* dev, struct fclk_state* state)
+{
+    const char*            firmware_name;
+    const struct firmware* fw;
+    char*                  text;
+    char*                  ptr;
+    char*                  line;
+    int                    line_num = 0;
+    bool                   found    = false;
+    int                    retval;
+
+    if (of_property_read_string(dev->of_node, "firmware-name", &firmware_name) != 0)
+        return 0;
+
+    retval = request_firmware(&fw, firmware_name, dev);
+    if (retval) {
+        dev_err(dev, "request_firmware(%s) failed(%d).\n", firmware_name, retval);
+        return retval;
+    }
+    text = fclk_manifest_dup(fw);
+    release_firmware(fw);
+    if (text == NULL)
+        return -ENOMEM;
+
+    ptr = text;
+    while ((line = strsep(&ptr, "\n")) != NULL) {
+        char*             name;
+        struct fclk_state next;
+        line_num++;
+        if (0 != (retval = parse_fclk_manifest_line(line, &name, &next))) {
+            dev_err(dev, "%s:%d: parse error(%d).\n", firmware_name, line_num, retval);
+            break;
+        }
+        if ((name == NULL) || (strcmp(name, dev_name(this->device)) != 0))
+            continue;
+        if (0 != (retval = fclk_device_validate_state(this, &next))) {
+            dev_err(dev, "%s:%d: invalid state(%d).\n", firmware_name, line_num, retval);
+            break;
+        }
+        if (next.rate_valid   == true) {
+            state->rate         = next.rate;
+            state->rate_valid   = true;
+        }
+        if (next.enable_valid == true) {
+            state->enable       = next.enable;
+            state->enable_valid = true;
+        }
+        if (next.resclk_valid == true) {
+            state->resclk       = next.resclk;
+            state->resclk_valid = true;
+        }
+        found = true;
+    }
+    if ((retval == 0) && (found == false))
+        dev_warn(dev, "%s has no entry for %s.\n", firmware_name, dev_name(this->device));
+    kfree(text);
+    return retval;
+}
+
+/**
+ * fclk_device_count_clock_names() - Count "<prefix><N>" entries in clock-names.
+ *
+ * @dev:        handle to the device structure.
+ * @prefix:     clock name prefix ("target" or "resource").
+ * Return:      Number of consecutive names starting from "<prefix>0".
+ */
+static int fclk_device_count_clock_names(struct device *dev, const char* prefix)
+{
+    char name[16];
+    int  count;
+
+    for (count = 0; ; count++) {
+        snprintf(name, sizeof(name), "%s%d", prefix, count);
+        if (of_property_match_string(dev->of_node, "clock-names", name) < 0)
+            break;
+    }
+    return count;
+}
+
+/**
+ * fclk_device_get_group_clocks() - Get clocks by "target<N>" and "resource<M>" names.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @dev:        handle to the device structure.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * Clocks that have been got are left in @this on failure, and are released
+ * by fclk_device_cleanup().
+ */
+static int fclk_device_get_group_clocks(struct fclk_device_data* this, struct device *dev)
+{
+    char name[16];
+    int  targets_size   = fclk_device_count_clock_names(dev, "target");
+    int  resources_size = fclk_device_count_clock_names(dev, "resource");
+    int  i;
+
+    DEV_DBG(dev, "group targets=%d resources=%d\n", targets_size, resources_size);
+
+    if ((targets_size > 1) && (this->group_targets == NULL)) {
+        this->group_targets = kcalloc(targets_size-1, sizeof(struct fclk_target), GFP_KERNEL);
+        if (this->group_targets == NULL)
+            return -ENOMEM;
+    }
+    if (resources_size > 0) {
+        this->resource_clks = kcalloc(resources_size, sizeof(struct clk*), GFP_KERNEL);
+        if (this->resource_clks == NULL)
+            return -ENOMEM;
+    }
+    for (i = 0; i < targets_size; i++) {
+        struct fclk_target* target = (i == 0) ? &this->target : &this->group_targets[i-1];
+        struct clk*         clk;
+        snprintf(name, sizeof(name), "target%d", i);
+        clk = of_clk_get_by_name(dev->of_node, name);
+        if (IS_ERR_OR_NULL(clk)) {
+            if (PTR_ERR(clk) != -EPROBE_DEFER)
+                dev_err(dev, "of_clk_get_by_name(%s) failed.\n", name);
+            return (clk == NULL) ? -ENODEV : PTR_ERR(clk);
+        }
+        target->clk             = clk;
+        target->resource_clk_id = (resources_size > 0) ? -1 : 0;
+        if (i > 0)
+            this->group_targets_size++;
+    }
+    for (i = 0; i < resources_size; i++) {
+        struct clk* clk;
+        snprintf(name, sizeof(name), "resource%d", i);
+        clk = of_clk_get_by_name(dev->of_node, name);
+        if (IS_ERR_OR_NULL(clk)) {
+            if (PTR_ERR(clk) != -EPROBE_DEFER)
+                dev_err(dev, "of_clk_get_by_name(%s) failed.\n", name);
+            return (clk == NULL) ? -ENODEV : PTR_ERR(clk);
+        }
+        this->resource_clks[this->resource_clks_size++] = clk;
+    }
+    return 0;
+}
+
+/**
+ * fclk_device_init()      - Initialize the fclk device data.
+ *
+ * @this:       Pointer to the fclk device data.
+ *
+ * Initializes the locks, works and timers right after @this is allocated,
+ * before the device and its attributes are created, so that a sysfs write
+ * and fclk_device_cleanup() never see them uninitialized.
+ */
+static void fclk_device_init(struct fclk_device_data* this)
+{
+    kref_init(&this->kref);
+    mutex_init(&this->lock);
+    spin_lock_init(&this->atomic_lock);
+    INIT_WORK(&this->schedule.work, __fclk_schedule_work);
+    __fclk_schedule_init(this, CLOCK_MONOTONIC);
+    INIT_DELAYED_WORK(&this->enforce_work, __fclk_enforce_work);
+    INIT_DELAYED_WORK(&this->search.timeout_work, __fclk_search_timeout);
+    INIT_WORK(&this->cpufreq.work, __fclk_cpufreq_work);
+    INIT_DELAYED_WORK(&this->overlay_timeout_work, fclk_device_overlay_timeout);
+}
+
+/**
+ * fclk_device_get()       - Get a reference of the fclk device data.
+ *
+ * @this:       Pointer to the fclk device data.
+ */
+static void fclk_device_get(struct fclk_device_data* this)
+{
+    kref_get(&this->kref);
+}
+
+/**
+ * fclk_device_release()   - Free the fclk device data.
+ *
+ * @kref:       kref of the fclk device data.
+ */
+static void fclk_device_release(struct kref* kref)
+{
+    struct fclk_device_data* this = container_of(kref, struct fclk_device_data, kref);
+
+    mutex_destroy(&this->lock);
+    kfree(this);
+}
+
+/**
+ * fclk_device_put()       - Put a reference of the fclk device data.
+ *
+ * @this:       Pointer to the fclk device data.
+ *
+ * The fclk device data is freed when the last reference is put.
+ */
+static void fclk_device_put(struct fclk_device_data* this)
+{
+    kref_put(&this->kref, fclk_device_release);
+}
+
+/**
+ * fclk_device_setup()     - Set up the fclk device data.
+ *
+ * @this:        Pointer to the fclk device data.
+ * @dev:         handle to the device structure.
+ * Return:       Success(=0) or error status(<0).
+ *
+ */
+static int fclk_device_setup(struct fclk_device_data* this, struct device *dev)
+{
+    int  retval = 0;
+    bool group  = false;
+    /*
+     * get group clocks
+     */
+    if ((this->target.clk == NULL) &&
+        (of_property_match_string(dev->of_node, "clock-names", "target0") >= 0)) {
+        group  = true;
+        retval = fclk_device_get_group_clocks(this, dev);
+        if (retval)
+            goto failed;
+    }
+    /*
+     * get clk
+     */
+    if (this->target.clk == NULL) {
+        DEV_DBG(dev, "of_clk_get(0) start.\n");
+        this->target.clk = of_clk_get(dev->of_node, 0);
+        if (IS_ERR_OR_NULL(this->target.clk)) {
+            dev_err(dev, "of_clk_get(0) failed.\n");
+            retval = PTR_ERR(this->target.clk);
+            this->target.clk = NULL;
+            goto failed;
+        }
+        DEV_DBG(dev, "of_clk_get(0) done.\n");
+    }
+    /*
+     * get resource clock list
+     */
+    if ((this->resource_clks == NULL) && (group == false)) {
+        int clk_count;
+
+        DEV_DBG(dev, "of_clk_get(1..) start.\n");
+        clk_count = of_count_phandle_with_args(dev->of_node, "clocks", "#clock-cells");
+        this->resource_clks      = NULL;
+        this->resource_clks_size = 0;
+        this->target.resource_clk_id = 0;
+        if (clk_count > 1) {
+            int clk_index;
+            this->resource_clks = kcalloc(clk_count-1, sizeof(struct clk*), GFP_KERNEL);
+            if (this->resource_clks == NULL) {
+                dev_err(dev, "create resource_clks falied.\n");
+                retval = -ENOMEM;
+                goto failed;
+            }
+            for (clk_index = 0; clk_index < clk_count-1; clk_index++) {
+                struct clk* resource_clk = of_clk_get(dev->of_node, clk_index+1);
+                if (IS_ERR_OR_NULL(resource_clk))
+                    break;
+                this->resource_clks[this->resource_clks_size++] = resource_clk;
+            }
+            if (this->resource_clks_size > 0) {
+                this->target.resource_clk_id = -1;   /* Uninitialized resclk flag */
+            } else {
+                kfree(this->resource_clks);
+                this->resource_clks = NULL;
+            }
+        }
+        DEV_DBG(dev, "of_clk_get(1..) done.\n");
+    }
+
+    /*
+     * get resets
+     */
+    DEV_DBG(dev, "get resets start.\n");
+    {
+        this->resets = of_reset_control_array_get_optional_exclusive(dev->of_node);
+        if (IS_ERR(this->resets)) {
+            retval = PTR_ERR(this->resets);
+            this->resets = NULL;
+            if (retval != -EPROBE_DEFER)
+                dev_err(dev, "get resets failed(%d).\n", retval);
+            goto failed;
+        }
+        this->reset_asserted          = false;
+        this->reset_assert_delay_us   = fclk_device_get_u32_property(dev, "reset-assert-delay-us"  , 0);
+        this->reset_deassert_delay_us = fclk_device_get_u32_property(dev, "reset-deassert-delay-us", 0);
+    }
+    DEV_DBG(dev, "get resets done.\n");
+
+    /*
+     * get settle times
+     */
+    this->enable_settle_us   = fclk_device_get_u32_property(dev, "enable-settle-us"  , 0);
+    this->resource_settle_us = fclk_device_get_u32_property(dev, "resource-settle-us", 0);
+    this->rate_settle_us     = fclk_device_get_u32_property(dev, "rate-settle-us"    , 0);
+
+    /*
+     * get rate tolerance
+     */
+    this->rate_tolerance_ppm = fclk_device_get_u32_property(dev, "rate-tolerance-ppm", 0);
+    this->rate_tolerance_hz  = fclk_device_get_u32_property(dev, "rate-tolerance-hz" , 0);
+
+    /*
+     * get rate range
+     */
+    this->min_rate = fclk_device_get_rate_property(dev, "min-rate", 0);
+    this->max_rate = fclk_device_get_rate_property(dev, "max-rate", 0);
+    if ((this->max_rate != 0) && (this->min_rate > this->max_rate)) {
+        dev_err(dev, "min-rate(%lu) > max-rate(%lu).\n", this->min_rate, this->max_rate);
+        retval = -EINVAL;
+        goto failed;
+    }
+
+    /*
+     * get retunable resources
+     */
+    if (this->resource_clks != NULL) {
+        const char* prop_name = "retunable-resources";
+        int         count     = of_property_count_u32_elems(dev->of_node, prop_name);
+        int         i;
+
+        this->resource_retunable = 0;
+        for (i = 0; i < count; i++) {
+            u32 index;
+            if (of_property_read_u32_index(dev->of_node, prop_name, i, &index) != 0)
+                break;
+            if ((index >= this->resource_clks_size) || (index >= BITS_PER_LONG)) {
+                dev_err(dev, "invalid %s(%u).\n", prop_name, index);
+                retval = -EINVAL;
+                goto failed;
+            }
+            this->resource_retunable |= BIT(index);
+        }
+        if ((this->resource_retunable != 0) && (this->resource_saved_rates == NULL)) {
+            this->resource_saved_rates = kcalloc(this->resource_clks_size, sizeof(unsigned long), GFP_KERNEL);
+            if (this->resource_saved_rates == NULL) {
+                retval = -ENOMEM;
+                goto failed;
+            }
+        }
+        this->retunable_min_rate = fclk_device_get_rate_property(dev, "retunable-min-rate", 0);
+        this->retunable_max_rate = fclk_device_get_rate_property(dev, "retunable-max-rate", 0);
+    }
+
+    /*
+     * get rate ratio
+     */
+    {
+        const char* ratio_device;
+        u32         ratio[2] = {1, 1};
+
+        if ((this->ratio_device == NULL) &&
+            (of_property_read_string(dev->of_node, "rate-ratio-device", &ratio_device) == 0)) {
+            of_property_read_u32_index(dev->of_node, "rate-ratio", 0, &ratio[0]);
+            of_property_read_u32_index(dev->of_node, "rate-ratio", 1, &ratio[1]);
+            if ((ratio[0] == 0) || (ratio[1] == 0)) {
+                dev_err(dev, "invalid rate-ratio.\n");
+                retval = -EINVAL;
+                goto failed;
+            }
+            this->ratio_device = kstrdup(ratio_device, GFP_KERNEL);
+            if (this->ratio_device == NULL) {
+                retval = -ENOMEM;
+                goto failed;
+            }
+            this->ratio_num = ratio[0];
+            this->ratio_den = ratio[1];
+        }
+    }
+
+    /*
+     * get power model
+     */
+    if (this->power.valid == false) {
+        const char* prop_name = "power-table";
+        int         count     = of_property_count_u32_elems(dev->of_node, prop_name);
+        int         i;
+
+        if (count > 0) {
+            if ((count % 2) != 0) {
+                dev_err(dev, "invalid %s.\n", prop_name);
+                retval = -EINVAL;
+                goto failed;
+            }
+            this->power.table = kcalloc(count / 2, sizeof(struct fclk_power_point), GFP_KERNEL);
+            if (this->power.table == NULL) {
+                retval = -ENOMEM;
+                goto failed;
+            }
+            for (i = 0; i < count / 2; i++) {
+                u32 rate = 0;
+                u32 mw   = 0;
+                of_property_read_u32_index(dev->of_node, prop_name, 2*i+0, &rate);
+                of_property_read_u32_index(dev->of_node, prop_name, 2*i+1, &mw);
+                if ((i > 0) && (rate <= this->power.table[i-1].rate)) {
+                    dev_err(dev, "invalid %s[%d].\n", prop_name, i);
+                    retval = -EINVAL;
+                    goto failed;
+                }
+                this->power.table[i].rate = rate;
+                this->power.table[i].uw   = (unsigned long)mw * 1000;
+            }
+            this->power.table_size = count / 2;
+            this->power.valid      = true;
+        }
+        if (of_property_read_bool(dev->of_node, "power-dynamic-uw-per-mhz") ||
+            of_property_read_bool(dev->of_node, "power-static-uw")) {
+            this->power.dynamic_uw_per_mhz = fclk_device_get_u32_property(dev, "power-dynamic-uw-per-mhz", 0);
+            this->power.static_uw          = fclk_device_get_u32_property(dev, "power-static-uw"         , 0);
+            this->power.valid              = true;
+        }
+        this->power.last = ktime_get();
+    }
+
+    /*
+     * get insert state
+     */
+    if ((this->resource_clks != NULL) && (this->insert.resclk_valid == false)) {
+        this->insert.resclk_valid = true; 
+        this->insert.resclk       = 0;
+    }
+    retval = fclk_device_get_state_property(
+                 this, dev, dev->of_node,
+                 "insert-rate", "insert-enable", "insert-resource", &this->insert
+             );
+    if (retval)
+        goto failed;
+    retval = fclk_device_get_manifest_state(this, dev, &this->insert);
+    if (retval)
+        goto failed;
+
+    /*
+     * disable-retry is no longer used: a disable releases exactly the
+     * references fclkcfg holds.
+     */
+    if (of_property_read_bool(dev->of_node, "disable-retry"))
+        dev_warn_once(dev, "disable-retry property is deprecated and ignored.\n");
+    /*
+     * enable synchronization
+     */
+    {
+        const char*  prog_name = "enable synchronization";
+        const char*  prop_name = "enable-sync";
+        bool         clk_enable_sync;
+
+        if (enable_sync != 0)
+            clk_enable_sync = true;
+        else
+            clk_enable_sync = of_property_read_bool(dev->of_node, prop_name);
+
+        if (clk_enable_sync == true) {
+            int i;
+            for (i = 0; i < __fclk_targets_size(this); i++) {
+                struct fclk_target* target = __fclk_get_target(this, i);
+                if (__clk_is_enabled(target->clk) == false)
+                    continue;
+                DEV_DBG(dev, "%s start.\n", prog_name);
+                retval = clk_prepare_enable(target->clk);
+                if (retval) {
+                    dev_err(dev, "%s failed(%d).\n", prog_name, retval);
+                } else {
+                    target->prepare_refs++;
+                    target->enable_refs++;
+                    DEV_DBG(dev, "%s success.\n", prog_name);
+                }
+                DEV_DBG(dev, "%s done.\n", prog_name);
+            }
+        }
+    }
+    /*
+     * keep prepared mode
+     */
+    if (of_property_read_bool(dev->of_node, "keep-prepared")) {
+        retval = __fclk_set_keep_prepared(this, true);
+        if (retval)
+            goto failed;
+    }
+    /*
+     * staged mode
+     */
+    fclk_state_clear(&this->pending);
+    this->staged = of_property_read_bool(dev->of_node, "staged");
+    /*
+     * change state to insert
+     */
+    retval = __fclk_change_all_state(this, &this->insert);
+    if (retval) {
+        dev_err(dev, "fclk change state failed(%d).\n", retval);
+        goto failed;
+    }
+    this->insert.enable = __clk_is_enabled(this->target.clk);
+    this->insert.rate   = clk_get_rate(this->target.clk);
+    this->insert.rate_max = false;
+    this->insert.resclk = this->target.resource_clk_id;
+    __fclk_power_update(this);
+    if ((this->min_rate != 0) || (this->max_rate != 0)) {
+        retval = __fclk_change_rate_range(this, this->min_rate, this->max_rate);
+        if (retval)
+            goto failed;
+    }
+
+    /*
+     * get remove state
+     */
+    retval = fclk_device_get_state_property(
+                 this, dev, dev->of_node,
+                 "remove-rate", "remove-enable", "remove-resource", &this->remove
+             );
+    if (retval)
+        goto failed;
+
+    /*
+     * get program state and fpga region
+     */
+    retval = fclk_device_get_state_property(
+                 this, dev, dev->of_node,
+                 "program-rate", "program-enable", "program-resource", &this->program
+             );
+    if (retval)
+        goto failed;
+    if ((this->program.rate_valid   == false) &&
+        (this->program.enable_valid == false) &&
+        (this->program.resclk_valid == false)) {
+        this->program = this->remove;
+    }
+    this->fpga_region = of_parse_phandle(dev->of_node, "fpga-region", 0);
+    if (this->fpga_region != NULL) {
+#if (USE_OF_OVERLAY_NOTIFIER == 1)
+        this->program_timeout_ms = fclk_device_get_u32_property(dev, "program-timeout-ms", 10000);
+        this->overlay_notifier.notifier_call = fclk_device_overlay_notify;
+        this->overlay_notifier.priority      = 1;
+        retval = of_overlay_notifier_register(&this->overlay_notifier);
+        if (retval) {
+            dev_err(dev, "of_overlay_notifier_register failed(%d).\n", retval);
+            goto failed;
+        }
+        this->overlay_notifier_done = true;
+#else
+        dev_warn(dev, "fpga-region is ignored without CONFIG_OF_OVERLAY.\n");
+#endif
+    }
+
+    /*
+     * enforce mode
+     */
+    this->enforce_interval_ms = fclk_device_get_u32_property(dev, "enforce-interval-ms", 0);
+    if (of_property_read_bool(dev->of_node, "enforce")) {
+        retval = __fclk_enforce_start(this);
+        if (retval)
+            goto failed;
+    }
+
+    /*
+     * cpufreq coupling
+     */
+    if ((this->cpufreq.bands == NULL) && (of_property_count_u32_elems(dev->of_node, "cpufreq-bands") > 0)) {
+        const char* prop_name = "cpufreq-bands";
+        int         count     = of_property_count_u32_elems(dev->of_node, prop_name);
+        int         i;
+
+        if ((count % 2) != 0) {
+            dev_err(dev, "invalid %s.\n", prop_name);
+            retval = -EINVAL;
+            goto failed;
+        }
+        this->cpufreq.bands = kcalloc(count / 2, sizeof(struct fclk_cpufreq_band), GFP_KERNEL);
+        if (this->cpufreq.bands == NULL) {
+            retval = -ENOMEM;
+            goto failed;
+        }
+        for (i = 0; i < count / 2; i++) {
+            u32 khz  = 0;
+            u32 rate = 0;
+            of_property_read_u32_index(dev->of_node, prop_name, 2*i+0, &khz);
+            of_property_read_u32_index(dev->of_node, prop_name, 2*i+1, &rate);
+            if ((rate == 0) || ((i > 0) && (khz <= this->cpufreq.bands[i-1].cpu_khz))) {
+                dev_err(dev, "invalid %s[%d].\n", prop_name, i);
+                retval = -EINVAL;
+                goto failed;
+            }
+            this->cpufreq.bands[i].cpu_khz = khz;
+            this->cpufreq.bands[i].rate    = rate;
+        }
+        this->cpufreq.bands_size     = count / 2;
+        this->cpufreq.cpu            = fclk_device_get_u32_property(dev, "cpufreq-cpu"           , 0);
+        this->cpufreq.hysteresis_khz = fclk_device_get_u32_property(dev, "cpufreq-hysteresis-khz", 0);
+#if (USE_CPUFREQ == 1)
+        retval = __fclk_cpufreq_start(this);
+        if (retval) {
+            dev_warn(dev, "cpufreq coupling is disabled(%d).\n", retval);
+            retval = 0;
+        }
+#else
+        dev_warn(dev, "cpufreq-bands is ignored without CONFIG_CPU_FREQ.\n");
+#endif
+    }
+
+    return 0;
+
+ failed:
+    return retval;
+}
+
+/**
+ * fclk_device_cleanup()   - Clean up the fclk device data.
+ *
+ * @this:       Pointer to the fclk device data.
+ * Return:      Success(=0) or error status(<0).
+ *
+ */
+static int fclk_device_cleanup(struct fclk_device_data* this)
+{
+    if (!this)
+        return -ENODEV;
+
+    __fclk_schedule_cancel(this);
+    __fclk_enforce_stop(this);
+    __fclk_search_stop(this);
+    __fclk_cpufreq_stop(this);
+    if (this->cpufreq.bands != NULL) {
+        kfree(this->cpufreq.bands);
+        this->cpufreq.bands      = NULL;
+        this->cpufreq.bands_size = 0;
+    }
+    if (this->power.table != NULL) {
+        kfree(this->power.table);
+        this->power.table      = NULL;
+        this->power.table_size = 0;
+    }
+    this->power.valid = false;
+    mutex_lock(&this->lock);
+    __fclk_set_keep_prepared(this, false);
+    mutex_unlock(&this->lock);
+#if (USE_OF_OVERLAY_NOTIFIER == 1)
+    if (this->overlay_notifier_done == true) {
+        of_overlay_notifier_unregister(&this->overlay_notifier);
+        this->overlay_notifier_done = false;
+    }
+#endif
+    cancel_delayed_work_sync(&this->overlay_timeout_work);
+    this->overlay_programming = false;
+    if (this->fpga_region) {
+        of_node_put(this->fpga_region);
+        this->fpga_region = NULL;
+    }
+    if (this->resets) {
+        reset_control_put(this->resets);
+        this->resets = NULL;
+    }
+    if (this->target.clk) {
+        clk_put(this->target.clk);
+        this->target.clk = NULL;
+    }
+    if (this->group_targets != NULL) {
+        int i;
+        for (i = 0 ; i < this->group_targets_size ; i++) {
+            clk_put(this->group_targets[i].clk);
+            this->group_targets[i].clk = NULL;
+        }
+        /*
+         * while the target<N> attribute groups are registered, they refer to
+         * group_targets, which is freed by fclkcfg_device_destroy() instead.
+         */
+        if (this->target_groups == NULL) {
+            kfree(this->group_targets);
+            this->group_targets  = NULL;
+        }
+    }
+    this->group_targets_size = 0;
+    if (this->resource_clks != NULL) {
+        int i;
+        for (i = 0 ; i < this->resource_clks_size ; i++) {
+            struct clk* resource_clk = this->resource_clks[i];
+            clk_put(resource_clk);
+        }
+        kfree(this->resource_clks);
+        this->resource_clks  = NULL;
+    }
+    this->resource_clks_size = 0;
+    this->target.resource_clk_id = 0;
+    kfree(this->resource_saved_rates);
+    this->resource_saved_rates = NULL;
+    this->resource_retunable   = 0;
+    kfree(this->ratio_device);
+    this->ratio_device         = NULL;
+    return 0;
+}
+
+/**
+ * DOC: fclkcfg device operations
+ *
+ * This section defines the operation of fclkcfg device.
+ *
+ * * fclkcfg_sys_class        - fclkcfg system class.
+ * * fclkcfg_device_number    - fclkcfg device major number.
+ * * fclkcfg_device_ida       - fclkcfg device minor number allocator variable.
+ * * fclkcfg_device_attrs     - fclkcfg device attribute table.
  * * fclkcfg_attr_group       - fclkcfg device attribute group.
  * * fclkcfg_attr_groups      - fclkcfg device attribute group table.
+ * * fclkcfg_device_prepare_target_groups() - Prepare target<N> attribute groups.
  * * fclkcfg_device_create()  - Create  fclkcfg device.
+ * * fclkcfg_device_release() - Release fclkcfg device.
  * * fclkcfg_device_destroy() - Destroy fclkcfg device.
  * * fclkcfg_device_attrs     - 
  */
-static struct class*  fclkcfg_sys_class     = NULL;
-static dev_t          fclkcfg_device_number = 0;
-static DEFINE_IDA(    fclkcfg_device_ida );
+static struct class*  fclkcfg_sys_class     = NULL;
+static dev_t          fclkcfg_device_number = 0;
+static DEFINE_IDA(    fclkcfg_device_ida );
+
+/**
+ * DEF_FCLKCFG_SHOW() - generate fclkcfg_show_ ## __attr_name() macro
+ */
+#define DEF_FCLKCFG_SHOW(__attr_name)        \
+static ssize_t fclkcfg_show_ ## __attr_name( \
+    struct device* dev,                      \
+    struct device_attribute *attr,           \
+    char *buf)                               \
+{   return fclk_show_ ## __attr_name(dev_get_drvdata(dev), attr, buf);}
+
+/**
+ * DEF_FCLKCFG_SET()  - generate fclkcfg_set_ ## __attr_name() macro
+ */
+#define DEF_FCLKCFG_SET(__attr_name)        \
+static ssize_t fclkcfg_set_ ## __attr_name( \
+    struct device* dev,                     \
+    struct device_attribute *attr,          \
+    const char *buf,                        \
+    size_t size)                            \
+{   return fclk_set_ ## __attr_name(dev_get_drvdata(dev), attr, buf, size);}
+
+/**
+ * fclkcfg_show_driver_version()
+ */
+DEF_FCLKCFG_SHOW(driver_version);
+/**
+ * fclkcfg_show_enable()
+ * fclkcfg_set_enable()
+ */
+DEF_FCLKCFG_SHOW(enable);
+DEF_FCLKCFG_SET (enable);
+/**
+ * fclkcfg_show_rate()
+ * fclkcfg_set_rate()
+ */
+DEF_FCLKCFG_SHOW(rate);
+DEF_FCLKCFG_SET (rate);
+/**
+ * fclkcfg_show_round_rate()
+ * fclkcfg_set_round_rate()
+ */
+DEF_FCLKCFG_SHOW(round_rate);
+DEF_FCLKCFG_SET (round_rate);
+/**
+ * fclkcfg_show_resource()
+ * fclkcfg_set_resource()
+ */
+DEF_FCLKCFG_SHOW(resource);
+DEF_FCLKCFG_SET (resource);
+/**
+ * fclkcfg_show_state()
+ * fclkcfg_set_state()
+ */
+DEF_FCLKCFG_SHOW(state);
+DEF_FCLKCFG_SET (state);
+/**
+ * fclkcfg_show_resource_clks()
+ */
+DEF_FCLKCFG_SHOW(resource_clks);
+/**
+ * fclkcfg_show_remove_enable()
+ * fclkcfg_set_remove_enable()
+ */
+DEF_FCLKCFG_SHOW(remove_enable);
+DEF_FCLKCFG_SET (remove_enable);
+/**
+ * fclkcfg_show_remove_rate()
+ * fclkcfg_set_remove_rate()
+ */
+DEF_FCLKCFG_SHOW(remove_rate);
+DEF_FCLKCFG_SET (remove_rate);
+/**
+ * fclkcfg_show_remove_resource()
+ * fclkcfg_set_remove_resource()
+ */
+DEF_FCLKCFG_SHOW(remove_resource);
+DEF_FCLKCFG_SET (remove_resource);
+/**
+ * fclkcfg_show_program_enable()
+ * fclkcfg_set_program_enable()
+ */
+DEF_FCLKCFG_SHOW(program_enable);
+DEF_FCLKCFG_SET (program_enable);
+/**
+ * fclkcfg_show_program_rate()
+ * fclkcfg_set_program_rate()
+ */
+DEF_FCLKCFG_SHOW(program_rate);
+DEF_FCLKCFG_SET (program_rate);
+/**
+ * fclkcfg_show_program_resource()
+ * fclkcfg_set_program_resource()
+ */
+DEF_FCLKCFG_SHOW(program_resource);
+DEF_FCLKCFG_SET (program_resource);
+/**
+ * fclkcfg_show_reset_assert_delay_us()
+ * fclkcfg_set_reset_assert_delay_us()
+ */
+DEF_FCLKCFG_SHOW(reset_assert_delay_us);
+DEF_FCLKCFG_SET (reset_assert_delay_us);
+/**
+ * fclkcfg_show_reset_deassert_delay_us()
+ * fclkcfg_set_reset_deassert_delay_us()
+ */
+DEF_FCLKCFG_SHOW(reset_deassert_delay_us);
+DEF_FCLKCFG_SET (reset_deassert_delay_us);
+/**
+ * fclkcfg_show_enable_settle_us()
+ * fclkcfg_set_enable_settle_us()
+ */
+DEF_FCLKCFG_SHOW(enable_settle_us);
+DEF_FCLKCFG_SET (enable_settle_us);
+/**
+ * fclkcfg_show_resource_settle_us()
+ * fclkcfg_set_resource_settle_us()
+ */
+DEF_FCLKCFG_SHOW(resource_settle_us);
+DEF_FCLKCFG_SET (resource_settle_us);
+/**
+ * fclkcfg_show_rate_settle_us()
+ * fclkcfg_set_rate_settle_us()
+ */
+DEF_FCLKCFG_SHOW(rate_settle_us);
+DEF_FCLKCFG_SET (rate_settle_us);
+/**
+ * fclkcfg_show_settle_stats()
+ * fclkcfg_set_settle_stats()
+ */
+DEF_FCLKCFG_SHOW(settle_stats);
+DEF_FCLKCFG_SET (settle_stats);
+/**
+ * fclkcfg_show_foreign_enable_count()
+ */
+DEF_FCLKCFG_SHOW(foreign_enable_count);
+/**
+ * fclkcfg_show_transition_stats()
+ * fclkcfg_set_transition_stats()
+ */
+DEF_FCLKCFG_SHOW(transition_stats);
+DEF_FCLKCFG_SET (transition_stats);
+/**
+ * fclkcfg_show_schedule()
+ * fclkcfg_set_schedule()
+ */
+DEF_FCLKCFG_SHOW(schedule);
+DEF_FCLKCFG_SET (schedule);
+/**
+ * fclkcfg_show_enforce()
+ * fclkcfg_set_enforce()
+ */
+DEF_FCLKCFG_SHOW(enforce);
+DEF_FCLKCFG_SET (enforce);
+/**
+ * fclkcfg_show_enforce_interval_ms()
+ * fclkcfg_set_enforce_interval_ms()
+ */
+DEF_FCLKCFG_SHOW(enforce_interval_ms);
+DEF_FCLKCFG_SET (enforce_interval_ms);
+/**
+ * fclkcfg_show_enforce_corrections()
+ */
+DEF_FCLKCFG_SHOW(enforce_corrections);
+/**
+ * fclkcfg_show_rate_tolerance_ppm()
+ * fclkcfg_set_rate_tolerance_ppm()
+ */
+DEF_FCLKCFG_SHOW(rate_tolerance_ppm);
+DEF_FCLKCFG_SET (rate_tolerance_ppm);
+/**
+ * fclkcfg_show_rate_tolerance_hz()
+ * fclkcfg_set_rate_tolerance_hz()
+ */
+DEF_FCLKCFG_SHOW(rate_tolerance_hz);
+DEF_FCLKCFG_SET (rate_tolerance_hz);
+/**
+ * fclkcfg_show_achieved_rate()
+ */
+DEF_FCLKCFG_SHOW(achieved_rate);
+/**
+ * fclkcfg_show_error_ppm()
+ */
+DEF_FCLKCFG_SHOW(error_ppm);
+/**
+ * fclkcfg_show_keep_prepared()
+ * fclkcfg_set_keep_prepared()
+ */
+DEF_FCLKCFG_SHOW(keep_prepared);
+DEF_FCLKCFG_SET (keep_prepared);
+/**
+ * fclkcfg_show_staged()
+ * fclkcfg_set_staged()
+ */
+DEF_FCLKCFG_SHOW(staged);
+DEF_FCLKCFG_SET (staged);
+/**
+ * fclkcfg_show_pending()
+ * fclkcfg_set_pending()
+ */
+DEF_FCLKCFG_SHOW(pending);
+DEF_FCLKCFG_SET (pending);
+/**
+ * fclkcfg_show_min_rate()
+ * fclkcfg_set_min_rate()
+ */
+DEF_FCLKCFG_SHOW(min_rate);
+DEF_FCLKCFG_SET (min_rate);
+/**
+ * fclkcfg_show_max_rate()
+ * fclkcfg_set_max_rate()
+ */
+DEF_FCLKCFG_SHOW(max_rate);
+DEF_FCLKCFG_SET (max_rate);
+/**
+ * fclkcfg_show_resource_rate()
+ */
+DEF_FCLKCFG_SHOW(resource_rate);
+/**
+ * fclkcfg_show_rate_ratio()
+ * fclkcfg_set_rate_ratio()
+ */
+DEF_FCLKCFG_SHOW(rate_ratio);
+DEF_FCLKCFG_SET (rate_ratio);
+/**
+ * fclkcfg_show_search()
+ * fclkcfg_set_search()
+ */
+DEF_FCLKCFG_SHOW(search);
+DEF_FCLKCFG_SET (search);
+/**
+ * fclkcfg_show_cpufreq()
+ */
+DEF_FCLKCFG_SHOW(cpufreq);
+/**
+ * fclkcfg_show_power_uw()
+ */
+DEF_FCLKCFG_SHOW(power_uw);
+/**
+ * fclkcfg_show_energy_uj()
+ * fclkcfg_set_energy_uj()
+ */
+DEF_FCLKCFG_SHOW(energy_uj);
+DEF_FCLKCFG_SET (energy_uj);
+
+static struct device_attribute fclkcfg_device_attrs[] = {
+  __ATTR(driver_version , 0444, fclkcfg_show_driver_version , NULL                       ),
+  __ATTR(enable         , 0664, fclkcfg_show_enable         , fclkcfg_set_enable         ),
+  __ATTR(rate           , 0664, fclkcfg_show_rate           , fclkcfg_set_rate           ),
+  __ATTR(round_rate     , 0664, fclkcfg_show_round_rate     , fclkcfg_set_round_rate     ),
+  __ATTR(resource       , 0664, fclkcfg_show_resource       , fclkcfg_set_resource       ),
+  __ATTR(resource_clks  , 0444, fclkcfg_show_resource_clks  , NULL                       ),
+  __ATTR(state          , 0664, fclkcfg_show_state          , fclkcfg_set_state          ),
+  __ATTR(remove_enable  , 0664, fclkcfg_show_remove_enable  , fclkcfg_set_remove_enable  ),
+  __ATTR(remove_rate    , 0664, fclkcfg_show_remove_rate    , fclkcfg_set_remove_rate    ),
+  __ATTR(remove_resource, 0664, fclkcfg_show_remove_resource, fclkcfg_set_remove_resource),
+  __ATTR(reset_assert_delay_us  , 0664, fclkcfg_show_reset_assert_delay_us  , fclkcfg_set_reset_assert_delay_us  ),
+  __ATTR(reset_deassert_delay_us, 0664, fclkcfg_show_reset_deassert_delay_us, fclkcfg_set_reset_deassert_delay_us),
+  __ATTR(enable_settle_us       , 0664, fclkcfg_show_enable_settle_us       , fclkcfg_set_enable_settle_us       ),
+  __ATTR(resource_settle_us     , 0664, fclkcfg_show_resource_settle_us     , fclkcfg_set_resource_settle_us     ),
+  __ATTR(rate_settle_us         , 0664, fclkcfg_show_rate_settle_us         , fclkcfg_set_rate_settle_us         ),
+  __ATTR(settle_stats           , 0664, fclkcfg_show_settle_stats           , fclkcfg_set_settle_stats           ),
+  __ATTR(program_enable         , 0664, fclkcfg_show_program_enable         , fclkcfg_set_program_enable         ),
+  __ATTR(program_rate           , 0664, fclkcfg_show_program_rate           , fclkcfg_set_program_rate           ),
+  __ATTR(program_resource       , 0664, fclkcfg_show_program_resource       , fclkcfg_set_program_resource       ),
+  __ATTR(schedule               , 0664, fclkcfg_show_schedule               , fclkcfg_set_schedule               ),
+  __ATTR(enforce                , 0664, fclkcfg_show_enforce                , fclkcfg_set_enforce                ),
+  __ATTR(enforce_interval_ms    , 0664, fclkcfg_show_enforce_interval_ms    , fclkcfg_set_enforce_interval_ms    ),
+  __ATTR(enforce_corrections    , 0444, fclkcfg_show_enforce_corrections    , NULL                               ),
+  __ATTR(rate_tolerance_ppm     , 0664, fclkcfg_show_rate_tolerance_ppm     , fclkcfg_set_rate_tolerance_ppm     ),
+  __ATTR(rate_tolerance_hz      , 0664, fclkcfg_show_rate_tolerance_hz      , fclkcfg_set_rate_tolerance_hz      ),
+  __ATTR(achieved_rate          , 0444, fclkcfg_show_achieved_rate          , NULL                               ),
+  __ATTR(error_ppm              , 0444, fclkcfg_show_error_ppm              , NULL                               ),
+  __ATTR(transition_stats       , 0664, fclkcfg_show_transition_stats       , fclkcfg_set_transition_stats       ),
+  __ATTR(foreign_enable_count   , 0444, fclkcfg_show_foreign_enable_count   , NULL                               ),
+  __ATTR(keep_prepared          , 0664, fclkcfg_show_keep_prepared          , fclkcfg_set_keep_prepared          ),
+  __ATTR(staged                 , 0664, fclkcfg_show_staged                 , fclkcfg_set_staged                 ),
+  __ATTR(pending                , 0664, fclkcfg_show_pending                , fclkcfg_set_pending                ),
+  __ATTR(min_rate               , 0664, fclkcfg_show_min_rate               , fclkcfg_set_min_rate               ),
+  __ATTR(max_rate               , 0664, fclkcfg_show_max_rate               , fclkcfg_set_max_rate               ),
+  __ATTR(resource_rate          , 0444, fclkcfg_show_resource_rate          , NULL                               ),
+  __ATTR(rate_ratio             , 0664, fclkcfg_show_rate_ratio             , fclkcfg_set_rate_ratio             ),
+  __ATTR(search                 , 0664, fclkcfg_show_search                 , fclkcfg_set_search                 ),
+  __ATTR(cpufreq                , 0444, fclkcfg_show_cpufreq                , NULL                               ),
+  __ATTR(power_uw               , 0444, fclkcfg_show_power_uw               , NULL                               ),
+  __ATTR(energy_uj              , 0664, fclkcfg_show_energy_uj              , fclkcfg_set_energy_uj              ),
+  __ATTR_NULL,
+};
+
+#if (USE_DEV_GROUPS == 1)
+static struct attribute *fclkcfg_attrs[] = {
+  &(fclkcfg_device_attrs[ 0].attr),
+  &(fclkcfg_device_attrs[ 1].attr),
+  &(fclkcfg_device_attrs[ 2].attr),
+  &(fclkcfg_device_attrs[ 3].attr),
+  &(fclkcfg_device_attrs[ 4].attr),
+  &(fclkcfg_device_attrs[ 5].attr),
+  &(fclkcfg_device_attrs[ 6].attr),
+  &(fclkcfg_device_attrs[ 7].attr),
+  &(fclkcfg_device_attrs[ 8].attr),
+  &(fclkcfg_device_attrs[ 9].attr),
+  &(fclkcfg_device_attrs[10].attr),
+  &(fclkcfg_device_attrs[11].attr),
+  &(fclkcfg_device_attrs[12].attr),
+  &(fclkcfg_device_attrs[13].attr),
+  &(fclkcfg_device_attrs[14].attr),
+  &(fclkcfg_device_attrs[15].attr),
+  &(fclkcfg_device_attrs[16].attr),
+  &(fclkcfg_device_attrs[17].attr),
+  &(fclkcfg_device_attrs[18].attr),
+  &(fclkcfg_device_attrs[19].attr),
+  &(fclkcfg_device_attrs[20].attr),
+  &(fclkcfg_device_attrs[21].attr),
+  &(fclkcfg_device_attrs[22].attr),
+  &(fclkcfg_device_attrs[23].attr),
+  &(fclkcfg_device_attrs[24].attr),
+  &(fclkcfg_device_attrs[25].attr),
+  &(fclkcfg_device_attrs[26].attr),
+  &(fclkcfg_device_attrs[27].attr),
+  &(fclkcfg_device_attrs[28].attr),
+  &(fclkcfg_device_attrs[29].attr),
+  &(fclkcfg_device_attrs[30].attr),
+  &(fclkcfg_device_attrs[31].attr),
+  &(fclkcfg_device_attrs[32].attr),
+  &(fclkcfg_device_attrs[33].attr),
+  &(fclkcfg_device_attrs[34].attr),
+  &(fclkcfg_device_attrs[35].attr),
+  &(fclkcfg_device_attrs[36].attr),
+  &(fclkcfg_device_attrs[37].attr),
+  &(fclkcfg_device_attrs[38].attr),
+  &(fclkcfg_device_attrs[39].attr),
+  NULL
+};
+static struct attribute_group  fclkcfg_attr_group = {
+  .attrs = fclkcfg_attrs
+};
+static const struct attribute_group* fclkcfg_attr_groups[] = {
+  &fclkcfg_attr_group,
+  NULL
+};
+#define SET_SYS_CLASS_ATTRIBUTES(sys_class) {(sys_class)->dev_groups = fclkcfg_attr_groups; }
+#else
+#define SET_SYS_CLASS_ATTRIBUTES(sys_class) {(sys_class)->dev_attrs  = fclkcfg_device_attrs;}
+#endif
+
+/**
+ * DEF_FCLKCFG_TARGET_SHOW() - generate fclkcfg_show_target_ ## __attr_name() macro
+ */
+#define DEF_FCLKCFG_TARGET_SHOW(__attr_name)                      \
+static ssize_t fclkcfg_show_target_ ## __attr_name(               \
+    struct device* dev,                                           \
+    struct device_attribute *attr,                                \
+    char *buf)                                                    \
+{                                                                 \
+    struct fclk_device_data* this = dev_get_drvdata(dev);         \
+    if (!this)                                                    \
+        return -ENODEV;                                           \
+    return fclk_show_target_ ## __attr_name(this, fclkcfg_target_index(this, attr), buf); \
+}
+
+/**
+ * DEF_FCLKCFG_TARGET_SET()  - generate fclkcfg_set_target_ ## __attr_name() macro
+ */
+#define DEF_FCLKCFG_TARGET_SET(__attr_name)                       \
+static ssize_t fclkcfg_set_target_ ## __attr_name(                \
+    struct device* dev,                                           \
+    struct device_attribute *attr,                                \
+    const char *buf,                                              \
+    size_t size)                                                  \
+{                                                                 \
+    struct fclk_device_data* this = dev_get_drvdata(dev);         \
+    if (!this)                                                    \
+        return -ENODEV;                                           \
+    return fclk_set_target_ ## __attr_name(this, fclkcfg_target_index(this, attr), buf, size); \
+}
+
+/**
+ * fclkcfg_target_index() - index of the target of target<N> attribute.
+ */
+static int fclkcfg_target_index(struct fclk_device_data* this, struct device_attribute *attr)
+{
+    struct fclk_target* target = container_of(attr, struct dev_ext_attribute, attr)->var;
+    return (target == &this->target) ? 0 : (int)(target - this->group_targets) + 1;
+}
+
+/**
+ * fclkcfg_show_target_enable()
+ * fclkcfg_set_target_enable()
+ */
+DEF_FCLKCFG_TARGET_SHOW(enable);
+DEF_FCLKCFG_TARGET_SET (enable);
+/**
+ * fclkcfg_show_target_rate()
+ * fclkcfg_set_target_rate()
+ */
+DEF_FCLKCFG_TARGET_SHOW(rate);
+DEF_FCLKCFG_TARGET_SET (rate);
+/**
+ * fclkcfg_show_target_resource()
+ * fclkcfg_set_target_resource()
+ */
+DEF_FCLKCFG_TARGET_SHOW(resource);
+DEF_FCLKCFG_TARGET_SET (resource);
+/**
+ * fclkcfg_show_target_foreign_enable_count()
+ */
+DEF_FCLKCFG_TARGET_SHOW(foreign_enable_count);
+
+/**
+ * fclkcfg_target_attr_init() - initialize target<N> attribute.
+ */
+static void fclkcfg_target_attr_init(
+    struct dev_ext_attribute* ext_attr,
+    const char*               name,
+    ssize_t (*show)(struct device*, struct device_attribute*, char*),
+    ssize_t (*store)(struct device*, struct device_attribute*, const char*, size_t),
+    struct fclk_target*       target)
+{
+    sysfs_attr_init(&ext_attr->attr.attr);
+    ext_attr->attr.attr.name = name;
+    ext_attr->attr.attr.mode = (store != NULL) ? 0664 : 0444;
+    ext_attr->attr.show      = show;
+    ext_attr->attr.store     = store;
+    ext_attr->var            = target;
+}
+
+/**
+ * fclkcfg_device_prepare_target_groups() - Prepare target<N> attribute groups.
+ *
+ * @this:       Pointer to the fclk device data.
+ * @dev:        handle to the device structure or NULL.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The group targets are allocated here from the "target<N>" clock names, so
+ * that their attribute groups can be passed to device_create_with_groups()
+ * and exist when the device is announced to user space.
+ */
+static int fclkcfg_device_prepare_target_groups(struct fclk_device_data* this, struct device *dev)
+{
+    int targets_size;
+    int i;
+
+    if ((dev == NULL) || (dev->of_node == NULL) || (this->target.clk != NULL))
+        return 0;
+
+    targets_size = fclk_device_count_clock_names(dev, "target");
+    if (targets_size <= 1)
+        return 0;
+
+    this->group_targets = kcalloc(targets_size-1, sizeof(struct fclk_target), GFP_KERNEL);
+    if (this->group_targets == NULL)
+        return -ENOMEM;
+    this->target_groups = kcalloc(targets_size+1, sizeof(struct attribute_group*), GFP_KERNEL);
+    if (this->target_groups == NULL)
+        return -ENOMEM;
+
+    for (i = 0; i < targets_size; i++) {
+        struct fclk_target* target = (i == 0) ? &this->target : &this->group_targets[i-1];
+        snprintf(target->name, sizeof(target->name), "target%d", i);
+        fclkcfg_target_attr_init(&target->enable_attr  , "enable"  , fclkcfg_show_target_enable  , fclkcfg_set_target_enable  , target);
+        fclkcfg_target_attr_init(&target->rate_attr    , "rate"    , fclkcfg_show_target_rate    , fclkcfg_set_target_rate    , target);
+        fclkcfg_target_attr_init(&target->resource_attr, "resource", fclkcfg_show_target_resource, fclkcfg_set_target_resource, target);
+        fclkcfg_target_attr_init(&target->foreign_enable_count_attr, "foreign_enable_count",
+                                 fclkcfg_show_target_foreign_enable_count, NULL, target);
+        target->attrs[0]          = &target->enable_attr.attr.attr;
+        target->attrs[1]          = &target->rate_attr.attr.attr;
+        target->attrs[2]          = &target->resource_attr.attr.attr;
+        target->attrs[3]          = &target->foreign_enable_count_attr.attr.attr;
+        target->attrs[4]          = NULL;
+        target->attr_group.name   = target->name;
+        target->attr_group.attrs  = target->attrs;
+        this->target_groups[i]    = &target->attr_group;
+    }
+    this->target_groups[targets_size] = NULL;
+    return 0;
+}
+
+/**
+ * fclkcfg_device_release() - Release the fclkcfg device.
+ *
+ * @dev:        handle to the device structure.
+ *
+ * Replaces the release of device_create(), which only frees @dev, and puts
+ * the reference of the fclk device data held by the device.
+ */
+static void fclkcfg_device_release(struct device *dev)
+{
+    struct fclk_device_data* this = dev_get_drvdata(dev);
+
+    kfree(dev);
+    fclk_device_put(this);
+}
+
+/**
+ * fclkcfg_device_destroy() - Destroy the fclkcfg device.
+ *
+ * @this:       Pointer to the fclk device data.
+ * Return:      Success(=0) or error status(<0).
+ *
+ */
+static int fclkcfg_device_destroy(struct fclk_device_data* this)
+{
+    struct device* device;
+    unsigned long  flags;
+    int            retval;
+
+    if (!this)
+        return -ENODEV;
+
+    mutex_lock(&this->lock);
+    spin_lock_irqsave(&this->atomic_lock, flags);
+    this->removed = true;
+    spin_unlock_irqrestore(&this->atomic_lock, flags);
+    mutex_unlock(&this->lock);
+
+    /*
+     * remove the device files first, so that no writer runs during the
+     * clean up. The device is kept until the clean up has finished.
+     */
+    device = this->device;
+    if (device) {
+        get_device(device);
+        device_destroy(fclkcfg_sys_class, this->device_number);
+    }
+    retval = fclk_device_cleanup(this);
+    if (device) {
+        this->device = NULL;
+        put_device(device);
+    }
+    fclkcfg_ratio_update();
+    if (retval)
+        return retval;
+
+    if (this->target_groups != NULL) {
+        kfree(this->target_groups);
+        this->target_groups = NULL;
+        kfree(this->group_targets);
+        this->group_targets = NULL;
+    }
+    if (this->device_number) {
+        ida_simple_remove(&fclkcfg_device_ida, MINOR(this->device_number));
+        this->device_number = 0;
+    }
+    fclk_device_put(this);
+    return 0;
+}
+
+/**
+ * fclkcfg_device_create() -  Create fclkcfg device.
+ *
+ * @dev:         handle to the device structure or NULL.
+ * @device_name: device name or NULL.
+ * @this:        Pointer to the fclk device data prepared by caller or NULL.
+ * Return:       Pointer to the fclk device data or NULL.
+ *
+ * When @this is NULL, the fclk device data is allocated here and all clocks
+ * and properties are taken from the device tree node of @dev. Otherwise the
+ * clocks and states already set in @this are used, and @this is destroyed
+ * on failure. When @device_name is NULL, the "device-name" property or the
+ * name of @dev is used.
+ */
+static struct fclk_device_data* fclkcfg_device_create(struct device *dev, const char* device_name, struct fclk_device_data* this)
+{
+    int                      retval = 0;
+
+    DEV_DBG(dev, "driver probe start.\n");
+    /*
+     * create (fclk_device_data*) this.
+     */
+    if (this == NULL) {
+        this = kzalloc(sizeof(*this), GFP_KERNEL);
+        if (IS_ERR_OR_NULL(this)) {
+            retval = PTR_ERR(this);
+            this   = NULL;
+            goto failed;
+        }
+        this->device        = NULL;
+        this->target.clk    = NULL;
+        this->device_number = 0;
+        fclk_device_init(this);
+    }
+    /*
+     * get device number
+     */
+    DEV_DBG(dev, "get device_number start.\n");
+    {
+        int minor_number = ida_simple_get(&fclkcfg_device_ida, 0, MINORMASK + 1, GFP_KERNEL);
+        if (minor_number < 0) {
+            dev_err(dev, "invalid or conflict minor number %d.\n", minor_number);
+            retval = -ENODEV;
+            goto failed;
+        }
+        this->device_number = MKDEV(MAJOR(fclkcfg_device_number), minor_number);
+    }
+    DEV_DBG(dev, "get device_number done.\n");
+
+    /*
+     * get device name
+     */
+    DEV_DBG(dev, "get device name start.\n");
+    if ((device_name == NULL) && (dev != NULL)) {
+        device_name = of_get_property(dev->of_node, "device-name", NULL);
+        
+        if (IS_ERR_OR_NULL(device_name)) {
+            device_name = dev_name(dev);
+        }
+    }
+    if (device_name == NULL) {
+        retval = -EINVAL;
+        goto failed;
+    }
+    DEV_DBG(dev, "get device name done.\n");
+
+    /*
+     * prepare target<N> attribute groups
+     */
+    {
+        retval = fclkcfg_device_prepare_target_groups(this, dev);
+        if (retval)
+            goto failed;
+    }
+
+    /*
+     * create device
+     */
+    DEV_DBG(dev, "device_create start.\n");
+    {
+        this->device = device_create_with_groups(fclkcfg_sys_class,
+                                                 NULL,
+                                                 this->device_number,
+                                                 (void *)this,
+                                                 this->target_groups,
+                                                 device_name);
+        if (IS_ERR_OR_NULL(this->device)) {
+            dev_err(dev, "device create falied.\n");
+            retval = (this->device == NULL) ? -ENODEV : PTR_ERR(this->device);
+            this->device = NULL;
+            goto failed;
+        }
+        fclk_device_get(this);
+        this->device->release = fclkcfg_device_release;
+    }
+    DEV_DBG(dev, "device_create done\n");
+
+    /*
+     * set up fclk device data
+     */
+    {
+        mutex_lock(&this->lock);
+        retval = fclk_device_setup(this, (dev != NULL) ? dev : this->device);
+        mutex_unlock(&this->lock);
+        if (retval)
+            goto failed;
+    }
+    fclkcfg_ratio_update();
+    return this;
+
+ failed:
+    fclkcfg_device_destroy(this);
+    return ERR_PTR(retval);
+}
+
+/**
+ * DOC: fclkcfg Platform Driver
+ *
+ * This section defines the fclkcfg platform driver.
+ *
+ * * fclkcfg_platform_driver_probe()   - Probe call for the device.
+ * * fclkcfg_platform_driver_remove()  - Remove call for the device.
+ * * fclkcfg_of_match                  - Open Firmware Device Identifier Matching Table.
+ * * fclkcfg_platform_driver           - Platform Driver Structure.
+ * * fclkcfg_platform_driver_done
+ */
+
+/**
+ * fclkcfg_platform_driver_probe() -  Probe call for the device.
+ *
+ * @pdev:	handle to the platform device structure.
+ * Returns 0 on success, negative error otherwise.
+ *
+ * It does all the memory allocation and registration for the device.
+ */
+static int fclkcfg_platform_driver_probe(struct platform_device *pdev)
+{
+    int                      retval = 0;
+    struct fclk_device_data* data;
+
+    data = fclkcfg_device_create(&pdev->dev, NULL, NULL);
+    if (IS_ERR_OR_NULL(data)) {
+        retval = PTR_ERR(data);
+        dev_err(&pdev->dev, "driver create failed. return=%d.\n", retval);
+        retval = (retval == 0) ? -EINVAL : retval;
+        goto failed;
+    }
+
+    platform_set_drvdata(pdev, data);
+
+    if (info_enable >= 2)
+        fclk_device_info(data, pdev);
+    if (info_enable >= 1)
+        fclk_device_info_summary(data, pdev, "driver installed.");
+    else
+        dev_info(&pdev->dev, "driver installed.\n");
+    return 0;
+
+ failed:
+    dev_info(&pdev->dev, "driver install failed.\n");
+    return retval;
+}
+
+/**
+ * _fclkcfg_platform_driver_remove() -  Remove call for the device.
+ *
+ * @pdev:	handle to the platform device structure.
+ * Returns 0 or error status.
+ *
+ * Unregister the device after releasing the resources.
+ */
+static inline int _fclkcfg_platform_driver_remove(struct platform_device *pdev)
+{
+    struct fclk_device_data* this = dev_get_drvdata(&pdev->dev);
+
+    if (!this)
+        return -ENODEV;
+
+    if (this->target.clk) {
+        __fclk_schedule_cancel(this);
+        __fclk_enforce_stop(this);
+        __fclk_search_stop(this);
+        __fclk_cpufreq_stop(this);
+        mutex_lock(&this->lock);
+        __fclk_change_all_state(this, &this->remove);
+        mutex_unlock(&this->lock);
+    }
+
+    fclkcfg_device_destroy(this);
+    platform_set_drvdata(pdev, NULL);
+    dev_info(&pdev->dev, "driver removed.\n");
+    return 0;
+}
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 11, 0)
+/**
+ * fclkcfg_platform_driver_remove() -  Remove call for the device.
+ *
+ * @pdev:	handle to the platform device structure.
+ * Returns 0 or error status.
+ *
+ * Unregister the device after releasing the resources.
+ */
+static int fclkcfg_platform_driver_remove(struct platform_device *pdev)
+{
+    return _fclkcfg_platform_driver_remove(pdev);
+}
+#else
+/**
+ * fclkcfg_platform_driver_remove() -  Remove call for the device.
+ *
+ * @pdev:	handle to the platform device structure.
+ * Returns      void
+ *
+ * Unregister the device after releasing the resources.
+ */
+static void fclkcfg_platform_driver_remove(struct platform_device *pdev)
+{
+    _fclkcfg_platform_driver_remove(pdev);
+}
+#endif
+
+/**
+ * Open Firmware Device Identifier Matching Table
+ */
+static struct of_device_id fclkcfg_of_match[] = {
+    { .compatible = "ikwzm,fclkcfg-0.10.a", },
+    { .compatible = "ikwzm,fclkcfg"       , },
+    { /* end of table */}
+};
+MODULE_DEVICE_TABLE(of, fclkcfg_of_match);
+
+/**
+ * Platform Driver Structure
+ */
+static struct platform_driver fclkcfg_platform_driver = {
+    .probe  = fclkcfg_platform_driver_probe,
+    .remove = fclkcfg_platform_driver_remove,
+    .driver = {
+        .owner = THIS_MODULE,
+        .name  = DRIVER_NAME,
+        .of_match_table = fclkcfg_of_match,
+#if (USE_ASYNC_PROBE == 1)
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+#endif
+    },
+};
+static bool fclkcfg_platform_driver_done = 0;
 
+#if (USE_CONFIGFS == 1)
 /**
- * DEF_FCLKCFG_SHOW() - generate fclkcfg_show_ ## __attr_name() macro
+ * DOC: fclkcfg configfs operations
+ *
+ * This section defines the configfs interface that creates fclkcfg devices
+ * without a device tree node.
+ *
+ * * /sys/kernel/config/fclkcfg/<item-name>/device_name
+ * * /sys/kernel/config/fclkcfg/<item-name>/clock
+ * * /sys/kernel/config/fclkcfg/<item-name>/resource_clks
+ * * /sys/kernel/config/fclkcfg/<item-name>/insert_state
+ * * /sys/kernel/config/fclkcfg/<item-name>/remove_state
+ * * /sys/kernel/config/fclkcfg/<item-name>/enable
+ *
+ * * struct fclkcfg_config_item    - fclkcfg configfs item structure.
+ * * fclkcfg_config_get_clk()      - get clock by name or by phandle and index.
+ * * fclkcfg_config_enable()       - create fclkcfg device from configfs item.
+ * * fclkcfg_config_disable()      - remove fclkcfg device created from configfs item.
+ * * fclkcfg_configfs_subsys       - fclkcfg configfs subsystem.
  */
-#define DEF_FCLKCFG_SHOW(__attr_name)        \
-static ssize_t fclkcfg_show_ ## __attr_name( \
-    struct device* dev,                      \
-    struct device_attribute *attr,           \
-    char *buf)                               \
-{   return fclk_show_ ## __attr_name(dev_get_drvdata(dev), attr, buf);}
 
 /**
- * DEF_FCLKCFG_SET()  - generate fclkcfg_set_ ## __attr_name() macro
+ * struct fclkcfg_config_item - fclkcfg configfs item structure.
  */
-#define DEF_FCLKCFG_SET(__attr_name)        \
-static ssize_t fclkcfg_set_ ## __attr_name( \
-    struct device* dev,                     \
-    struct device_attribute *attr,          \
-    const char *buf,                        \
-    size_t size)                            \
-{   return fclk_set_ ## __attr_name(dev_get_drvdata(dev), attr, buf, size);}
+struct fclkcfg_config_item {
+    struct config_item       item;
+    struct mutex             lock;
+    char*                    device_name;
+    char*                    clock;
+    char*                    resource_clks;
+    struct fclk_state        insert;
+    struct fclk_state        remove;
+    struct fclk_device_data* data;
+};
+
+static inline struct fclkcfg_config_item* to_fclkcfg_config_item(struct config_item* item)
+{
+    return container_of(item, struct fclkcfg_config_item, item);
+}
 
 /**
- * fclkcfg_show_driver_version()
+ * fclkcfg_config_get_clk() - get clock by name or by phandle and index.
+ *
+ * @spec:       "<clock-name>" or "<phandle> <index>".
+ * Return:      Pointer to the clock or error pointer.
  */
-DEF_FCLKCFG_SHOW(driver_version);
+static struct clk* fclkcfg_config_get_clk(const char* spec)
+{
+    unsigned int phandle;
+    unsigned int index;
+    char         tail;
+
+    if (sscanf(spec, "%u %u %c", &phandle, &index, &tail) == 2) {
+        struct of_phandle_args args;
+        struct clk*            clk;
+        args.np = of_find_node_by_phandle(phandle);
+        if (args.np == NULL)
+            return ERR_PTR(-ENOENT);
+        args.args_count = 1;
+        args.args[0]    = index;
+        clk = of_clk_get_from_provider(&args);
+        of_node_put(args.np);
+        return clk;
+    }
+    return clk_get(NULL, spec);
+}
+
 /**
- * fclkcfg_show_enable()
- * fclkcfg_set_enable()
+ * fclkcfg_config_enable() - create fclkcfg device from configfs item.
+ *
+ * @config:     Pointer to the fclkcfg configfs item.
+ * Return:      Success(=0) or error status(<0).
  */
-DEF_FCLKCFG_SHOW(enable);
-DEF_FCLKCFG_SET (enable);
+static int fclkcfg_config_enable(struct fclkcfg_config_item* config)
+{
+    struct fclk_device_data* this;
+    struct fclk_device_data* data;
+    const char*              device_name;
+
+    if (config->clock == NULL)
+        return -EINVAL;
+
+    this = kzalloc(sizeof(*this), GFP_KERNEL);
+    if (this == NULL)
+        return -ENOMEM;
+    fclk_device_init(this);
+
+    this->target.clk = fclkcfg_config_get_clk(config->clock);
+    if (IS_ERR(this->target.clk)) {
+        int retval = PTR_ERR(this->target.clk);
+        pr_err("%s: %s: get clock(%s) failed(%d).\n", DRIVER_NAME, config_item_name(&config->item), config->clock, retval);
+        fclk_device_put(this);
+        return retval;
+    }
+    if (config->resource_clks != NULL) {
+        const char* ptr;
+        int         size = 1;
+        for (ptr = config->resource_clks; *ptr != '\0'; ptr++) {
+            if (*ptr == ',')
+                size++;
+        }
+        this->resource_clks = kcalloc(size, sizeof(struct clk*), GFP_KERNEL);
+        if (this->resource_clks == NULL) {
+            clk_put(this->target.clk);
+            fclk_device_put(this);
+            return -ENOMEM;
+        }
+        this->target.resource_clk_id = -1;   /* Uninitialized resclk flag */
+        {
+            char* str = kstrdup(config->resource_clks, GFP_KERNEL);
+            char* next = str;
+            char* spec;
+            int   retval = (str == NULL) ? -ENOMEM : 0;
+            while ((retval == 0) && ((spec = strsep(&next, ",")) != NULL)) {
+                struct clk* resource_clk = fclkcfg_config_get_clk(strim(spec));
+                if (IS_ERR(resource_clk)) {
+                    retval = PTR_ERR(resource_clk);
+                    pr_err("%s: %s: get resource clock(%s) failed(%d).\n", DRIVER_NAME, config_item_name(&config->item), spec, retval);
+                    break;
+                }
+                this->resource_clks[this->resource_clks_size++] = resource_clk;
+            }
+            kfree(str);
+            if (retval) {
+                fclk_device_cleanup(this);
+                fclk_device_put(this);
+                return retval;
+            }
+        }
+    }
+    this->insert = config->insert;
+    this->remove = config->remove;
+    if (this->resource_clks == NULL) {
+        this->insert.resclk_valid = false;
+        this->remove.resclk_valid = false;
+    } else if (((this->insert.resclk_valid == true) && (this->insert.resclk >= this->resource_clks_size)) ||
+               ((this->remove.resclk_valid == true) && (this->remove.resclk >= this->resource_clks_size))) {
+        fclk_device_cleanup(this);
+        fclk_device_put(this);
+        return -EINVAL;
+    }
+
+    device_name = (config->device_name != NULL) ? config->device_name : config_item_name(&config->item);
+    data = fclkcfg_device_create(NULL, device_name, this);
+    if (IS_ERR_OR_NULL(data)) {
+        int retval = PTR_ERR(data);
+        return (retval == 0) ? -EINVAL : retval;
+    }
+    if (info_enable >= 2)
+        fclk_device_info(data, NULL);
+    if (info_enable >= 1)
+        fclk_device_info_summary(data, NULL, "device created.");
+    config->data = data;
+    return 0;
+}
+
 /**
- * fclkcfg_show_rate()
- * fclkcfg_set_rate()
+ * fclkcfg_config_disable() - remove fclkcfg device created from configfs item.
+ *
+ * @config:     Pointer to the fclkcfg configfs item.
  */
-DEF_FCLKCFG_SHOW(rate);
-DEF_FCLKCFG_SET (rate);
+static void fclkcfg_config_disable(struct fclkcfg_config_item* config)
+{
+    struct fclk_device_data* this = config->data;
+
+    if (this == NULL)
+        return;
+
+    if (this->target.clk) {
+        __fclk_schedule_cancel(this);
+        __fclk_enforce_stop(this);
+        __fclk_search_stop(this);
+        __fclk_cpufreq_stop(this);
+        mutex_lock(&this->lock);
+        __fclk_change_all_state(this, &this->remove);
+        mutex_unlock(&this->lock);
+    }
+
+    fclkcfg_device_destroy(this);
+    config->data = NULL;
+}
+
 /**
- * fclkcfg_show_round_rate()
- * fclkcfg_set_round_rate()
+ * DEF_FCLKCFG_CONFIG_STRING() - generate fclkcfg_config_ ## name ## _show/store() macro
  */
-DEF_FCLKCFG_SHOW(round_rate);
-DEF_FCLKCFG_SET (round_rate);
+#define DEF_FCLKCFG_CONFIG_STRING(name)                                       \
+static ssize_t fclkcfg_config_ ## name ## _show(struct config_item* item, char* buf) \
+{                                                                             \
+    struct fclkcfg_config_item* config = to_fclkcfg_config_item(item);       \
+    ssize_t                     size;                                         \
+    mutex_lock(&config->lock);                                                \
+    size = sprintf(buf, "%s\n", (config->name) ? config->name : "");          \
+    mutex_unlock(&config->lock);                                              \
+    return size;                                                              \
+}                                                                             \
+static ssize_t fclkcfg_config_ ## name ## _store(struct config_item* item, const char* buf, size_t size) \
+{                                                                             \
+    struct fclkcfg_config_item* config = to_fclkcfg_config_item(item);       \
+    char*                       str    = kstrndup(buf, size, GFP_KERNEL);     \
+    char*                       value  = NULL;                                \
+    if (str == NULL)                                                          \
+        return -ENOMEM;                                                       \
+    if (*strim(str) != '\0') {                                                \
+        value = kstrdup(strim(str), GFP_KERNEL);                              \
+        if (value == NULL) {                                                  \
+            kfree(str);                                                       \
+            return -ENOMEM;                                                   \
+        }                                                                     \
+    }                                                                         \
+    kfree(str);                                                               \
+    mutex_lock(&config->lock);                                                \
+    if (config->data != NULL) {                                               \
+        mutex_unlock(&config->lock);                                          \
+        kfree(value);                                                         \
+        return -EBUSY;                                                        \
+    }                                                                         \
+    kfree(config->name);                                                      \
+    config->name = value;                                                     \
+    mutex_unlock(&config->lock);                                              \
+    return size;                                                              \
+}                                                                             \
+CONFIGFS_ATTR(fclkcfg_config_, name)
+
 /**
- * fclkcfg_show_resource()
- * fclkcfg_set_resource()
+ * DEF_FCLKCFG_CONFIG_STATE()  - generate fclkcfg_config_ ## state ## _state_show/store() macro
  */
-DEF_FCLKCFG_SHOW(resource);
-DEF_FCLKCFG_SET (resource);
+#define DEF_FCLKCFG_CONFIG_STATE(state)                                       \
+static ssize_t fclkcfg_config_ ## state ## _state_show(struct config_item* item, char* buf) \
+{                                                                             \
+    struct fclkcfg_config_item* config = to_fclkcfg_config_item(item);       \
+    ssize_t                     size   = 0;                                   \
+    mutex_lock(&config->lock);                                                \
+    if (config->state.rate_valid  ) size += sprintf(buf+size, "rate=%lu "    , config->state.rate  ); \
+    if (config->state.enable_valid) size += sprintf(buf+size, "enable=%d "   , config->state.enable); \
+    if (config->state.resclk_valid) size += sprintf(buf+size, "resource=%lu ", config->state.resclk); \
+    size += sprintf(buf+size, "\n");                                          \
+    mutex_unlock(&config->lock);                                              \
+    return size;                                                              \
+}                                                                             \
+static ssize_t fclkcfg_config_ ## state ## _state_store(struct config_item* item, const char* buf, size_t size) \
+{                                                                             \
+    struct fclkcfg_config_item* config = to_fclkcfg_config_item(item);       \
+    struct fclk_state           next_state;                                   \
+    int                         retval;                                       \
+    if (0 != (retval = parse_fclk_state(buf, &next_state)))                   \
+        return retval;                                                        \
+    mutex_lock(&config->lock);                                                \
+    if (config->data != NULL) {                                               \
+        mutex_unlock(&config->lock);                                          \
+        return -EBUSY;                                                        \
+    }                                                                         \
+    config->state = next_state;                                               \
+    mutex_unlock(&config->lock);                                              \
+    return size;                                                              \
+}                                                                             \
+CONFIGFS_ATTR(fclkcfg_config_, state ## _state)
+
 /**
- * fclkcfg_show_resource_clks()
+ * fclkcfg_config_device_name_show()
+ * fclkcfg_config_device_name_store()
+ * fclkcfg_config_clock_show()
+ * fclkcfg_config_clock_store()
+ * fclkcfg_config_resource_clks_show()
+ * fclkcfg_config_resource_clks_store()
+ * fclkcfg_config_insert_state_show()
+ * fclkcfg_config_insert_state_store()
+ * fclkcfg_config_remove_state_show()
+ * fclkcfg_config_remove_state_store()
  */
-DEF_FCLKCFG_SHOW(resource_clks);
+DEF_FCLKCFG_CONFIG_STRING(device_name);
+DEF_FCLKCFG_CONFIG_STRING(clock);
+DEF_FCLKCFG_CONFIG_STRING(resource_clks);
+DEF_FCLKCFG_CONFIG_STATE (insert);
+DEF_FCLKCFG_CONFIG_STATE (remove);
+
 /**
- * fclkcfg_show_remove_enable()
- * fclkcfg_set_remove_enable()
+ * fclkcfg_config_enable_show()
  */
-DEF_FCLKCFG_SHOW(remove_enable);
-DEF_FCLKCFG_SET (remove_enable);
+static ssize_t fclkcfg_config_enable_show(struct config_item* item, char* buf)
+{
+    struct fclkcfg_config_item* config = to_fclkcfg_config_item(item);
+    ssize_t                     size;
+
+    mutex_lock(&config->lock);
+    size = sprintf(buf, "%d\n", (config->data != NULL) ? 1 : 0);
+    mutex_unlock(&config->lock);
+    return size;
+}
+
 /**
- * fclkcfg_show_remove_rate()
- * fclkcfg_set_remove_rate()
+ * fclkcfg_config_enable_store()
  */
-DEF_FCLKCFG_SHOW(remove_rate);
-DEF_FCLKCFG_SET (remove_rate);
+static ssize_t fclkcfg_config_enable_store(struct config_item* item, const char* buf, size_t size)
+{
+    struct fclkcfg_config_item* config = to_fclkcfg_config_item(item);
+    bool                        enable;
+    int                         retval;
+
+    if (0 != (retval = kstrtobool(buf, &enable)))
+        return retval;
+
+    mutex_lock(&config->lock);
+    if ((enable == true) && (config->data == NULL))
+        retval = fclkcfg_config_enable(config);
+    if ((enable == false) && (config->data != NULL))
+        fclkcfg_config_disable(config);
+    mutex_unlock(&config->lock);
+
+    return (retval) ? retval : size;
+}
+CONFIGFS_ATTR(fclkcfg_config_, enable);
+
+static struct configfs_attribute* fclkcfg_config_attrs[] = {
+    &fclkcfg_config_attr_device_name,
+    &fclkcfg_config_attr_clock,
+    &fclkcfg_config_attr_resource_clks,
+    &fclkcfg_config_attr_insert_state,
+    &fclkcfg_config_attr_remove_state,
+    &fclkcfg_config_attr_enable,
+    NULL,
+};
+
 /**
- * fclkcfg_show_remove_resource()
- * fclkcfg_set_remove_resource()
+ * fclkcfg_config_item_release()
  */
-DEF_FCLKCFG_SHOW(remove_resource);
-DEF_FCLKCFG_SET (remove_resource);
+static void fclkcfg_config_item_release(struct config_item* item)
+{
+    struct fclkcfg_config_item* config = to_fclkcfg_config_item(item);
 
-static struct device_attribute fclkcfg_device_attrs[] = {
-  __ATTR(driver_version , 0444, fclkcfg_show_driver_version , NULL                       ),
-  __ATTR(enable         , 0664, fclkcfg_show_enable         , fclkcfg_set_enable         ),
-  __ATTR(rate           , 0664, fclkcfg_show_rate           , fclkcfg_set_rate           ),
-  __ATTR(round_rate     , 0664, fclkcfg_show_round_rate     , fclkcfg_set_round_rate     ),
-  __ATTR(resource       , 0664, fclkcfg_show_resource       , fclkcfg_set_resource       ),
-  __ATTR(resource_clks  , 0444, fclkcfg_show_resource_clks  , NULL                       ),
-  __ATTR(remove_enable  , 0664, fclkcfg_show_remove_enable  , fclkcfg_set_remove_enable  ),
-  __ATTR(remove_rate    , 0664, fclkcfg_show_remove_rate    , fclkcfg_set_remove_rate    ),
-  __ATTR(remove_resource, 0664, fclkcfg_show_remove_resource, fclkcfg_set_remove_resource),
-  __ATTR_NULL,
+    kfree(config->device_name);
+    kfree(config->clock);
+    kfree(config->resource_clks);
+    mutex_destroy(&config->lock);
+    kfree(config);
+}
+
+static struct configfs_item_operations fclkcfg_config_item_ops = {
+    .release = fclkcfg_config_item_release,
 };
 
-#if (USE_DEV_GROUPS == 1)
-static struct attribute *fclkcfg_attrs[] = {
-  &(fclkcfg_device_attrs[ 0].attr),
-  &(fclkcfg_device_attrs[ 1].attr),
-  &(fclkcfg_device_attrs[ 2].attr),
-  &(fclkcfg_device_attrs[ 3].attr),
-  &(fclkcfg_device_attrs[ 4].attr),
-  &(fclkcfg_device_attrs[ 5].attr),
-  &(fclkcfg_device_attrs[ 6].attr),
-  &(fclkcfg_device_attrs[ 7].attr),
-  &(fclkcfg_device_attrs[ 8].attr),
-  NULL
+static const struct config_item_type fclkcfg_config_item_type = {
+    .ct_item_ops = &fclkcfg_config_item_ops,
+    .ct_attrs    = fclkcfg_config_attrs,
+    .ct_owner    = THIS_MODULE,
 };
-static struct attribute_group  fclkcfg_attr_group = {
-  .attrs = fclkcfg_attrs
+
+/**
+ * fclkcfg_config_make_item()
+ */
+static struct config_item* fclkcfg_config_make_item(struct config_group* group, const char* name)
+{
+    struct fclkcfg_config_item* config;
+
+    config = kzalloc(sizeof(*config), GFP_KERNEL);
+    if (config == NULL)
+        return ERR_PTR(-ENOMEM);
+
+    mutex_init(&config->lock);
+    fclk_state_clear(&config->insert);
+    fclk_state_clear(&config->remove);
+    config_item_init_type_name(&config->item, name, &fclkcfg_config_item_type);
+    return &config->item;
+}
+
+/**
+ * fclkcfg_config_drop_item()
+ */
+static void fclkcfg_config_drop_item(struct config_group* group, struct config_item* item)
+{
+    struct fclkcfg_config_item* config = to_fclkcfg_config_item(item);
+
+    mutex_lock(&config->lock);
+    fclkcfg_config_disable(config);
+    mutex_unlock(&config->lock);
+    config_item_put(item);
+}
+
+static struct configfs_group_operations fclkcfg_config_group_ops = {
+    .make_item = fclkcfg_config_make_item,
+    .drop_item = fclkcfg_config_drop_item,
 };
-static const struct attribute_group* fclkcfg_attr_groups[] = {
-  &fclkcfg_attr_group,
-  NULL
+
+static const struct config_item_type fclkcfg_config_group_type = {
+    .ct_group_ops = &fclkcfg_config_group_ops,
+    .ct_owner     = THIS_MODULE,
 };
-#define SET_SYS_CLASS_ATTRIBUTES(sys_class) {(sys_class)->dev_groups = fclkcfg_attr_groups; }
+
+/**
+ * fclkcfg configfs subsystem
+ */
+static struct configfs_subsystem fclkcfg_configfs_subsys = {
+    .su_group = {
+        .cg_item = {
+            .ci_namebuf = DRIVER_NAME,
+            .ci_type    = &fclkcfg_config_group_type,
+        },
+    },
+};
+static bool fclkcfg_configfs_done = 0;
+#endif
+
+/**
+ * DOC: fclkcfg clock manifest operations
+ *
+ * A clock manifest is a text file loaded by request_firmware(). Each line
+ * is "<device-name> rate=... enable=... resource=...", and text after '#'
+ * is a comment. Writing the file name to /sys/class/fclkcfg/manifest
+ * applies all lines as one transition: the devices whose rate or resource
+ * clock changes are stopped, all devices are changed, and then they are
+ * started.
+ *
+ * * struct fclkcfg_manifest_entry - one device of a clock manifest.
+ * * fclkcfg_manifest_match()  - match fclkcfg device by name.
+ * * fclkcfg_device_find()     - find fclkcfg device by name and get its data.
+ * * fclkcfg_manifest_change() - change states of manifest devices in three steps.
+ * * fclkcfg_manifest_apply()  - load and apply clock manifest.
+ * * fclkcfg_manifest_store()  - /sys/class/fclkcfg/manifest store operation.
+ */
+struct fclkcfg_manifest_entry {
+    struct fclk_device_data* data;
+    struct fclk_state        next;
+    struct fclk_state        prev;
+};
+
+/**
+ * fclkcfg_manifest_match() - match fclkcfg device by name.
+ */
+static int fclkcfg_manifest_match(struct device* dev, const void* name)
+{
+    return (strcmp(dev_name(dev), (const char*)name) == 0);
+}
+
+/**
+ * fclkcfg_device_find() - find fclkcfg device by name and get its data.
+ *
+ * @name:       device name.
+ * Return:      Pointer to the fclk device data or NULL.
+ *
+ * A reference of the fclk device data is taken, put it by fclk_device_put().
+ */
+static struct fclk_device_data* fclkcfg_device_find(const char* name)
+{
+    struct device*           dev;
+    struct fclk_device_data* this;
+    unsigned long            flags;
+    bool                     removed;
+
+    if ((fclkcfg_sys_class == NULL) || (name == NULL))
+        return NULL;
+    dev = class_find_device(fclkcfg_sys_class, NULL, name, fclkcfg_manifest_match);
+    if (dev == NULL)
+        return NULL;
+    /*
+     * the device holds a reference of this until its release, so this is
+     * valid while dev is held.
+     */
+    this = dev_get_drvdata(dev);
+    fclk_device_get(this);
+    put_device(dev);
+    spin_lock_irqsave(&this->atomic_lock, flags);
+    removed = this->removed;
+    spin_unlock_irqrestore(&this->atomic_lock, flags);
+    if (removed == true) {
+        fclk_device_put(this);
+        return NULL;
+    }
+    return this;
+}
+
+/**
+ * fclkcfg_manifest_change() - change states of manifest devices in three steps.
+ *
+ * @entries:    manifest entries.
+ * @size:       number of entries.
+ * @rollback:   apply prev states instead of next states, ignoring errors.
+ * Return:      Success(=0) or error status(<0).
+ */
+static int fclkcfg_manifest_change(struct fclkcfg_manifest_entry* entries, int size, bool rollback)
+{
+    int               retval = 0;
+    int               status;
+    int               i;
+    struct fclk_state state;
+
+    for (i = 0; i < size; i++) {
+        struct fclk_device_data* this = entries[i].data;
+        struct fclk_state*       next = (rollback) ? &entries[i].prev : &entries[i].next;
+        bool                     transition;
+        fclk_state_clear(&state);
+        state.enable_valid = true;
+        state.enable       = false;
+        mutex_lock(&this->lock);
+        transition = ((next->rate_valid   == true) && (next->rate   != clk_get_rate(this->target.clk))) ||
+                     ((next->resclk_valid == true) && (next->resclk != this->target.resource_clk_id));
+        if ((transition == true) && (__clk_is_enabled(this->target.clk) == true))
+            status = __fclk_change_state(this, &state);
+        else
+            status = (this->removed == true) ? -ENODEV : 0;
+        mutex_unlock(&this->lock);
+        if (status) {
+            retval = (retval) ? retval : status;
+            if (rollback == false)
+                return retval;
+        }
+    }
+    for (i = 0; i < size; i++) {
+        struct fclk_device_data* this = entries[i].data;
+        state              = (rollback) ? entries[i].prev : entries[i].next;
+        state.enable_valid = false;
+        mutex_lock(&this->lock);
+        status = __fclk_change_state(this, &state);
+        mutex_unlock(&this->lock);
+        if (status) {
+            retval = (retval) ? retval : status;
+            if (rollback == false)
+                return retval;
+        }
+    }
+    for (i = 0; i < size; i++) {
+        struct fclk_device_data* this = entries[i].data;
+        struct fclk_state*       next = (rollback) ? &entries[i].prev : &entries[i].next;
+        fclk_state_clear(&state);
+        state.enable_valid = true;
+        state.enable       = (next->enable_valid == true) ? next->enable : entries[i].prev.enable;
+        mutex_lock(&this->lock);
+        status = __fclk_change_state(this, &state);
+        mutex_unlock(&this->lock);
+        if (status) {
+            retval = (retval) ? retval : status;
+            if (rollback == false)
+                return retval;
+        }
+    }
+    return retval;
+}
+
+/**
+ * fclkcfg_manifest_apply() - load and apply clock manifest.
+ *
+ * @firmware_name: file name of the manifest.
+ * Return:         Success(=0) or error status(<0).
+ *
+ * All lines are parsed and checked against the devices before any clock is
+ * changed. If a change fails, all devices are restored to the states they
+ * had before. The rate and resource clock of a device linked by rate ratios
+ * can not be changed by a manifest (-EBUSY).
+ */
+static int fclkcfg_manifest_apply(const char* firmware_name)
+{
+    const struct firmware*         fw;
+    struct fclkcfg_manifest_entry* entries = NULL;
+    int                            size    = 0;
+    int                            lines   = 1;
+    int                            line_num = 0;
+    char*                          text;
+    char*                          ptr;
+    char*                          line;
+    int                            retval;
+    int                            i;
+
+    retval = request_firmware(&fw, firmware_name, NULL);
+    if (retval) {
+        pr_err("%s: request_firmware(%s) failed(%d).\n", DRIVER_NAME, firmware_name, retval);
+        return retval;
+    }
+    text = fclk_manifest_dup(fw);
+    release_firmware(fw);
+    if (text == NULL)
+        return -ENOMEM;
+
+    for (ptr = text; *ptr != '\0'; ptr++) {
+        if (*ptr == '\n')
+            lines++;
+    }
+    entries = kcalloc(lines, sizeof(*entries), GFP_KERNEL);
+    if (entries == NULL) {
+        retval = -ENOMEM;
+        goto done;
+    }
+
+    ptr = text;
+    while ((line = strsep(&ptr, "\n")) != NULL) {
+        struct fclkcfg_manifest_entry* entry = &entries[size];
+        struct fclk_device_data*       this;
+        char*                          name;
+        line_num++;
+        if (0 != (retval = parse_fclk_manifest_line(line, &name, &entry->next))) {
+            pr_err("%s: %s:%d: parse error(%d).\n", DRIVER_NAME, firmware_name, line_num, retval);
+            goto done;
+        }
+        if (name == NULL)
+            continue;
+        this = fclkcfg_device_find(name);
+        if (this == NULL) {
+            pr_err("%s: %s:%d: device %s not found.\n", DRIVER_NAME, firmware_name, line_num, name);
+            retval = -ENODEV;
+            goto done;
+        }
+        entry->data = this;
+        size++;
+        for (i = 0; i < size-1; i++) {
+            if (entries[i].data == this) {
+                dev_err(this->device, "%s:%d: duplicate entry.\n", firmware_name, line_num);
+                retval = -EINVAL;
+                goto done;
+            }
+        }
+        mutex_lock(&this->lock);
+        retval = fclk_device_validate_state(this, &entry->next);
+        if ((retval == 0) && (__fclk_ratio_refused(this, &entry->next) == true))
+            retval = -EBUSY;
+        entry->prev.rate         = clk_get_rate(this->target.clk);
+        entry->prev.rate_valid   = true;
+        entry->prev.enable       = __clk_is_enabled(this->target.clk);
+        entry->prev.enable_valid = true;
+        entry->prev.resclk       = this->target.resource_clk_id;
+        entry->prev.resclk_valid = (this->target.resource_clk_id >= 0);
+        entry->prev.ratio_solved = true;
+        mutex_unlock(&this->lock);
+        if (retval) {
+            pr_err("%s: %s:%d: %s: invalid state(%d).\n", DRIVER_NAME, firmware_name, line_num, name, retval);
+            goto done;
+        }
+    }
+
+    retval = fclkcfg_manifest_change(entries, size, false);
+    if (retval) {
+        int rollback = fclkcfg_manifest_change(entries, size, true);
+        pr_err("%s: %s apply failed(%d), rollback %s(%d).\n", DRIVER_NAME, firmware_name,
+               retval, (rollback) ? "failed" : "done", rollback);
+    }
+
+ done:
+    if (entries != NULL) {
+        for (i = 0; i < size; i++)
+            fclk_device_put(entries[i].data);
+        kfree(entries);
+    }
+    kfree(text);
+    return retval;
+}
+
+/**
+ * fclkcfg_manifest_store() - /sys/class/fclkcfg/manifest store operation.
+ */
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0))
+static ssize_t fclkcfg_manifest_store(const struct class* class, const struct class_attribute* attr, const char* buf, size_t size)
 #else
-#define SET_SYS_CLASS_ATTRIBUTES(sys_class) {(sys_class)->dev_attrs  = fclkcfg_device_attrs;}
+static ssize_t fclkcfg_manifest_store(struct class* class, struct class_attribute* attr, const char* buf, size_t size)
 #endif
+{
+    char* firmware_name;
+    int   retval;
+
+    firmware_name = kstrdup(buf, GFP_KERNEL);
+    if (firmware_name == NULL)
+        return -ENOMEM;
+    retval = fclkcfg_manifest_apply(strim(firmware_name));
+    kfree(firmware_name);
+    return (retval) ? retval : size;
+}
+static struct class_attribute fclkcfg_manifest_attr = __ATTR(manifest, 0200, NULL, fclkcfg_manifest_store);
+static bool fclkcfg_manifest_done = 0;
 
 /**
- * fclkcfg_device_destroy() - Destroy the fclkcfg device.
+ * DOC: fclkcfg rate ratio
  *
- * @this:       Pointer to the fclk device data.
- * Return:      Success(=0) or error status(<0).
+ * A device may declare that its rate is a fixed ratio (ratio_num/ratio_den)
+ * of the rate of another device, the reference device. A write to the rate
+ * file of the reference device or of any device referring to it is solved
+ * jointly for all of them: the highest rate of the reference device, over
+ * all of its resource clocks, for which every linked device can make its
+ * rate is searched, and the rates are applied in the three steps of the
+ * manifest. The linked devices keep their resource clocks.
  *
+ * Every other change of the rate or resource clock of the reference device
+ * or a linked device is refused with -EBUSY. Whether a device is linked is
+ * kept in ratio_linked, which fclkcfg_ratio_update() computes again when a
+ * rate ratio is set or cleared and when a device is created or destroyed,
+ * so the rate files of devices that are not linked never walk the class.
+ *
+ * * fclkcfg_ratio_collect()  - collect devices linked to reference device.
+ * * fclkcfg_ratio_linked()   - update ratio_linked of one device.
+ * * fclkcfg_ratio_update()   - update ratio_linked of all devices.
+ * * fclkcfg_ratio_feasible() - rate of linked device for reference rate.
+ * * fclkcfg_ratio_search()   - search highest feasible reference rate.
+ * * fclkcfg_ratio_set_rate() - set rate of linked devices jointly.
  */
-static int fclkcfg_device_destroy(struct fclk_device_data* this)
-{
-    int retval;
+struct fclkcfg_ratio_context {
+    const char*                    name;
+    struct fclkcfg_manifest_entry* entries;
+    int                            size;
+    int                            max;
+};
 
-    if (!this)
-        return -ENODEV;
+static DEFINE_MUTEX(fclkcfg_ratio_mutex);
 
-    retval = fclk_device_cleanup(this);
-    if (retval)
-        return retval;
+/**
+ * fclkcfg_ratio_collect() - collect devices linked to reference device.
+ *
+ * @dev:        class device.
+ * @data:       Pointer to the fclkcfg ratio context.
+ * Return:      0 to continue the iteration.
+ *
+ * When entries is NULL, the linked devices are only counted.
+ */
+static int fclkcfg_ratio_collect(struct device* dev, void* data)
+{
+    struct fclkcfg_ratio_context* context = data;
+    struct fclk_device_data*      this    = dev_get_drvdata(dev);
+    bool                          linked;
 
-    if (this->device) {
-        device_destroy(fclkcfg_sys_class, this->device_number);
-        this->device = NULL;
-    }
-    if (this->device_number) {
-        ida_simple_remove(&fclkcfg_device_ida, MINOR(this->device_number));
-        this->device_number = 0;
+    if (this == NULL)
+        return 0;
+    mutex_lock(&this->lock);
+    linked = ((this->removed == false) && (this->ratio_device != NULL) && (strcmp(this->ratio_device, context->name) == 0));
+    mutex_unlock(&this->lock);
+    if (linked == false)
+        return 0;
+    if ((context->entries != NULL) && (context->size < context->max)) {
+        /* dev is held during the iteration, and dev holds this */
+        fclk_device_get(this);
+        context->entries[context->size].data = this;
     }
-    kfree(this);
+    context->size++;
     return 0;
 }
 
 /**
- * fclkcfg_device_create() -  Create fclkcfg device.
+ * fclkcfg_ratio_linked() - update ratio_linked of one device.
  *
- * @dev:        handle to the device structure.
- * Return:      Pointer to the fclk device data or NULL.
+ * @dev:        class device.
+ * @data:       not used.
+ * Return:      0 to continue the iteration.
  *
+ * A device is linked if it refers to a reference device, or if it is the
+ * reference device of another device.
  */
-static struct fclk_device_data* fclkcfg_device_create(struct device *dev)
+static int fclkcfg_ratio_linked(struct device* dev, void* data)
 {
-    int                      retval = 0;
-    struct fclk_device_data* this   = NULL;
-    const char*              device_name;
+    struct fclkcfg_ratio_context context;
+    struct fclk_device_data*     this = dev_get_drvdata(dev);
 
-    DEV_DBG(dev, "driver probe start.\n");
-    /*
-     * create (fclk_device_data*) this.
-     */
-    {
-        this = kzalloc(sizeof(*this), GFP_KERNEL);
-        if (IS_ERR_OR_NULL(this)) {
-            retval = PTR_ERR(this);
-            this   = NULL;
-            goto failed;
-        }
-        this->device        = NULL;
-        this->clk           = NULL;
-        this->device_number = 0;
-    }
-    /*
-     * get device number
-     */
-    DEV_DBG(dev, "get device_number start.\n");
-    {
-        int minor_number = ida_simple_get(&fclkcfg_device_ida, 0, DEVICE_MAX_NUM, GFP_KERNEL);
-        if (minor_number < 0) {
-            dev_err(dev, "invalid or conflict minor number %d.\n", minor_number);
-            retval = -ENODEV;
-            goto failed;
-        }
-        this->device_number = MKDEV(MAJOR(fclkcfg_device_number), minor_number);
-    }
-    DEV_DBG(dev, "get device_number done.\n");
+    if (this == NULL)
+        return 0;
+    context.name    = dev_name(dev);
+    context.entries = NULL;
+    context.size    = 0;
+    context.max     = 0;
+    class_for_each_device(fclkcfg_sys_class, NULL, &context, fclkcfg_ratio_collect);
+    mutex_lock(&this->lock);
+    this->ratio_linked = (this->ratio_device != NULL) || (context.size > 0);
+    mutex_unlock(&this->lock);
+    return 0;
+}
 
-    /*
-     * get device name
-     */
-    DEV_DBG(dev, "get device name start.\n");
-    {
-        device_name = of_get_property(dev->of_node, "device-name", NULL);
-        
-        if (IS_ERR_OR_NULL(device_name)) {
-            device_name = dev_name(dev);
-        }
-    }
-    DEV_DBG(dev, "get device name done.\n");
+/**
+ * fclkcfg_ratio_update() - update ratio_linked of all devices.
+ *
+ * Must be called without the lock of any device. The updates are serialized,
+ * so the last one sees every rate ratio set before it.
+ */
+static void fclkcfg_ratio_update(void)
+{
+    if (fclkcfg_sys_class == NULL)
+        return;
+    mutex_lock(&fclkcfg_ratio_mutex);
+    class_for_each_device(fclkcfg_sys_class, NULL, NULL, fclkcfg_ratio_linked);
+    mutex_unlock(&fclkcfg_ratio_mutex);
+}
 
-    /*
-     * create device
-     */
-    DEV_DBG(dev, "device_create start.\n");
-    {
-        this->device = device_create(fclkcfg_sys_class,
-                                     NULL,
-                                     this->device_number,
-                                     (void *)this,
-                                     device_name);
-        if (IS_ERR_OR_NULL(this->device)) {
-            dev_err(dev, "device create falied.\n");
-            this->device = NULL;
-            goto failed;
-        }
-    }
-    DEV_DBG(dev, "device_create done\n");
+/**
+ * fclkcfg_ratio_feasible() - rate of linked device for reference rate.
+ *
+ * @this:       Pointer to the fclk device data of linked device.
+ * @ref_rate:   rate of reference device.
+ * @rate:       address to store the rate of linked device.
+ * Return:      true if the linked device can make the rate.
+ *
+ * Without rate tolerance, the rate must be an exact ratio and be made
+ * exactly by clk_round_rate().
+ */
+static bool fclkcfg_ratio_feasible(struct fclk_device_data* this, unsigned long ref_rate, unsigned long* rate)
+{
+    u64           product = (u64)ref_rate * this->ratio_num;
+    unsigned long want    = (unsigned long)div_u64(product, this->ratio_den);
+    long          round;
 
-    /*
-     * set up fclk device data
-     */
-    {
-        retval = fclk_device_setup(this, dev);
-        if (retval)
-            goto failed;
+    if (want == 0)
+        return false;
+    round = clk_round_rate(this->target.clk, want);
+    if (round <= 0)
+        return false;
+    if ((this->rate_tolerance_ppm == 0) && (this->rate_tolerance_hz == 0)) {
+        if (((u64)want * this->ratio_den != product) || ((unsigned long)round != want))
+            return false;
+    } else if (__fclk_rate_in_tolerance(this, want, (unsigned long)round) == false) {
+        return false;
     }
-
-    return this;
-
- failed:
-    fclkcfg_device_destroy(this);
-    return ERR_PTR(retval);
+    *rate = want;
+    return true;
 }
 
 /**
- * DOC: fclkcfg Platform Driver
+ * fclkcfg_ratio_search() - search highest feasible reference rate.
  *
- * This section defines the fclkcfg platform driver.
+ * @entries:    entries, the reference device first.
+ * @size:       number of entries.
+ * @request:    requested rate of reference device.
+ * @resclk:     address to store the resource clock of reference device.
+ * Return:      highest feasible rate or 0.
  *
- * * fclkcfg_platform_driver_probe()   - Probe call for the device.
- * * fclkcfg_platform_driver_remove()  - Remove call for the device.
- * * fclkcfg_of_match                  - Open Firmware Device Identifier Matching Table.
- * * fclkcfg_platform_driver           - Platform Driver Structure.
- * * fclkcfg_platform_driver_done
+ * The reference device must be gated and its lock held, because its
+ * resource clock is changed during the search. The lock of each linked
+ * device is taken while it is checked; a reference device never links to
+ * another device, so the locks are always taken in the same order.
  */
+static unsigned long fclkcfg_ratio_search(struct fclkcfg_manifest_entry* entries, int size, unsigned long request, int* resclk)
+{
+    struct fclk_device_data* ref       = entries[0].data;
+    struct fclk_target*      target    = &ref->target;
+    int                      resources = (ref->resource_clks != NULL) ? ref->resource_clks_size : 1;
+    unsigned long            best_rate = 0;
+    unsigned long            rate;
+    unsigned long            limit;
+    int                      index;
+    int                      step;
+    int                      i;
+
+    if ((ref->max_rate != 0) && (request > ref->max_rate))
+        request = ref->max_rate;
+    *resclk = target->resource_clk_id;
+    for (index = 0; index < resources; index++) {
+        if ((ref->resource_clks != NULL) && (0 != __fclk_change_resource(ref, target, index)))
+            continue;
+        limit = request;
+        for (step = 0; step < 4096; step++) {
+            bool feasible = true;
+            if (0 != __fclk_round_rate_down(target, limit, &rate))
+                break;
+            if ((rate <= best_rate) || (rate < ref->min_rate))
+                break;
+            for (i = 1; (i < size) && (feasible == true); i++) {
+                struct fclk_device_data* data = entries[i].data;
+                mutex_lock(&data->lock);
+                feasible = (data->removed == false) && fclkcfg_ratio_feasible(data, rate, &entries[i].next.rate);
+                mutex_unlock(&data->lock);
+            }
+            if (feasible == true) {
+                best_rate = rate;
+                *resclk   = index;
+                break;
+            }
+            limit = rate - 1;
+        }
+    }
+    return best_rate;
+}
 
 /**
- * fclkcfg_platform_driver_probe() -  Probe call for the device.
+ * fclkcfg_ratio_set_rate() - set rate of linked devices jointly.
  *
- * @pdev:	handle to the platform device structure.
- * Returns 0 on success, negative error otherwise.
+ * @this:       Pointer to the fclk device data.
+ * @rate:       requested rate of @this.
+ * Return:      Success(=0), -ENOENT if @this is not linked, or error status(<0).
  *
- * It does all the memory allocation and registration for the device.
+ * Devices that are not linked return -ENOENT from ratio_linked alone.
  */
-static int fclkcfg_platform_driver_probe(struct platform_device *pdev)
+static int fclkcfg_ratio_set_rate(struct fclk_device_data* this, unsigned long rate)
 {
-    int                      retval = 0;
-    struct fclk_device_data* data;
+    struct fclkcfg_ratio_context context;
+    char*                        name;
+    struct fclk_device_data*     ref;
+    bool                         chained;
+    struct fclk_state            state;
+    unsigned long                request;
+    unsigned long                ref_rate;
+    int                          resclk;
+    int                          retval = 0;
+    int                          rollback;
+    int                          i;
 
-    data = fclkcfg_device_create(&pdev->dev);
-    if (IS_ERR_OR_NULL(data)) {
-        retval = PTR_ERR(data);
-        dev_err(&pdev->dev, "driver create failed. return=%d.\n", retval);
-        retval = (retval == 0) ? -EINVAL : retval;
-        goto failed;
+    mutex_lock(&this->lock);
+    if (this->ratio_linked == false) {
+        mutex_unlock(&this->lock);
+        return -ENOENT;
+    }
+    name = kstrdup((this->ratio_device != NULL) ? this->ratio_device : dev_name(this->device), GFP_KERNEL);
+    mutex_unlock(&this->lock);
+    if (name == NULL)
+        return -ENOMEM;
+    context.name    = name;
+    context.entries = NULL;
+    context.size    = 0;
+    context.max     = 0;
+    class_for_each_device(fclkcfg_sys_class, NULL, &context, fclkcfg_ratio_collect);
+    if (context.size == 0) {
+        kfree(name);
+        return -ENOENT;
     }
 
-    platform_set_drvdata(pdev, data);
+    ref = fclkcfg_device_find(name);
+    if (ref == NULL) {
+        dev_err(this->device, "rate ratio device %s not found.\n", name);
+        kfree(name);
+        return -ENODEV;
+    }
+    mutex_lock(&ref->lock);
+    chained = (ref->ratio_device != NULL);
+    mutex_unlock(&ref->lock);
+    if (chained == true) {
+        dev_err(this->device, "rate ratio device %s refers to another device.\n", name);
+        fclk_device_put(ref);
+        kfree(name);
+        return -EINVAL;
+    }
 
-    if (info_enable) {
-        fclk_device_info(data, pdev);
+    context.max     = context.size;
+    context.size    = 0;
+    context.entries = kcalloc(context.max + 1, sizeof(*context.entries), GFP_KERNEL);
+    if (context.entries == NULL) {
+        fclk_device_put(ref);
+        kfree(name);
+        return -ENOMEM;
     }
+    context.entries[0].data = ref;
+    context.entries++;
+    class_for_each_device(fclkcfg_sys_class, NULL, &context, fclkcfg_ratio_collect);
+    context.entries--;
+    context.size = 1 + min(context.size, context.max);
 
-    dev_info(&pdev->dev, "driver installed.\n");
-    return 0;
+    for (i = 0; i < context.size; i++) {
+        struct fclk_device_data* data = context.entries[i].data;
+        fclk_state_clear(&context.entries[i].next);
+        mutex_lock(&data->lock);
+        context.entries[i].prev.rate         = clk_get_rate(data->target.clk);
+        context.entries[i].prev.rate_valid   = true;
+        context.entries[i].prev.enable       = __clk_is_enabled(data->target.clk);
+        context.entries[i].prev.enable_valid = true;
+        context.entries[i].prev.resclk       = data->target.resource_clk_id;
+        context.entries[i].prev.resclk_valid = (data->target.resource_clk_id >= 0);
+        context.entries[i].prev.ratio_solved = true;
+        mutex_unlock(&data->lock);
+    }
+    request = (this == ref) ? rate : (unsigned long)div_u64((u64)rate * this->ratio_den, this->ratio_num);
+
+    fclk_state_clear(&state);
+    state.enable_valid = true;
+    state.enable       = false;
+    for (i = 0; i < context.size; i++) {
+        struct fclk_device_data* data = context.entries[i].data;
+        mutex_lock(&data->lock);
+        if (__clk_is_enabled(data->target.clk) == true)
+            retval = __fclk_change_state(data, &state);
+        else
+            retval = (data->removed == true) ? -ENODEV : 0;
+        mutex_unlock(&data->lock);
+        if (retval)
+            goto failed;
+    }
+
+    mutex_lock(&ref->lock);
+    ref_rate = fclkcfg_ratio_search(context.entries, context.size, request, &resclk);
+    mutex_unlock(&ref->lock);
+    if (ref_rate == 0) {
+        dev_err(this->device, "no rate of %s near %lu satisfies the rate ratios.\n", name, request);
+        retval = -ERANGE;
+        goto failed;
+    }
+    DEV_DBG(this->device, "rate of %s %lu => %lu by rate ratios.\n", name, request, ref_rate);
+
+    for (i = 0; i < context.size; i++) {
+        context.entries[i].next.rate_valid   = true;
+        context.entries[i].next.ratio_solved = true;
+    }
+    context.entries[0].next.rate         = ref_rate;
+    context.entries[0].next.resclk       = resclk;
+    context.entries[0].next.resclk_valid = (resclk >= 0);
+    retval = fclkcfg_manifest_change(context.entries, context.size, false);
+    if (retval == 0)
+        goto done;
 
  failed:
-    dev_info(&pdev->dev, "driver install failed.\n");
+    rollback = fclkcfg_manifest_change(context.entries, context.size, true);
+    dev_err(this->device, "rate ratio change failed(%d), rollback %s(%d).\n",
+            retval, (rollback) ? "failed" : "done", rollback);
+ done:
+    for (i = 0; i < context.size; i++)
+        fclk_device_put(context.entries[i].data);
+    kfree(context.entries);
+    kfree(name);
     return retval;
 }
 
 /**
- * _fclkcfg_platform_driver_remove() -  Remove call for the device.
+ * DOC: fclkcfg kernel API
  *
- * @pdev:	handle to the platform device structure.
- * Returns 0 or error status.
+ * This section defines the kernel API declared in fclkcfg.h.
  *
- * Unregister the device after releasing the resources.
+ * * fclkcfg_get()            - get fclkcfg device by name.
+ * * fclkcfg_put()            - put fclkcfg device.
+ * * fclkcfg_enable_atomic()  - enable clocks of fclkcfg device.
+ * * fclkcfg_disable_atomic() - disable clocks of fclkcfg device.
+ *
+ * The atomic operations take atomic_lock only and call clk_enable() and
+ * clk_disable(), so they may be called from interrupt handlers. They do not
+ * wait enable_settle_us and do not touch resets. They return -EPERM if the
+ * device is not in keep prepared mode, -EBUSY while a state change is in
+ * progress and -ENODEV after the device has been removed.
+ *
+ * fclkcfg_get() holds a reference of the fclk device data, so the pointer
+ * stays valid after the device is removed, until fclkcfg_put().
  */
-static inline int _fclkcfg_platform_driver_remove(struct platform_device *pdev)
+/**
+ * fclkcfg_get() - get fclkcfg device by name.
+ *
+ * @name:       device name (e.g. "fpga-clk0").
+ * Return:      Pointer to the fclk device data or NULL.
+ */
+struct fclk_device_data* fclkcfg_get(const char* name)
 {
-    struct fclk_device_data* this = dev_get_drvdata(&pdev->dev);
-
-    if (!this)
-        return -ENODEV;
-
-    if (this->clk) 
-        __fclk_change_state(this, &this->remove);
-
-    fclkcfg_device_destroy(this);
-    platform_set_drvdata(pdev, NULL);
-    dev_info(&pdev->dev, "driver removed.\n");
-    return 0;
+    return fclkcfg_device_find(name);
 }
-#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 11, 0)
+EXPORT_SYMBOL_GPL(fclkcfg_get);
+
 /**
- * fclkcfg_platform_driver_remove() -  Remove call for the device.
- *
- * @pdev:	handle to the platform device structure.
- * Returns 0 or error status.
+ * fclkcfg_put() - put fclkcfg device.
  *
- * Unregister the device after releasing the resources.
+ * @this:       Pointer to the fclk device data returned by fclkcfg_get().
  */
-static int fclkcfg_platform_driver_remove(struct platform_device *pdev)
+void fclkcfg_put(struct fclk_device_data* this)
 {
-    return _fclkcfg_platform_driver_remove(pdev);
+    if (this != NULL)
+        fclk_device_put(this);
 }
-#else
+EXPORT_SYMBOL_GPL(fclkcfg_put);
+
 /**
- * fclkcfg_platform_driver_remove() -  Remove call for the device.
+ * fclkcfg_enable_atomic() - enable clocks of fclkcfg device.
  *
- * @pdev:	handle to the platform device structure.
- * Returns      void
+ * @this:       Pointer to the fclk device data.
+ * Return:      Success(=0) or error status(<0).
  *
- * Unregister the device after releasing the resources.
+ * All targets are enabled. If one of them fails, all targets are left
+ * disabled.
  */
-static void fclkcfg_platform_driver_remove(struct platform_device *pdev)
+int fclkcfg_enable_atomic(struct fclk_device_data* this)
 {
-    _fclkcfg_platform_driver_remove(pdev);
+    unsigned long flags;
+    int           status = 0;
+    int           i;
+
+    if (this == NULL)
+        return -ENODEV;
+    spin_lock_irqsave(&this->atomic_lock, flags);
+    if (this->removed == true) {
+        status = -ENODEV;
+        goto done;
+    }
+    if (this->keep_prepared == false) {
+        status = -EPERM;
+        goto done;
+    }
+    if (this->in_transition == true) {
+        status = -EBUSY;
+        goto done;
+    }
+    for (i = 0; i < __fclk_targets_size(this); i++) {
+        struct fclk_target* target = __fclk_get_target(this, i);
+        if (target->enable_refs > 0)
+            continue;
+        if (0 != (status = clk_enable(target->clk)))
+            break;
+        target->enable_refs++;
+    }
+    if (status) {
+        for (i = 0; i < __fclk_targets_size(this); i++) {
+            struct fclk_target* target = __fclk_get_target(this, i);
+            while (target->enable_refs > 0) {
+                clk_disable(target->clk);
+                target->enable_refs--;
+            }
+        }
+    }
+    this->enforce_desired.enable = (status == 0);
+    if (this->power.valid == true)
+        __fclk_power_account(this, (status == 0) ? this->power.active_uw : 0);
+ done:
+    spin_unlock_irqrestore(&this->atomic_lock, flags);
+    return status;
 }
-#endif
+EXPORT_SYMBOL_GPL(fclkcfg_enable_atomic);
 
 /**
- * Open Firmware Device Identifier Matching Table
+ * fclkcfg_disable_atomic() - disable clocks of fclkcfg device.
+ *
+ * @this:       Pointer to the fclk device data.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The enable references held by fclkcfg are released, the prepare
+ * references are kept.
  */
-static struct of_device_id fclkcfg_of_match[] = {
-    { .compatible = "ikwzm,fclkcfg-0.10.a", },
-    { .compatible = "ikwzm,fclkcfg"       , },
-    { /* end of table */}
-};
-MODULE_DEVICE_TABLE(of, fclkcfg_of_match);
+int fclkcfg_disable_atomic(struct fclk_device_data* this)
+{
+    unsigned long flags;
+    int           status = 0;
+    int           i;
 
-/**
- * Platform Driver Structure
- */
-static struct platform_driver fclkcfg_platform_driver = {
-    .probe  = fclkcfg_platform_driver_probe,
-    .remove = fclkcfg_platform_driver_remove,
-    .driver = {
-        .owner = THIS_MODULE,
-        .name  = DRIVER_NAME,
-        .of_match_table = fclkcfg_of_match,
-    },
-};
-static bool fclkcfg_platform_driver_done = 0;
+    if (this == NULL)
+        return -ENODEV;
+    spin_lock_irqsave(&this->atomic_lock, flags);
+    if (this->removed == true) {
+        status = -ENODEV;
+        goto done;
+    }
+    if (this->keep_prepared == false) {
+        status = -EPERM;
+        goto done;
+    }
+    if (this->in_transition == true) {
+        status = -EBUSY;
+        goto done;
+    }
+    for (i = 0; i < __fclk_targets_size(this); i++) {
+        struct fclk_target* target = __fclk_get_target(this, i);
+        while (target->enable_refs > 0) {
+            clk_disable(target->clk);
+            target->enable_refs--;
+        }
+    }
+    this->enforce_desired.enable = false;
+    if (this->power.valid == true)
+        __fclk_power_account(this, 0);
+ done:
+    spin_unlock_irqrestore(&this->atomic_lock, flags);
+    return status;
+}
+EXPORT_SYMBOL_GPL(fclkcfg_disable_atomic);
 
 /**
  * DOC: fclkcfg kernel module operations
@@ -1350,7 +7365,11 @@ static bool fclkcfg_platform_driver_done = 0;
  */
 static void fclkcfg_module_cleanup(void)
 {
+#if (USE_CONFIGFS == 1)
+    if (fclkcfg_configfs_done        ){configfs_unregister_subsystem(&fclkcfg_configfs_subsys);}
+#endif
     if (fclkcfg_platform_driver_done ){platform_driver_unregister(&fclkcfg_platform_driver);}
+    if (fclkcfg_manifest_done        ){class_remove_file(fclkcfg_sys_class, &fclkcfg_manifest_attr);}
     if (fclkcfg_sys_class     != NULL){class_destroy(fclkcfg_sys_class);}
     if (fclkcfg_device_number != 0   ){unregister_chrdev_region(fclkcfg_device_number, 0);}
     ida_destroy(&fclkcfg_device_ida);
@@ -1373,6 +7392,9 @@ static int __init fclkcfg_module_init(void)
 
     ida_init(&fclkcfg_device_ida);
 
+    if (disable_retry >= 0)
+        printk(KERN_WARNING "%s: disable_retry parameter is deprecated and ignored\n", DRIVER_NAME);
+
     retval = alloc_chrdev_region(&fclkcfg_device_number, 0, 0, DRIVER_NAME);
     if (retval != 0) {
         printk(KERN_ERR "%s: couldn't allocate device major number\n", DRIVER_NAME);
@@ -1393,12 +7415,30 @@ static int __init fclkcfg_module_init(void)
     }
     SET_SYS_CLASS_ATTRIBUTES(fclkcfg_sys_class);
 
+    retval = class_create_file(fclkcfg_sys_class, &fclkcfg_manifest_attr);
+    if (retval) {
+        printk(KERN_ERR "%s: couldn't create manifest file\n", DRIVER_NAME);
+    } else {
+        fclkcfg_manifest_done = 1;
+    }
+
     retval = platform_driver_register(&fclkcfg_platform_driver);
     if (retval) {
         printk(KERN_ERR "%s: couldn't register platform driver\n", DRIVER_NAME);
     } else {
         fclkcfg_platform_driver_done = 1;
     }
+
+#if (USE_CONFIGFS == 1)
+    config_group_init(&fclkcfg_configfs_subsys.su_group);
+    mutex_init(&fclkcfg_configfs_subsys.su_mutex);
+    retval = configfs_register_subsystem(&fclkcfg_configfs_subsys);
+    if (retval) {
+        printk(KERN_ERR "%s: couldn't register configfs subsystem\n", DRIVER_NAME);
+    } else {
+        fclkcfg_configfs_done = 1;
+    }
+#endif
     return 0;
 
  failed:
@@ -1409,3 +7449,7 @@ static int __init fclkcfg_module_init(void)
 module_init(fclkcfg_module_init);
 module_exit(fclkcfg_module_exit);
 
+#if (USE_KUNIT_TEST == 1)
+#include "fclkcfg_test.c"
+#endif
+
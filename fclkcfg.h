@@ -0,0 +1,57 @@
+/*********************************************************************************
+ *
+ *       Copyright (C) 2025 Ichiro Kawazome
+ *       All rights reserved.
+ *
+ *       Redistribution and use in source and binary forms, with or without
+ *       modification, are permitted provided that the following conditions
+ *       are met:
+ *
+ *         1. Redistributions of source code must retain the above copyright
+ *            notice, this list of conditions and the following disclaimer.
+ *
+ *         2. Redistributions in binary form must reproduce the above copyright
+ *            notice, this list of conditions and the following disclaimer in
+ *            the documentation and/or other materials provided with the
+ *            distribution.
+ *
+ *       THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *       "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *       LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *       A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ *       OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *       SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *       LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *       DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *       THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *       (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *       OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ********************************************************************************/
+
+#ifndef FCLKCFG_H
+#define FCLKCFG_H
+
+#include <linux/types.h>
+
+/**
+ * DOC: fclkcfg kernel API
+ *
+ * Gate the clocks of a fclkcfg device from other drivers. The device must
+ * be in keep prepared mode ("keep-prepared" property or keep_prepared
+ * file), so that enable and disable only need clk_enable()/clk_disable()
+ * and may be called in atomic context, e.g. from an interrupt handler.
+ *
+ * * fclkcfg_get()            - get fclkcfg device by name (may sleep).
+ * * fclkcfg_put()            - put fclkcfg device (may sleep).
+ * * fclkcfg_enable_atomic()  - enable clocks of fclkcfg device.
+ * * fclkcfg_disable_atomic() - disable clocks of fclkcfg device.
+ */
+struct fclk_device_data;
+
+struct fclk_device_data* fclkcfg_get(const char* name);
+void                     fclkcfg_put(struct fclk_device_data* fclk);
+int                      fclkcfg_enable_atomic(struct fclk_device_data* fclk);
+int                      fclkcfg_disable_atomic(struct fclk_device_data* fclk);
+
+#endif /* FCLKCFG_H */
@@ -0,0 +1,915 @@
+/*********************************************************************************
+ *
+ *       Copyright (C) 2025 Ichiro Kawazome
+ *       All rights reserved.
+ *
+ *       Redistribution and use in source and binary forms, with or without
+ *       modification, are permitted provided that the following conditions
+ *       are met:
+ *
+ *         1. Redistributions of source code must retain the above copyright
+ *            notice, this list of conditions and the following disclaimer.
+ *
+ *         2. Redistributions in binary form must reproduce the above copyright
+ *            notice, this list of conditions and the following disclaimer in
+ *            the documentation and/or other materials provided with the
+ *            distribution.
+ *
+ *       THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *       "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *       LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *       A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ *       OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *       SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *       LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *       DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *       THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *       (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *       OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ********************************************************************************/
+/*
+ * KUnit tests of fclkcfg. This file is included from fclkcfg.c when
+ * CONFIG_FCLKCFG_KUNIT_TEST is set, so that the static functions can be
+ * tested directly.
+ */
+#include <kunit/test.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+
+/**
+ * DOC: fclkcfg test constants
+ *
+ * Each test device is a fclk device data created like a configfs item, on
+ * its own software clock tree:
+ *
+ *   fclkcfg-test<N>-ref0 (400MHz) ---+
+ *                                    +--- fclkcfg-test<N> (mux + divider + gate)
+ *   fclkcfg-test<N>-ref1 (300MHz) ---+
+ *
+ * ref0 and ref1 are resource 0 and 1. The device is inserted at 100MHz on
+ * resource 0, that is, a divider of 4.
+ */
+#define FCLKCFG_TEST_REF0_RATE      400000000UL
+#define FCLKCFG_TEST_REF1_RATE      300000000UL
+#define FCLKCFG_TEST_INSERT_RATE    100000000UL
+#define FCLKCFG_TEST_NEXT_RATE       50000000UL
+#define FCLKCFG_TEST_DIV_MAX        64
+#define FCLKCFG_TEST_BENCH_LOOPS    100
+#define FCLKCFG_TEST_PARALLEL_DEVICES 4
+#define FCLKCFG_TEST_PARALLEL_LOOPS 100
+
+/**
+ * DOC: fclkcfg test clock structure
+ *
+ * * struct fclkcfg_test_clk    - test target clock.
+ * * struct fclkcfg_test_device - test device and its clock tree.
+ *
+ * The fail_* counters make the next N operations fail. changes is the number
+ * of rate or parent changes done while the target clock was enabled, which
+ * must stay 0 since fclkcfg gates the clock around every change.
+ */
+struct fclkcfg_test_clk {
+    struct clk_hw            hw;
+    u8                       parent;
+    unsigned int             div;
+    bool                     enabled;
+    int                      fail_prepare;
+    int                      fail_enable;
+    int                      fail_set_parent;
+    int                      fail_rate_change;
+    unsigned int             changes;
+    struct clk*              notifier_clk;
+    struct notifier_block    notifier;
+};
+
+struct fclkcfg_test_device {
+    char                     name[32];
+    struct clk_hw*           refs[2];
+    struct fclkcfg_test_clk  tclk;
+    bool                     tclk_done;
+    struct fclk_device_data* data;
+};
+
+#define to_test_clk(_hw) container_of(_hw, struct fclkcfg_test_clk, hw)
+
+static atomic_t fclkcfg_test_device_count = ATOMIC_INIT(0);
+
+/**
+ * DOC: fclkcfg test clock operations
+ *
+ * * fclkcfg_test_inject_failure()  - consume injected failure count.
+ * * fclkcfg_test_clk_ops           - test target clock operations.
+ * * fclkcfg_test_clk_notify()      - fail rate changes on request.
+ */
+
+/**
+ * fclkcfg_test_inject_failure() - consume injected failure count.
+ *
+ * @failures:   address of failure count.
+ * Return:      true if the operation should fail.
+ */
+static bool fclkcfg_test_inject_failure(int* failures)
+{
+    if (READ_ONCE(*failures) <= 0)
+        return false;
+    WRITE_ONCE(*failures, READ_ONCE(*failures) - 1);
+    return true;
+}
+
+static int fclkcfg_test_clk_prepare(struct clk_hw* hw)
+{
+    return (fclkcfg_test_inject_failure(&to_test_clk(hw)->fail_prepare)) ? -EIO : 0;
+}
+
+static int fclkcfg_test_clk_enable(struct clk_hw* hw)
+{
+    struct fclkcfg_test_clk* tclk = to_test_clk(hw);
+
+    if (fclkcfg_test_inject_failure(&tclk->fail_enable))
+        return -EIO;
+    tclk->enabled = true;
+    return 0;
+}
+
+static void fclkcfg_test_clk_disable(struct clk_hw* hw)
+{
+    to_test_clk(hw)->enabled = false;
+}
+
+static unsigned long fclkcfg_test_clk_recalc_rate(struct clk_hw* hw, unsigned long parent_rate)
+{
+    return parent_rate / to_test_clk(hw)->div;
+}
+
+static unsigned int fclkcfg_test_clk_div(unsigned long rate, unsigned long parent_rate)
+{
+    unsigned long div = (rate == 0) ? FCLKCFG_TEST_DIV_MAX : DIV_ROUND_CLOSEST(parent_rate, rate);
+    return clamp_t(unsigned long, div, 1, FCLKCFG_TEST_DIV_MAX);
+}
+
+static int fclkcfg_test_clk_determine_rate(struct clk_hw* hw, struct clk_rate_request* req)
+{
+    req->rate = req->best_parent_rate / fclkcfg_test_clk_div(req->rate, req->best_parent_rate);
+    return 0;
+}
+
+static int fclkcfg_test_clk_set_rate(struct clk_hw* hw, unsigned long rate, unsigned long parent_rate)
+{
+    struct fclkcfg_test_clk* tclk = to_test_clk(hw);
+
+    if (tclk->enabled)
+        tclk->changes++;
+    tclk->div = fclkcfg_test_clk_div(rate, parent_rate);
+    return 0;
+}
+
+static u8 fclkcfg_test_clk_get_parent(struct clk_hw* hw)
+{
+    return to_test_clk(hw)->parent;
+}
+
+static int fclkcfg_test_clk_set_parent(struct clk_hw* hw, u8 index)
+{
+    struct fclkcfg_test_clk* tclk = to_test_clk(hw);
+
+    if (fclkcfg_test_inject_failure(&tclk->fail_set_parent))
+        return -EIO;
+    if (tclk->enabled)
+        tclk->changes++;
+    tclk->parent = index;
+    return 0;
+}
+
+static const struct clk_ops fclkcfg_test_clk_ops = {
+    .prepare        = fclkcfg_test_clk_prepare,
+    .enable         = fclkcfg_test_clk_enable,
+    .disable        = fclkcfg_test_clk_disable,
+    .recalc_rate    = fclkcfg_test_clk_recalc_rate,
+    .determine_rate = fclkcfg_test_clk_determine_rate,
+    .set_rate       = fclkcfg_test_clk_set_rate,
+    .get_parent     = fclkcfg_test_clk_get_parent,
+    .set_parent     = fclkcfg_test_clk_set_parent,
+};
+
+/**
+ * fclkcfg_test_clk_notify() - fail rate changes on request.
+ *
+ * The clock framework ignores the return value of .set_rate, so a failed
+ * clk_set_rate() is injected by refusing the PRE_RATE_CHANGE notification.
+ */
+static int fclkcfg_test_clk_notify(struct notifier_block* nb, unsigned long event, void* data)
+{
+    struct fclkcfg_test_clk* tclk = container_of(nb, struct fclkcfg_test_clk, notifier);
+
+    if ((event == PRE_RATE_CHANGE) && fclkcfg_test_inject_failure(&tclk->fail_rate_change))
+        return NOTIFY_BAD;
+    return NOTIFY_OK;
+}
+
+/**
+ * DOC: fclkcfg test device operations
+ *
+ * * fclkcfg_test_device_destroy() - destroy test device and its clock tree.
+ * * fclkcfg_test_device_create()  - create test device and its clock tree.
+ * * fclkcfg_test_change()         - change clock state of test device.
+ * * fclkcfg_test_state()          - make clock state.
+ * * fclkcfg_test_expect()         - check clock state of test device.
+ */
+
+/**
+ * fclkcfg_test_device_destroy() - destroy test device and its clock tree.
+ *
+ * @tdev:       Pointer to the test device.
+ *
+ * The clocks are disabled first, as fclkcfg_config_disable() does with a
+ * remove state of "enable=0".
+ */
+static void fclkcfg_test_device_destroy(struct fclkcfg_test_device* tdev)
+{
+    struct fclkcfg_test_clk* tclk = &tdev->tclk;
+    int                      i;
+
+    if (tdev->data != NULL) {
+        struct fclk_state state;
+        fclk_state_clear(&state);
+        state.enable_valid = true;
+        mutex_lock(&tdev->data->lock);
+        __fclk_change_state(tdev->data, &state);
+        mutex_unlock(&tdev->data->lock);
+        fclkcfg_device_destroy(tdev->data);
+        tdev->data = NULL;
+    }
+    if (tclk->notifier_clk != NULL) {
+        clk_notifier_unregister(tclk->notifier_clk, &tclk->notifier);
+        clk_put(tclk->notifier_clk);
+        tclk->notifier_clk = NULL;
+    }
+    if (tdev->tclk_done == true) {
+        clk_hw_unregister(&tclk->hw);
+        tdev->tclk_done = false;
+    }
+    for (i = 0; i < 2; i++) {
+        if (!IS_ERR_OR_NULL(tdev->refs[i]))
+            clk_hw_unregister_fixed_rate(tdev->refs[i]);
+        tdev->refs[i] = NULL;
+    }
+}
+
+/**
+ * fclkcfg_test_device_create() - create test device and its clock tree.
+ *
+ * @tdev:       Pointer to the test device.
+ * @enable:     insert enable state.
+ * Return:      Success(=0) or error status(<0).
+ *
+ * The fclk device data is built as fclkcfg_config_enable() does, with
+ * target and resource clocks taken from the test clock tree.
+ */
+static int fclkcfg_test_device_create(struct fclkcfg_test_device* tdev, bool enable)
+{
+    static const unsigned long ref_rates[2] = {FCLKCFG_TEST_REF0_RATE, FCLKCFG_TEST_REF1_RATE};
+    struct fclkcfg_test_clk*   tclk = &tdev->tclk;
+    struct fclk_device_data*   this;
+    struct fclk_device_data*   data;
+    const struct clk_hw*       parents[2];
+    struct clk_init_data       init;
+    char                       name[48];
+    int                        retval;
+    int                        i;
+
+    memset(tdev, 0, sizeof(*tdev));
+    snprintf(tdev->name, sizeof(tdev->name), "fclkcfg-test%d", atomic_inc_return(&fclkcfg_test_device_count));
+
+    for (i = 0; i < 2; i++) {
+        snprintf(name, sizeof(name), "%s-ref%d", tdev->name, i);
+        tdev->refs[i] = clk_hw_register_fixed_rate(NULL, name, NULL, 0, ref_rates[i]);
+        if (IS_ERR(tdev->refs[i])) {
+            retval = PTR_ERR(tdev->refs[i]);
+            goto failed;
+        }
+        parents[i] = tdev->refs[i];
+    }
+
+    memset(&init, 0, sizeof(init));
+    init.name        = tdev->name;
+    init.ops         = &fclkcfg_test_clk_ops;
+    init.parent_hws  = parents;
+    init.num_parents = 2;
+    tclk->parent     = 0;
+    tclk->div        = 1;
+    tclk->hw.init    = &init;
+    retval = clk_hw_register(NULL, &tclk->hw);
+    if (retval)
+        goto failed;
+    tdev->tclk_done = true;
+
+    tclk->notifier.notifier_call = fclkcfg_test_clk_notify;
+    tclk->notifier_clk = clk_hw_get_clk(&tclk->hw, "notifier");
+    if (IS_ERR(tclk->notifier_clk)) {
+        retval = PTR_ERR(tclk->notifier_clk);
+        tclk->notifier_clk = NULL;
+        goto failed;
+    }
+    retval = clk_notifier_register(tclk->notifier_clk, &tclk->notifier);
+    if (retval) {
+        clk_put(tclk->notifier_clk);
+        tclk->notifier_clk = NULL;
+        goto failed;
+    }
+
+    this = kzalloc(sizeof(*this), GFP_KERNEL);
+    if (this == NULL) {
+        retval = -ENOMEM;
+        goto failed;
+    }
+    fclk_device_init(this);
+    this->target.clk = clk_hw_get_clk(&tclk->hw, "target");
+    if (IS_ERR(this->target.clk)) {
+        retval = PTR_ERR(this->target.clk);
+        this->target.clk = NULL;
+        goto put;
+    }
+    this->resource_clks = kcalloc(2, sizeof(struct clk*), GFP_KERNEL);
+    if (this->resource_clks == NULL) {
+        retval = -ENOMEM;
+        goto put;
+    }
+    this->target.resource_clk_id = -1;   /* Uninitialized resclk flag */
+    for (i = 0; i < 2; i++) {
+        struct clk* resource_clk = clk_hw_get_clk(tdev->refs[i], "resource");
+        if (IS_ERR(resource_clk)) {
+            retval = PTR_ERR(resource_clk);
+            goto put;
+        }
+        this->resource_clks[this->resource_clks_size++] = resource_clk;
+    }
+    fclk_state_clear(&this->insert);
+    this->insert.rate         = FCLKCFG_TEST_INSERT_RATE;
+    this->insert.rate_valid   = true;
+    this->insert.enable       = enable;
+    this->insert.enable_valid = true;
+    this->insert.resclk       = 0;
+    this->insert.resclk_valid = true;
+    fclk_state_clear(&this->remove);
+
+    data = fclkcfg_device_create(NULL, tdev->name, this);
+    if (IS_ERR_OR_NULL(data)) {
+        retval = (PTR_ERR(data) == 0) ? -EINVAL : PTR_ERR(data);
+        goto failed;
+    }
+    tdev->data = data;
+    return 0;
+
+ put:
+    fclk_device_cleanup(this);
+    fclk_device_put(this);
+ failed:
+    fclkcfg_test_device_destroy(tdev);
+    return retval;
+}
+
+/**
+ * fclkcfg_test_change() - change clock state of test device.
+ *
+ * @tdev:       Pointer to the test device.
+ * @next:       next state to change.
+ * Return:      Success(=0) or error status(<0).
+ */
+static int fclkcfg_test_change(struct fclkcfg_test_device* tdev, struct fclk_state* next)
+{
+    int retval;
+
+    mutex_lock(&tdev->data->lock);
+    retval = __fclk_change_state(tdev->data, next);
+    mutex_unlock(&tdev->data->lock);
+    return retval;
+}
+
+/**
+ * fclkcfg_test_state() - make clock state.
+ *
+ * @state:      address of fclk state data.
+ * @rate:       rate, or 0 to keep the rate.
+ * @enable:     enable, or -1 to keep the enable.
+ * @resclk:     resource clock index, or -1 to keep the resource clock.
+ */
+static void fclkcfg_test_state(struct fclk_state* state, unsigned long rate, int enable, int resclk)
+{
+    fclk_state_clear(state);
+    state->rate         = rate;
+    state->rate_valid   = (rate != 0);
+    state->enable       = (enable > 0);
+    state->enable_valid = (enable >= 0);
+    state->resclk       = (resclk >= 0) ? resclk : 0;
+    state->resclk_valid = (resclk >= 0);
+}
+
+/**
+ * fclkcfg_test_expect() - check clock state of test device.
+ *
+ * @test:       kunit test.
+ * @tdev:       Pointer to the test device.
+ * @rate:       expected rate.
+ * @enable:     expected enable.
+ * @resclk:     expected resource clock index.
+ */
+static void fclkcfg_test_expect(struct kunit* test, struct fclkcfg_test_device* tdev, unsigned long rate, bool enable, int resclk)
+{
+    struct fclk_device_data* this = tdev->data;
+
+    KUNIT_EXPECT_EQ(test, clk_get_rate(this->target.clk), rate);
+    KUNIT_EXPECT_EQ(test, __clk_is_enabled(this->target.clk), enable);
+    KUNIT_EXPECT_EQ(test, tdev->tclk.enabled, enable);
+    KUNIT_EXPECT_EQ(test, (int)tdev->tclk.parent, resclk);
+    KUNIT_EXPECT_EQ(test, this->target.resource_clk_id, resclk);
+    KUNIT_EXPECT_EQ(test, this->target.enable_refs, (enable) ? 1U : 0U);
+    KUNIT_EXPECT_EQ(test, tdev->tclk.changes, 0U);
+}
+
+/**
+ * DOC: fclkcfg test cases
+ *
+ * * fclkcfg_test_init()              - create test device.
+ * * fclkcfg_test_exit()              - destroy test device.
+ * * fclkcfg_test_change_state()      - every combination of valid flags.
+ * * fclkcfg_test_rate_max()          - highest rate within max_rate.
+ * * fclkcfg_test_set_rate_failure()  - rollback after set rate failure.
+ * * fclkcfg_test_set_parent_failure() - rollback after set parent failure.
+ * * fclkcfg_test_enable_failure()    - rollback after enable failure.
+ * * fclkcfg_test_prepare_failure()   - enable failure without transition.
+ * * fclkcfg_test_foreign_enable()    - clock enabled by another consumer.
+ * * fclkcfg_test_removed()           - device held after destroy.
+ * * fclkcfg_test_benchmark()         - time of each kind of transition.
+ * * fclkcfg_test_parallel()          - transitions of several devices in parallel.
+ */
+
+/**
+ * struct fclkcfg_test_param - parameter of fclkcfg_test_change_state().
+ *
+ * The device is inserted with @enable, then changed with the fields of the
+ * next state selected by the valid flags: 50MHz, the other enable and
+ * resource 1.
+ */
+struct fclkcfg_test_param {
+    bool                     rate_valid;
+    bool                     enable_valid;
+    bool                     resclk_valid;
+    bool                     enable;
+};
+
+static const struct fclkcfg_test_param fclkcfg_test_params[] = {
+    {false, false, false, false}, {false, false, false, true},
+    {false, false, true , false}, {false, false, true , true},
+    {false, true , false, false}, {false, true , false, true},
+    {false, true , true , false}, {false, true , true , true},
+    {true , false, false, false}, {true , false, false, true},
+    {true , false, true , false}, {true , false, true , true},
+    {true , true , false, false}, {true , true , false, true},
+    {true , true , true , false}, {true , true , true , true},
+};
+
+static void fclkcfg_test_param_desc(const struct fclkcfg_test_param* param, char* desc)
+{
+    snprintf(desc, KUNIT_PARAM_DESC_SIZE, "rate_valid=%d enable_valid=%d resclk_valid=%d enable=%d",
+             param->rate_valid, param->enable_valid, param->resclk_valid, param->enable);
+}
+
+KUNIT_ARRAY_PARAM(fclkcfg_test_change_state, fclkcfg_test_params, fclkcfg_test_param_desc);
+
+static int fclkcfg_test_init(struct kunit* test)
+{
+    const struct fclkcfg_test_param* param = test->param_value;
+    struct fclkcfg_test_device*      tdev;
+    int                              retval;
+
+    tdev = kunit_kzalloc(test, sizeof(*tdev), GFP_KERNEL);
+    if (tdev == NULL)
+        return -ENOMEM;
+    retval = fclkcfg_test_device_create(tdev, (param != NULL) ? param->enable : true);
+    if (retval)
+        return retval;
+    test->priv = tdev;
+    return 0;
+}
+
+static void fclkcfg_test_exit(struct kunit* test)
+{
+    struct fclkcfg_test_device* tdev = test->priv;
+
+    if (tdev != NULL)
+        fclkcfg_test_device_destroy(tdev);
+}
+
+static void fclkcfg_test_change_state(struct kunit* test)
+{
+    const struct fclkcfg_test_param* param = test->param_value;
+    struct fclkcfg_test_device*      tdev  = test->priv;
+    struct fclk_transition_stat*     stat  = &tdev->data->transition_stat;
+    unsigned long                    gated = stat->gated_count;
+    bool                             transition;
+    bool                             enable;
+    int                              resclk;
+    unsigned long                    rate;
+    struct fclk_state                next;
+
+    fclkcfg_test_expect(test, tdev, FCLKCFG_TEST_INSERT_RATE, param->enable, 0);
+
+    fclkcfg_test_state(&next,
+                       (param->rate_valid  ) ? FCLKCFG_TEST_NEXT_RATE : 0,
+                       (param->enable_valid) ? !param->enable : -1,
+                       (param->resclk_valid) ? 1 : -1);
+    KUNIT_ASSERT_EQ(test, fclkcfg_test_change(tdev, &next), 0);
+
+    transition = (param->rate_valid || param->resclk_valid);
+    enable     = (param->enable_valid) ? !param->enable : param->enable;
+    resclk     = (param->resclk_valid) ? 1 : 0;
+    rate       = (param->rate_valid) ? FCLKCFG_TEST_NEXT_RATE :
+                 ((resclk == 0) ? FCLKCFG_TEST_REF0_RATE : FCLKCFG_TEST_REF1_RATE) / 4;
+    fclkcfg_test_expect(test, tdev, rate, enable, resclk);
+    KUNIT_EXPECT_EQ(test, stat->gated_count - gated, (transition && param->enable) ? 1UL : 0UL);
+    KUNIT_EXPECT_EQ(test, stat->failures, 0UL);
+}
+
+static void fclkcfg_test_rate_max(struct kunit* test)
+{
+    struct fclkcfg_test_device* tdev = test->priv;
+    struct fclk_state           next;
+
+    fclk_state_clear(&next);
+    next.rate_max = true;
+    KUNIT_ASSERT_EQ(test, fclkcfg_test_change(tdev, &next), 0);
+    fclkcfg_test_expect(test, tdev, FCLKCFG_TEST_REF0_RATE, true, 0);
+
+    mutex_lock(&tdev->data->lock);
+    tdev->data->max_rate = 350000000UL;
+    mutex_unlock(&tdev->data->lock);
+    KUNIT_ASSERT_EQ(test, fclkcfg_test_change(tdev, &next), 0);
+    fclkcfg_test_expect(test, tdev, FCLKCFG_TEST_REF1_RATE, true, 1);
+
+    /* with the resource fixed, only the divider is changed */
+    next.resclk       = 0;
+    next.resclk_valid = true;
+    KUNIT_ASSERT_EQ(test, fclkcfg_test_change(tdev, &next), 0);
+    fclkcfg_test_expect(test, tdev, FCLKCFG_TEST_REF0_RATE / 2, true, 0);
+}
+
+static void fclkcfg_test_set_rate_failure(struct kunit* test)
+{
+    struct fclkcfg_test_device* tdev = test->priv;
+    struct fclk_transition_stat* stat = &tdev->data->transition_stat;
+    struct fclk_state           next;
+
+    tdev->tclk.fail_rate_change = 1;
+    fclkcfg_test_state(&next, FCLKCFG_TEST_NEXT_RATE, -1, -1);
+    KUNIT_EXPECT_LT(test, fclkcfg_test_change(tdev, &next), 0);
+    fclkcfg_test_expect(test, tdev, FCLKCFG_TEST_INSERT_RATE, true, 0);
+    KUNIT_EXPECT_EQ(test, stat->failures , 1UL);
+    KUNIT_EXPECT_EQ(test, stat->rollbacks, 1UL);
+
+    /* the failure is not left behind, the same change succeeds next time */
+    fclkcfg_test_state(&next, FCLKCFG_TEST_NEXT_RATE, -1, 1);
+    KUNIT_ASSERT_EQ(test, fclkcfg_test_change(tdev, &next), 0);
+    fclkcfg_test_expect(test, tdev, FCLKCFG_TEST_NEXT_RATE, true, 1);
+}
+
+static void fclkcfg_test_set_parent_failure(struct kunit* test)
+{
+    struct fclkcfg_test_device* tdev = test->priv;
+    struct fclk_state           next;
+
+    tdev->tclk.fail_set_parent = 1;
+    fclkcfg_test_state(&next, 0, -1, 1);
+    KUNIT_EXPECT_EQ(test, fclkcfg_test_change(tdev, &next), -EIO);
+    fclkcfg_test_expect(test, tdev, FCLKCFG_TEST_INSERT_RATE, true, 0);
+    KUNIT_EXPECT_EQ(test, tdev->data->transition_stat.rollbacks, 1UL);
+}
+
+static void fclkcfg_test_enable_failure(struct kunit* test)
+{
+    struct fclkcfg_test_device* tdev = test->priv;
+    struct fclk_state           next;
+
+    /* the clock can not be started again after the rate change */
+    tdev->tclk.fail_enable = 1;
+    fclkcfg_test_state(&next, FCLKCFG_TEST_NEXT_RATE, -1, -1);
+    KUNIT_EXPECT_EQ(test, fclkcfg_test_change(tdev, &next), -EIO);
+    fclkcfg_test_expect(test, tdev, FCLKCFG_TEST_INSERT_RATE, true, 0);
+    KUNIT_EXPECT_EQ(test, tdev->data->transition_stat.rollbacks, 1UL);
+
+    /* an enable alone is not rolled back, the clock stays stopped */
+    fclkcfg_test_state(&next, 0, 0, -1);
+    KUNIT_ASSERT_EQ(test, fclkcfg_test_change(tdev, &next), 0);
+    tdev->tclk.fail_enable = 1;
+    fclkcfg_test_state(&next, 0, 1, -1);
+    KUNIT_EXPECT_EQ(test, fclkcfg_test_change(tdev, &next), -EIO);
+    fclkcfg_test_expect(test, tdev, FCLKCFG_TEST_INSERT_RATE, false, 0);
+    KUNIT_EXPECT_EQ(test, tdev->data->target.prepare_refs, 0U);
+}
+
+static void fclkcfg_test_prepare_failure(struct kunit* test)
+{
+    struct fclkcfg_test_device* tdev = test->priv;
+    struct fclk_state           next;
+
+    fclkcfg_test_state(&next, 0, 0, -1);
+    KUNIT_ASSERT_EQ(test, fclkcfg_test_change(tdev, &next), 0);
+
+    tdev->tclk.fail_prepare = 1;
+    fclkcfg_test_state(&next, FCLKCFG_TEST_NEXT_RATE, 1, -1);
+    KUNIT_EXPECT_EQ(test, fclkcfg_test_change(tdev, &next), -EIO);
+    fclkcfg_test_expect(test, tdev, FCLKCFG_TEST_INSERT_RATE, false, 0);
+    KUNIT_EXPECT_EQ(test, tdev->data->target.prepare_refs, 0U);
+
+    KUNIT_ASSERT_EQ(test, fclkcfg_test_change(tdev, &next), 0);
+    fclkcfg_test_expect(test, tdev, FCLKCFG_TEST_NEXT_RATE, true, 0);
+}
+
+static void fclkcfg_test_foreign_enable(struct kunit* test)
+{
+    struct fclkcfg_test_device* tdev = test->priv;
+    struct fclk_device_data*    this = tdev->data;
+    struct fclk_state           next;
+    struct clk*                 clk;
+
+    clk = clk_hw_get_clk(&tdev->tclk.hw, "foreign");
+    KUNIT_ASSERT_FALSE(test, IS_ERR(clk));
+    KUNIT_ASSERT_EQ(test, clk_prepare_enable(clk), 0);
+    KUNIT_EXPECT_EQ(test, __fclk_foreign_enable_count(&this->target), 1U);
+
+    /* the clock can not be gated, the change is refused and the reference kept */
+    fclkcfg_test_state(&next, FCLKCFG_TEST_NEXT_RATE, -1, -1);
+    KUNIT_EXPECT_EQ(test, fclkcfg_test_change(tdev, &next), -EBUSY);
+    KUNIT_EXPECT_EQ(test, this->target.enable_refs, 1U);
+
+    /* the disable drops the reference of fclkcfg, the clock keeps running */
+    fclkcfg_test_state(&next, 0, 0, -1);
+    KUNIT_EXPECT_EQ(test, fclkcfg_test_change(tdev, &next), -EBUSY);
+    KUNIT_EXPECT_EQ(test, this->target.enable_refs, 0U);
+    KUNIT_EXPECT_EQ(test, __fclk_foreign_enable_count(&this->target), 1U);
+
+    /* a refused change does not take a reference that fclkcfg did not hold */
+    fclkcfg_test_state(&next, FCLKCFG_TEST_NEXT_RATE, -1, -1);
+    KUNIT_EXPECT_EQ(test, fclkcfg_test_change(tdev, &next), -EBUSY);
+    KUNIT_EXPECT_EQ(test, this->target.enable_refs, 0U);
+    KUNIT_EXPECT_EQ(test, clk_get_rate(this->target.clk), FCLKCFG_TEST_INSERT_RATE);
+    KUNIT_EXPECT_EQ(test, tdev->tclk.changes, 0U);
+
+    clk_disable_unprepare(clk);
+    clk_put(clk);
+    KUNIT_EXPECT_EQ(test, __fclk_foreign_enable_count(&this->target), 0U);
+    KUNIT_ASSERT_EQ(test, fclkcfg_test_change(tdev, &next), 0);
+    fclkcfg_test_expect(test, tdev, FCLKCFG_TEST_NEXT_RATE, false, 0);
+}
+
+static void fclkcfg_test_rate_ratio(struct kunit* test)
+{
+    struct fclkcfg_test_device* tdev = test->priv;
+    struct fclkcfg_test_device* linked;
+    struct fclk_state           next;
+
+    linked = kunit_kzalloc(test, sizeof(*linked), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, linked);
+    KUNIT_ASSERT_EQ(test, fclkcfg_test_device_create(linked, true), 0);
+
+    /* linked runs at half the rate of tdev */
+    mutex_lock(&linked->data->lock);
+    linked->data->ratio_device = kstrdup(tdev->name, GFP_KERNEL);
+    linked->data->ratio_num    = 1;
+    linked->data->ratio_den    = 2;
+    mutex_unlock(&linked->data->lock);
+    fclkcfg_ratio_update();
+    KUNIT_EXPECT_TRUE(test, tdev->data->ratio_linked);
+    KUNIT_EXPECT_TRUE(test, linked->data->ratio_linked);
+
+    /* a change of one device alone is refused */
+    fclkcfg_test_state(&next, FCLKCFG_TEST_NEXT_RATE, -1, -1);
+    KUNIT_EXPECT_EQ(test, fclkcfg_test_change(tdev  , &next), -EBUSY);
+    KUNIT_EXPECT_EQ(test, fclkcfg_test_change(linked, &next), -EBUSY);
+    fclk_state_clear(&next);
+    next.rate_max = true;
+    KUNIT_EXPECT_EQ(test, fclkcfg_test_change(tdev, &next), -EBUSY);
+    fclkcfg_test_expect(test, tdev  , FCLKCFG_TEST_INSERT_RATE, true, 0);
+    fclkcfg_test_expect(test, linked, FCLKCFG_TEST_INSERT_RATE, true, 0);
+
+    /* a change solved with the rate ratios is applied to both */
+    KUNIT_EXPECT_EQ(test, fclkcfg_ratio_set_rate(tdev->data, FCLKCFG_TEST_REF0_RATE / 2), 0);
+    fclkcfg_test_expect(test, tdev  , FCLKCFG_TEST_REF0_RATE / 2, true, 0);
+    fclkcfg_test_expect(test, linked, FCLKCFG_TEST_REF0_RATE / 4, true, 0);
+
+    mutex_lock(&linked->data->lock);
+    kfree(linked->data->ratio_device);
+    linked->data->ratio_device = NULL;
+    mutex_unlock(&linked->data->lock);
+    fclkcfg_ratio_update();
+    KUNIT_EXPECT_FALSE(test, tdev->data->ratio_linked);
+    KUNIT_EXPECT_EQ(test, fclkcfg_ratio_set_rate(tdev->data, FCLKCFG_TEST_NEXT_RATE), -ENOENT);
+    fclkcfg_test_state(&next, FCLKCFG_TEST_NEXT_RATE, -1, -1);
+    KUNIT_EXPECT_EQ(test, fclkcfg_test_change(tdev, &next), 0);
+    fclkcfg_test_expect(test, tdev, FCLKCFG_TEST_NEXT_RATE, true, 0);
+
+    fclkcfg_test_device_destroy(linked);
+}
+
+static void fclkcfg_test_removed(struct kunit* test)
+{
+    struct fclkcfg_test_device* tdev = test->priv;
+    struct fclk_device_data*    this;
+    struct fclk_state           next;
+
+    this = fclkcfg_get(tdev->name);
+    KUNIT_ASSERT_PTR_EQ(test, this, tdev->data);
+
+    mutex_lock(&this->lock);
+    __fclk_set_keep_prepared(this, true);
+    mutex_unlock(&this->lock);
+    KUNIT_EXPECT_EQ(test, fclkcfg_disable_atomic(this), 0);
+    KUNIT_EXPECT_EQ(test, fclkcfg_enable_atomic(this) , 0);
+
+    fclkcfg_test_state(&next, 0, 0, -1);
+    KUNIT_ASSERT_EQ(test, fclkcfg_test_change(tdev, &next), 0);
+    fclkcfg_device_destroy(tdev->data);
+    tdev->data = NULL;
+
+    KUNIT_EXPECT_PTR_EQ(test, fclkcfg_get(tdev->name), (struct fclk_device_data*)NULL);
+    KUNIT_EXPECT_EQ(test, fclkcfg_enable_atomic(this) , -ENODEV);
+    KUNIT_EXPECT_EQ(test, fclkcfg_disable_atomic(this), -ENODEV);
+    mutex_lock(&this->lock);
+    KUNIT_EXPECT_EQ(test, __fclk_change_state(this, &next), -ENODEV);
+    mutex_unlock(&this->lock);
+    fclkcfg_put(this);
+}
+
+/**
+ * fclkcfg_test_bench() - measure time of transitions.
+ *
+ * @test:       kunit test.
+ * @tdev:       Pointer to the test device.
+ * @label:      name of the kind of transition.
+ * @state:      two states, changed alternately.
+ */
+static void fclkcfg_test_bench(struct kunit* test, struct fclkcfg_test_device* tdev, const char* label, struct fclk_state* state)
+{
+    s64 total_ns = 0;
+    s64 min_ns   = S64_MAX;
+    s64 max_ns   = 0;
+    int i;
+
+    for (i = 0; i < FCLKCFG_TEST_BENCH_LOOPS; i++) {
+        ktime_t start = ktime_get();
+        int     retval;
+        s64     elapsed;
+
+        retval  = fclkcfg_test_change(tdev, &state[i & 1]);
+        elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+        KUNIT_ASSERT_EQ(test, retval, 0);
+        total_ns += elapsed;
+        min_ns    = min(min_ns, elapsed);
+        max_ns    = max(max_ns, elapsed);
+    }
+    kunit_info(test, "%-8s: %d transitions, avg %lld ns, min %lld ns, max %lld ns\n",
+               label, FCLKCFG_TEST_BENCH_LOOPS,
+               (long long)div_s64(total_ns, FCLKCFG_TEST_BENCH_LOOPS), (long long)min_ns, (long long)max_ns);
+}
+
+static void fclkcfg_test_benchmark(struct kunit* test)
+{
+    struct fclkcfg_test_device* tdev = test->priv;
+    struct fclk_state           state[2];
+
+    fclkcfg_test_state(&state[0], 0, -1, -1);
+    fclkcfg_test_state(&state[1], 0, -1, -1);
+    fclkcfg_test_bench(test, tdev, "none"    , state);
+
+    fclkcfg_test_state(&state[0], 0, 0, -1);
+    fclkcfg_test_state(&state[1], 0, 1, -1);
+    fclkcfg_test_bench(test, tdev, "enable"  , state);
+
+    fclkcfg_test_state(&state[0], FCLKCFG_TEST_NEXT_RATE  , -1, -1);
+    fclkcfg_test_state(&state[1], FCLKCFG_TEST_INSERT_RATE, -1, -1);
+    fclkcfg_test_bench(test, tdev, "rate"    , state);
+
+    fclkcfg_test_state(&state[0], FCLKCFG_TEST_INSERT_RATE, -1, 1);
+    fclkcfg_test_state(&state[1], FCLKCFG_TEST_INSERT_RATE, -1, 0);
+    fclkcfg_test_bench(test, tdev, "resource", state);
+
+    fclkcfg_test_expect(test, tdev, FCLKCFG_TEST_INSERT_RATE, true, 0);
+    KUNIT_EXPECT_EQ(test, tdev->data->transition_stat.failures, 0UL);
+}
+
+/**
+ * struct fclkcfg_test_worker - thread of fclkcfg_test_parallel().
+ */
+struct fclkcfg_test_worker {
+    struct fclkcfg_test_device* tdev;
+    struct completion           done;
+    int                         failures;
+    int                         retval;
+};
+
+/**
+ * fclkcfg_test_parallel_thread() - change the state of one device repeatedly.
+ *
+ * @arg:        Pointer to the worker.
+ *
+ * The rate alternates between 50MHz and 100MHz, and the resource clock
+ * changes every two transitions, so the last state is 100MHz on resource 1.
+ */
+static int fclkcfg_test_parallel_thread(void* arg)
+{
+    struct fclkcfg_test_worker* worker = arg;
+    struct fclk_state           next;
+    int                         i;
+
+    for (i = 0; i < FCLKCFG_TEST_PARALLEL_LOOPS; i++) {
+        int retval;
+        fclkcfg_test_state(&next,
+                           (i & 1) ? FCLKCFG_TEST_INSERT_RATE : FCLKCFG_TEST_NEXT_RATE,
+                           -1, (i >> 1) & 1);
+        retval = fclkcfg_test_change(worker->tdev, &next);
+        if (retval) {
+            worker->failures++;
+            worker->retval = retval;
+        }
+    }
+    complete(&worker->done);
+    return 0;
+}
+
+static void fclkcfg_test_parallel(struct kunit* test)
+{
+    struct fclkcfg_test_device* tdevs;
+    struct fclkcfg_test_worker* workers;
+    unsigned long               counts[FCLKCFG_TEST_PARALLEL_DEVICES];
+    int                         created = 0;
+    ktime_t                     start;
+    s64                         elapsed;
+    int                         i;
+
+    tdevs   = kunit_kcalloc(test, FCLKCFG_TEST_PARALLEL_DEVICES, sizeof(*tdevs)  , GFP_KERNEL);
+    workers = kunit_kcalloc(test, FCLKCFG_TEST_PARALLEL_DEVICES, sizeof(*workers), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, tdevs);
+    KUNIT_ASSERT_NOT_NULL(test, workers);
+
+    for (created = 0; created < FCLKCFG_TEST_PARALLEL_DEVICES; created++) {
+        int retval = fclkcfg_test_device_create(&tdevs[created], true);
+        KUNIT_EXPECT_EQ(test, retval, 0);
+        if (retval)
+            goto destroy;
+        counts[created] = tdevs[created].data->transition_stat.count;
+    }
+
+    start = ktime_get();
+    for (i = 0; i < FCLKCFG_TEST_PARALLEL_DEVICES; i++) {
+        struct task_struct* task;
+        workers[i].tdev = &tdevs[i];
+        init_completion(&workers[i].done);
+        task = kthread_run(fclkcfg_test_parallel_thread, &workers[i], "%s", tdevs[i].name);
+        if (IS_ERR(task)) {
+            workers[i].failures = FCLKCFG_TEST_PARALLEL_LOOPS;
+            workers[i].retval   = PTR_ERR(task);
+            complete(&workers[i].done);
+        }
+    }
+    for (i = 0; i < FCLKCFG_TEST_PARALLEL_DEVICES; i++)
+        wait_for_completion(&workers[i].done);
+    elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+    kunit_info(test, "%d devices: %d transitions each, %lld ns in total\n",
+               FCLKCFG_TEST_PARALLEL_DEVICES, FCLKCFG_TEST_PARALLEL_LOOPS, (long long)elapsed);
+
+    for (i = 0; i < FCLKCFG_TEST_PARALLEL_DEVICES; i++) {
+        struct fclk_transition_stat* stat = &tdevs[i].data->transition_stat;
+        KUNIT_EXPECT_EQ_MSG(test, workers[i].failures, 0, "%s failed(%d)", tdevs[i].name, workers[i].retval);
+        KUNIT_EXPECT_EQ(test, stat->count - counts[i], (unsigned long)FCLKCFG_TEST_PARALLEL_LOOPS);
+        KUNIT_EXPECT_EQ(test, stat->failures, 0UL);
+        fclkcfg_test_expect(test, &tdevs[i], FCLKCFG_TEST_INSERT_RATE, true, 1);
+    }
+
+ destroy:
+    while (--created >= 0)
+        fclkcfg_test_device_destroy(&tdevs[created]);
+}
+
+static struct kunit_case fclkcfg_test_cases[] = {
+    KUNIT_CASE_PARAM(fclkcfg_test_change_state, fclkcfg_test_change_state_gen_params),
+    KUNIT_CASE(fclkcfg_test_rate_max),
+    KUNIT_CASE(fclkcfg_test_set_rate_failure),
+    KUNIT_CASE(fclkcfg_test_set_parent_failure),
+    KUNIT_CASE(fclkcfg_test_enable_failure),
+    KUNIT_CASE(fclkcfg_test_prepare_failure),
+    KUNIT_CASE(fclkcfg_test_foreign_enable),
+    KUNIT_CASE(fclkcfg_test_rate_ratio),
+    KUNIT_CASE(fclkcfg_test_removed),
+    KUNIT_CASE(fclkcfg_test_benchmark),
+    KUNIT_CASE(fclkcfg_test_parallel),
+    {}
+};
+
+static struct kunit_suite fclkcfg_test_suite = {
+    .name       = "fclkcfg",
+    .init       = fclkcfg_test_init,
+    .exit       = fclkcfg_test_exit,
+    .test_cases = fclkcfg_test_cases,
+};
+
+kunit_test_suite(fclkcfg_test_suite);